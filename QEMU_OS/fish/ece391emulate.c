@@ -176,6 +176,19 @@ ece391_vidmap (uint8_t** screen_start)
     return 0;
 }
 
+/* no back buffer under emulation, callers fall back to ece391_vidmap */
+int32_t
+ece391_vidmap_back (uint8_t** screen_start)
+{
+    return -1;
+}
+
+int32_t
+ece391_flip (void)
+{
+    return -1;
+}
+
 int32_t 
 ece391_read (int32_t fd, void* buf, int32_t nbytes)
 {
@@ -6,6 +6,8 @@
 #define NULL 0
 #define WAIT 100
 uint8_t *vmem_base_addr;
+/* set when drawing goes to a back buffer that has to be flipped */
+static int32_t double_buffered;
 uint8_t *mp1_set_video_mode (void);
 void add_frames(uint8_t *, uint8_t *, int32_t);
 void ece391_memset(void* memory, char c, int n);
@@ -41,6 +43,8 @@ int main(void)
     for(i=0; i<WAIT; i++) {
         ece391_read(rtc_fd, &garbage, 4);
         mp1_rtc_tasklet(garbage);
+        if (double_buffered)
+            ece391_flip();
     }
 
     blink_struct.on_char = 'I';
@@ -54,6 +58,8 @@ int main(void)
     for(i=0; i<WAIT; i++) {
         ece391_read(rtc_fd, &garbage, 4);
         mp1_rtc_tasklet(garbage);
+        if (double_buffered)
+            ece391_flip();
     }
 
     mp1_ioctl((40 << 16 | (6*80+60)), RTC_SYNC);
@@ -61,6 +67,8 @@ int main(void)
     for(i=0; i<WAIT; i++) {
         ece391_read(rtc_fd, &garbage, 4);
         mp1_rtc_tasklet(garbage);
+        if (double_buffered)
+            ece391_flip();
     }
 
     mp1_ioctl(6*80+60, RTC_REMOVE);
@@ -68,6 +76,8 @@ int main(void)
     for(i=0; i<WAIT; i++) {
         ece391_read(rtc_fd, &garbage, 4);
         mp1_rtc_tasklet(garbage);
+        if (double_buffered)
+            ece391_flip();
     }
 
     ece391_close(rtc_fd);
@@ -150,6 +160,11 @@ add_frames(uint8_t *f0, uint8_t *f1, int32_t rtc_fd)
 uint8_t*
 mp1_set_video_mode (void)
 {
+    /* draw off screen and flip once per tick so no half drawn frame shows */
+    if(ece391_vidmap_back(&vmem_base_addr) != -1) {
+        double_buffered = 1;
+        return vmem_base_addr;
+    }
     if(ece391_vidmap(&vmem_base_addr) == -1) {
         return NULL;
     } else {
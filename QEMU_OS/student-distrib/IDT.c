@@ -1,6 +1,8 @@
 
 #include "IDT.h"
 #include "inthandler.h"
+#include "apic.h"
+#include "smp.h"
 
 /*
  * populate_IDT
@@ -55,10 +57,18 @@ void populate_IDT ()
     SET_IDT_ENTRY(idt[18], MC_excpt);
     SET_IDT_ENTRY(idt[19], XF_excpt);
 
+    //set the PIT with vector 0x20
+    SET_IDT_ENTRY(idt[0x20], pit_interrupt);
     //set the kbd with vector 0x21
     SET_IDT_ENTRY(idt[0x21], kbd_interrupt);
     //set the RTC with vector 0x20
     SET_IDT_ENTRY(idt[0x28], rtc_interrupt);
+    //set the local APIC timer and spurious vectors
+    SET_IDT_ENTRY(idt[APIC_TIMER_VECTOR], apic_timer_interrupt);
+    SET_IDT_ENTRY(idt[APIC_SPURIOUS_VECTOR], apic_spurious_interrupt);
+    //set the interprocessor interrupts
+    SET_IDT_ENTRY(idt[IPI_RESCHED_VECTOR], resched_interrupt);
+    SET_IDT_ENTRY(idt[IPI_TLB_VECTOR], tlb_interrupt);
     //set SYSCALL with vector 0x80
     SET_IDT_ENTRY(idt[0x80], sys_call);
 
@@ -5,14 +5,21 @@
     // #define JMP_ESP  0x83FFFF0
 
     void kbd_interrupt();
+    // pointer to pit interrupt
+    void pit_interrupt();
     // pointer to rtc interrupt
     void rtc_interrupt();
+    // pointer to local APIC timer interrupt
+    void apic_timer_interrupt();
+    // pointer to local APIC spurious interrupt
+    void apic_spurious_interrupt();
     // pointer for syscalls
     void sys_call();
     // pointer for undefined interrupt
     void undef_interrupt();
-    // jump to user level
-    uint32_t jump_to_user(uint32_t start_point);
+    // pointers to the interprocessor interrupts
+    void resched_interrupt();
+    void tlb_interrupt();
 
 
 #endif //_LINKAGE_H
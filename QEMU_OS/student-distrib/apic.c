@@ -0,0 +1,506 @@
+// apic.c - local APIC and IOAPIC interrupt delivery
+//
+// The MP configuration table the BIOS leaves in low memory gives the local
+// APIC and IOAPIC addresses and which IOAPIC pin each ISA irq is wired to.
+// When it is found every 8259 line is masked and ISA irqs are routed
+// through the IOAPIC to the vector the 8259 would have used, so the IDT
+// does not change. enable_irq, disable_irq and send_eoi in i8259.c forward
+// here once apic_active is set. Without an MP table, or with USE_APIC 0,
+// the 8259 stays in charge.
+#include "apic.h"
+#include "i8259.h"
+#include "lib.h"
+#include "paging.h"
+#include "timer.h"
+
+int32_t apic_active;
+uint32_t lapic_timer_khz;
+uint8_t mp_cpu_ids[MAX_CPUS];
+int32_t mp_num_cpus;
+
+// MP floating pointer structure, found on a 16 byte boundary
+typedef struct mp_float_t {
+  char sig[4];              // "_MP_"
+  uint32_t config;          // physical address of the configuration table
+  uint8_t length;           // in 16 byte units
+  uint8_t spec;
+  uint8_t checksum;
+  uint8_t type;             // default configuration, 0 if there is a table
+  uint8_t imcr;             // bit 7 set if the IMCR is present
+  uint8_t reserved[3];
+} __attribute__((packed)) mp_float_t;
+
+// MP configuration table header, entries follow it
+typedef struct mp_config_t {
+  char sig[4];              // "PCMP"
+  uint16_t length;
+  uint8_t spec;
+  uint8_t checksum;
+  char oem[20];
+  uint32_t oem_table;
+  uint16_t oem_length;
+  uint16_t entries;
+  uint32_t lapic;           // physical address of the local APIC
+  uint16_t ext_length;
+  uint8_t ext_checksum;
+  uint8_t reserved;
+} __attribute__((packed)) mp_config_t;
+
+// processor entry
+typedef struct mp_cpu_t {
+  uint8_t type;
+  uint8_t apic_id;
+  uint8_t version;
+  uint8_t flags;            // bit 0 set if usable
+  uint8_t reserved[16];
+} __attribute__((packed)) mp_cpu_t;
+
+// bus entry, ISA buses are named "ISA   "
+typedef struct mp_bus_t {
+  uint8_t type;
+  uint8_t id;
+  char name[6];
+} __attribute__((packed)) mp_bus_t;
+
+// IOAPIC entry
+typedef struct mp_ioapic_t {
+  uint8_t type;
+  uint8_t id;
+  uint8_t version;
+  uint8_t flags;            // bit 0 set if usable
+  uint32_t addr;
+} __attribute__((packed)) mp_ioapic_t;
+
+// I/O interrupt assignment entry, wires a bus irq to an IOAPIC pin
+typedef struct mp_ioint_t {
+  uint8_t type;
+  uint8_t int_type;         // 0 for a vectored interrupt
+  uint16_t flags;           // bits 0-1 polarity, 2-3 trigger, 3 means low/level
+  uint8_t src_bus;
+  uint8_t src_irq;
+  uint8_t dst_apic;
+  uint8_t dst_pin;
+} __attribute__((packed)) mp_ioint_t;
+
+static volatile uint8_t* lapic_base;
+static volatile uint8_t* ioapic_base;
+// local APIC id of the boot CPU, every irq is sent to it
+static uint32_t bsp_id;
+// IOAPIC pin and polarity/trigger bits of each ISA irq
+static uint8_t irq_pin[NUM_ISA_IRQS];
+static uint32_t irq_mode[NUM_ISA_IRQS];
+
+/*
+ * lapic_read
+ *   DESCRIPTION: reads a local APIC register
+ *   INPUTS: reg - register offset
+ *   OUTPUTS: none
+ *   RETURN VALUE: register value
+ *   SIDE EFFECTS: none
+ */
+static uint32_t lapic_read(uint32_t reg)
+{
+  return *(volatile uint32_t*) (lapic_base + reg);
+}
+
+/*
+ * lapic_write
+ *   DESCRIPTION: writes a local APIC register
+ *   INPUTS: reg - register offset
+ *           val - value
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: device dependent
+ */
+static void lapic_write(uint32_t reg, uint32_t val)
+{
+  *(volatile uint32_t*) (lapic_base + reg) = val;
+}
+
+/*
+ * ioapic_read
+ *   DESCRIPTION: reads an IOAPIC register through the select/window pair
+ *   INPUTS: reg - register number
+ *   OUTPUTS: none
+ *   RETURN VALUE: register value
+ *   SIDE EFFECTS: changes the selected register
+ */
+static uint32_t ioapic_read(uint32_t reg)
+{
+  *(volatile uint32_t*) (ioapic_base + IOAPIC_REGSEL) = reg;
+  return *(volatile uint32_t*) (ioapic_base + IOAPIC_WIN);
+}
+
+/*
+ * ioapic_write
+ *   DESCRIPTION: writes an IOAPIC register through the select/window pair
+ *   INPUTS: reg - register number
+ *           val - value
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the selected register
+ */
+static void ioapic_write(uint32_t reg, uint32_t val)
+{
+  *(volatile uint32_t*) (ioapic_base + IOAPIC_REGSEL) = reg;
+  *(volatile uint32_t*) (ioapic_base + IOAPIC_WIN) = val;
+}
+
+/*
+ * checksum
+ *   DESCRIPTION: MP structures are valid when their bytes sum to 0
+ *   INPUTS: p - start
+ *           len - bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: the byte sum
+ *   SIDE EFFECTS: none
+ */
+static uint8_t checksum(const uint8_t* p, uint32_t len)
+{
+  uint8_t sum = 0;
+  while (len--) sum += *p++;
+  return sum;
+}
+
+/*
+ * mp_search
+ *   DESCRIPTION: looks for the MP floating pointer in [start, end)
+ *   INPUTS: start, end - physical range, identity mapped
+ *   OUTPUTS: none
+ *   RETURN VALUE: the floating pointer, NULL if not found
+ *   SIDE EFFECTS: none
+ */
+static mp_float_t* mp_search(uint32_t start, uint32_t end)
+{
+  mp_float_t* mpf;
+  for (; start + sizeof(mp_float_t) <= end; start += 16) {
+    mpf = (mp_float_t*) start;
+    if (!strncmp((int8_t*) mpf->sig, (int8_t*) "_MP_", 4)
+        && !checksum((uint8_t*) mpf, mpf->length * 16)) return mpf;
+  }
+  return NULL;
+}
+
+/*
+ * mp_parse
+ *   DESCRIPTION: reads the processors, the APIC addresses and ISA irq
+ *                wiring out of the MP configuration table. Only the first
+ *                IOAPIC is used.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if there is no usable table
+ *   SIDE EFFECTS: may write the IMCR
+ */
+static int32_t mp_parse()
+{
+  mp_float_t* mpf;
+  mp_config_t* cfg;
+  uint8_t* entry;
+  mp_ioint_t* ioint;
+  uint32_t isa_buses = 0;
+  uint32_t ioapic_phys = 0;
+  int32_t i;
+
+  mpf = mp_search(MP_EBDA_START, MP_EBDA_END);
+  if (!mpf) mpf = mp_search(MP_ROM_START, MP_ROM_END);
+  // default configurations without a table are not supported
+  if (!mpf || mpf->type || !mpf->config) return -1;
+  // the table has to be in the low memory mapped for the search
+  if (mpf->config < MP_EBDA_START || mpf->config + sizeof(mp_config_t) > MP_ROM_END) return -1;
+  cfg = (mp_config_t*) mpf->config;
+  if (strncmp((int8_t*) cfg->sig, (int8_t*) "PCMP", 4) || mpf->config + cfg->length > MP_ROM_END
+      || checksum((uint8_t*) cfg, cfg->length)) return -1;
+
+  for (i = 0; i < NUM_ISA_IRQS; i++) {
+    irq_pin[i] = i;
+    irq_mode[i] = 0;
+  }
+  mp_num_cpus = 0;
+
+  entry = (uint8_t*) (cfg + 1);
+  for (i = 0; i < cfg->entries; i++) {
+    switch (*entry) {
+      case MP_PROCESSOR:
+        if ((((mp_cpu_t*) entry)->flags & 1) && mp_num_cpus < MAX_CPUS) {
+          mp_cpu_ids[mp_num_cpus++] = ((mp_cpu_t*) entry)->apic_id;
+        }
+        entry += sizeof(mp_cpu_t);
+        break;
+      case MP_BUS:
+        if (!strncmp((int8_t*) ((mp_bus_t*) entry)->name, (int8_t*) "ISA", 3)) {
+          isa_buses |= 1 << ((mp_bus_t*) entry)->id;
+        }
+        entry += sizeof(mp_bus_t);
+        break;
+      case MP_IOAPIC:
+        if (!ioapic_phys && (((mp_ioapic_t*) entry)->flags & 1)) {
+          ioapic_phys = ((mp_ioapic_t*) entry)->addr;
+        }
+        entry += sizeof(mp_ioapic_t);
+        break;
+      case MP_IOINT:
+        ioint = (mp_ioint_t*) entry;
+        // buses are listed before the interrupts wired to them
+        if (!ioint->int_type && ioint->src_bus < 32 && (isa_buses & (1 << ioint->src_bus))
+            && ioint->src_irq < NUM_ISA_IRQS) {
+          irq_pin[ioint->src_irq] = ioint->dst_pin;
+          irq_mode[ioint->src_irq] = ((ioint->flags & 0x3) == 0x3 ? IOAPIC_ACTIVE_LOW : 0)
+                                   | (((ioint->flags >> 2) & 0x3) == 0x3 ? IOAPIC_LEVEL : 0);
+        }
+        entry += sizeof(mp_ioint_t);
+        break;
+      default:
+        // local interrupt assignments and anything newer are 8 bytes
+        entry += 8;
+        break;
+    }
+  }
+  if (!cfg->lapic || !ioapic_phys) return -1;
+
+  lapic_base = (volatile uint8_t*) cfg->lapic;
+  ioapic_base = (volatile uint8_t*) ioapic_phys;
+  // PIC mode: the 8259 is wired straight to the CPU until the IMCR says not
+  if (mpf->imcr & 0x80) {
+    outb(0x70, IMCR_SELECT);
+    outb(0x01, IMCR_DATA);
+  }
+  return 0;
+}
+
+/*
+ * cpu_has_apic
+ *   DESCRIPTION: checks CPUID for an on-chip local APIC
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: nonzero if there is one
+ *   SIDE EFFECTS: none
+ */
+static int32_t cpu_has_apic()
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+  return edx & (1 << 9);
+}
+
+/*
+ * apic_init
+ *   DESCRIPTION: finds the APICs and moves irq delivery from the 8259 to
+ *                them. Every IOAPIC pin starts masked; enable_irq unmasks
+ *                them like it would on the 8259. Call after paging_init
+ *                and before any device enables its irq.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: maps the BIOS area and the APIC registers, masks the 8259
+ */
+void apic_init()
+{
+  uint32_t pins, pin;
+
+  apic_active = 0;
+  if (!USE_APIC || !cpu_has_apic()) return;
+
+  map_kernel_low(MP_EBDA_START, MP_EBDA_END);
+  map_kernel_low(MP_ROM_START, MP_ROM_END);
+  if (mp_parse()) return;
+  map_mmio((uint32_t) lapic_base);
+  map_mmio((uint32_t) ioapic_base);
+
+  // the 8259 stays programmed but never raises anything again
+  outb(0xFF, MASTER_DATA);
+  outb(0xFF, SLAVE_DATA);
+
+  bsp_id = lapic_read(LAPIC_ID) >> 24;
+  lapic_write(LAPIC_TPR, 0);
+  lapic_write(LAPIC_SVR, LAPIC_ENABLE | APIC_SPURIOUS_VECTOR);
+
+  pins = ((ioapic_read(IOAPIC_VER) >> 16) & 0xFF) + 1;
+  for (pin = 0; pin < pins; pin++) {
+    ioapic_write(IOAPIC_REDIR + 2 * pin, IOAPIC_MASKED);
+  }
+  apic_active = 1;
+}
+
+/*
+ * ioapic_enable
+ *   DESCRIPTION: routes an ISA irq to the boot CPU at vector
+ *                APIC_IRQ_BASE + irq and unmasks it
+ *   INPUTS: irq - ISA irq
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the irq's redirection entry
+ */
+void ioapic_enable(uint32_t irq)
+{
+  if (irq >= NUM_ISA_IRQS) return;
+  ioapic_write(IOAPIC_REDIR + 2 * irq_pin[irq] + 1, bsp_id << 24);
+  ioapic_write(IOAPIC_REDIR + 2 * irq_pin[irq], (APIC_IRQ_BASE + irq) | irq_mode[irq]);
+}
+
+/*
+ * ioapic_disable
+ *   DESCRIPTION: masks an ISA irq
+ *   INPUTS: irq - ISA irq
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the irq's redirection entry
+ */
+void ioapic_disable(uint32_t irq)
+{
+  if (irq >= NUM_ISA_IRQS) return;
+  ioapic_write(IOAPIC_REDIR + 2 * irq_pin[irq], (APIC_IRQ_BASE + irq) | irq_mode[irq] | IOAPIC_MASKED);
+}
+
+/*
+ * lapic_eoi
+ *   DESCRIPTION: ends the interrupt being serviced, one MMIO write for
+ *                every irq where the 8259 needs two port writes for the
+ *                slave's
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: lets the next interrupt of the same or lower priority in
+ */
+void lapic_eoi()
+{
+  lapic_write(LAPIC_EOI, 0);
+}
+
+/*
+ * lapic_id
+ *   DESCRIPTION: reads the local APIC id of the CPU this runs on
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: APIC id
+ *   SIDE EFFECTS: none
+ */
+uint32_t lapic_id()
+{
+  return lapic_read(LAPIC_ID) >> 24;
+}
+
+/*
+ * lapic_ap_init
+ *   DESCRIPTION: software enables the local APIC of an application
+ *                processor the way apic_init does the boot CPU's, and
+ *                its timer the way lapic_timer_init leaves the boot
+ *                CPU's: timers are added on any CPU, and the wheel is
+ *                armed on the CPU that added the earliest one. Call after
+ *                lapic_timer_init.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: lets IPIs and timer interrupts in
+ */
+void lapic_ap_init()
+{
+  lapic_write(LAPIC_TPR, 0);
+  lapic_write(LAPIC_SVR, LAPIC_ENABLE | APIC_SPURIOUS_VECTOR);
+  // every local APIC timer runs off the same bus clock as the boot CPU's
+  lapic_write(LAPIC_TIMER_DIV, LAPIC_DIV_16);
+  lapic_write(LAPIC_TIMER_INIT, 0);
+  lapic_write(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR);
+}
+
+/*
+ * lapic_send_icr
+ *   DESCRIPTION: writes the interrupt command register and waits for the
+ *                local APIC to accept it
+ *   INPUTS: apic_id - destination
+ *           cmd - low half of the ICR
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sends an IPI
+ */
+static void lapic_send_icr(uint32_t apic_id, uint32_t cmd)
+{
+  uint32_t flags;
+  // an interrupt between the two writes could send its own IPI
+  cli_and_save(flags);
+  lapic_write(LAPIC_ICR_HI, apic_id << 24);
+  lapic_write(LAPIC_ICR_LO, cmd);
+  while (lapic_read(LAPIC_ICR_LO) & LAPIC_ICR_PENDING);
+  restore_flags(flags);
+}
+
+/*
+ * lapic_send_ipi
+ *   DESCRIPTION: sends a fixed interrupt to another CPU
+ *   INPUTS: apic_id - destination
+ *           vector - IDT vector it takes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: interrupts the destination
+ */
+void lapic_send_ipi(uint32_t apic_id, uint32_t vector)
+{
+  lapic_send_icr(apic_id, vector);
+}
+
+/*
+ * lapic_send_init
+ *   DESCRIPTION: resets another CPU into wait-for-SIPI
+ *   INPUTS: apic_id - destination
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the destination stops whatever it was doing
+ */
+void lapic_send_init(uint32_t apic_id)
+{
+  lapic_send_icr(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+}
+
+/*
+ * lapic_send_startup
+ *   DESCRIPTION: starts a CPU waiting for SIPI in real mode at page:0000
+ *   INPUTS: apic_id - destination
+ *           page - physical page number below 1MB
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the destination runs the code there
+ */
+void lapic_send_startup(uint32_t apic_id, uint32_t page)
+{
+  lapic_send_icr(apic_id, LAPIC_ICR_STARTUP | LAPIC_ICR_ASSERT | page);
+}
+
+/*
+ * lapic_timer_init
+ *   DESCRIPTION: counts local APIC timer ticks against the TSC clock for
+ *                CALIBRATE_MS, then leaves the timer stopped in one-shot
+ *                mode on APIC_TIMER_VECTOR. Call after the TSC is
+ *                calibrated.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets lapic_timer_khz
+ */
+void lapic_timer_init()
+{
+  uint64_t start;
+  uint32_t elapsed;
+
+  lapic_write(LAPIC_TIMER_DIV, LAPIC_DIV_16);
+  lapic_write(LAPIC_LVT_TIMER, LAPIC_MASKED | APIC_TIMER_VECTOR);
+  lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+  start = ktime_ns();
+  while (ktime_ns() - start < CALIBRATE_MS * 1000000);
+  elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+  lapic_write(LAPIC_TIMER_INIT, 0);
+
+  lapic_timer_khz = fmax(elapsed / CALIBRATE_MS, 1);
+  lapic_write(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR);
+}
+
+/*
+ * lapic_timer_arm
+ *   DESCRIPTION: starts the local APIC timer counting down from ns
+ *   INPUTS: ns - nanoseconds until the interrupt
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: replaces any countdown in progress
+ */
+void lapic_timer_arm(uint32_t ns)
+{
+  lapic_write(LAPIC_TIMER_INIT, div64((uint64_t) ns * lapic_timer_khz, 1000000, NULL) + 1);
+}
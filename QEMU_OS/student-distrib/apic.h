@@ -0,0 +1,98 @@
+// apic.h - declares local APIC and IOAPIC interrupt delivery
+
+#ifndef _APIC_H
+#define _APIC_H
+
+#include "types.h"
+
+// TURN OFF/ON (0/1) the APIC, 0 keeps every irq on the 8259
+#define USE_APIC                1
+
+// vectors of interrupts the local APIC raises itself; ISA irqs keep the
+// 0x20 + irq vectors they have on the 8259
+#define APIC_TIMER_VECTOR       0x30
+#define APIC_SPURIOUS_VECTOR    0xFF
+#define APIC_IRQ_BASE           0x20
+
+// local APIC register offsets
+#define LAPIC_ID                0x020
+#define LAPIC_TPR               0x080
+#define LAPIC_EOI               0x0B0
+#define LAPIC_SVR               0x0F0
+#define LAPIC_ICR_LO            0x300
+#define LAPIC_ICR_HI            0x310
+#define LAPIC_LVT_TIMER         0x320
+#define LAPIC_TIMER_INIT        0x380
+#define LAPIC_TIMER_CUR         0x390
+#define LAPIC_TIMER_DIV         0x3E0
+// SVR software enable, LVT mask bit, timer divide by 16
+#define LAPIC_ENABLE            0x100
+#define LAPIC_MASKED            0x10000
+#define LAPIC_DIV_16            0x3
+// ICR delivery modes, level assert and the busy bit
+#define LAPIC_ICR_INIT          0x500
+#define LAPIC_ICR_STARTUP       0x600
+#define LAPIC_ICR_ASSERT        0x4000
+#define LAPIC_ICR_PENDING       0x1000
+
+// IOAPIC register select and data window, and its registers
+#define IOAPIC_REGSEL           0x00
+#define IOAPIC_WIN              0x10
+#define IOAPIC_VER              0x01
+#define IOAPIC_REDIR            0x10
+// redirection entry bits: active low, level triggered, masked
+#define IOAPIC_ACTIVE_LOW       0x2000
+#define IOAPIC_LEVEL            0x8000
+#define IOAPIC_MASKED           0x10000
+
+// MP floating pointer search areas: the last KB of base memory, where
+// QEMU's EBDA sits, and the BIOS ROM
+#define MP_EBDA_START           0x9FC00
+#define MP_EBDA_END             0xA0000
+#define MP_ROM_START            0xF0000
+#define MP_ROM_END              0x100000
+// MP configuration table entry types
+#define MP_PROCESSOR            0
+#define MP_BUS                  1
+#define MP_IOAPIC               2
+#define MP_IOINT                3
+// IMCR ports, written to route the 8259 away from the BSP's LINT0
+#define IMCR_SELECT             0x22
+#define IMCR_DATA               0x23
+
+#define NUM_ISA_IRQS            16
+// processors the kernel will use
+#define MAX_CPUS                8
+
+// 1 once irqs are delivered by the IOAPIC and local APIC
+extern int32_t apic_active;
+// local APIC timer ticks per millisecond
+extern uint32_t lapic_timer_khz;
+// local APIC ids of the usable processors in the MP table
+extern uint8_t mp_cpu_ids[MAX_CPUS];
+extern int32_t mp_num_cpus;
+
+// finds the APICs in the MP table and switches irq delivery over to them
+void apic_init();
+// unmasks an ISA irq at the IOAPIC
+void ioapic_enable(uint32_t irq);
+// masks an ISA irq at the IOAPIC
+void ioapic_disable(uint32_t irq);
+// ends the current interrupt at the local APIC
+void lapic_eoi();
+// local APIC id of the CPU this runs on
+uint32_t lapic_id();
+// enables the local APIC and its timer on an application processor
+void lapic_ap_init();
+// sends a fixed interrupt to another CPU
+void lapic_send_ipi(uint32_t apic_id, uint32_t vector);
+// sends INIT to another CPU
+void lapic_send_init(uint32_t apic_id);
+// sends a startup IPI, the CPU starts in real mode at page << 12
+void lapic_send_startup(uint32_t apic_id, uint32_t page);
+// measures the local APIC timer and points it at APIC_TIMER_VECTOR
+void lapic_timer_init();
+// one-shot local APIC timer interrupt ns nanoseconds from now
+void lapic_timer_arm(uint32_t ns);
+
+#endif //_APIC_H
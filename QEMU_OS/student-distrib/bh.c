@@ -0,0 +1,142 @@
+// bh.c - deferred interrupt work (bottom halves)
+//
+// Interrupt handlers are split in two. The top half runs from the irq stub
+// with interrupts off and only does what cannot wait: read the device,
+// send EOI and raise its bottom half. On the way out the stub calls
+// bh_run, which turns interrupts back on and runs every pending bottom
+// half. Bottom halves are ordered by priority, lowest number first. An
+// interrupt that arrives while one runs raises its own bottom half, which
+// runs right away, nested, if it outranks every bottom half already
+// running; otherwise the loop already running picks it up. No bottom half
+// ever runs inside itself. Bottom halves must not sleep; anything that
+// switches processes is asked for with bh_want and done after the
+// outermost loop, on the CPU it was asked of.
+#include "bh.h"
+#include "lib.h"
+#include "syscalls.h"
+#include "sched.h"
+#include "smp.h"
+
+uint32_t irq_entry_tsc;
+uint32_t irq_off_max[NUM_IRQS];
+uint32_t irq_count[NUM_IRQS];
+uint64_t irq_off_total[NUM_IRQS];
+
+// function of each bottom half
+static void (*bh_table[NUM_BH])(void);
+// bit nr set while bottom half nr has work
+static volatile uint32_t bh_pending;
+// bit nr set while bottom half nr is running, nested ones included
+static uint32_t bh_running;
+
+/*
+ * bh_register
+ *   DESCRIPTION: sets the function run for a bottom half
+ *   INPUTS: nr - bottom half number
+ *           fn - function to run
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void bh_register(int32_t nr, void (*fn)(void))
+{
+  if (nr < 0 || nr >= NUM_BH) return;
+  bh_table[nr] = fn;
+}
+
+/*
+ * bh_raise
+ *   DESCRIPTION: marks a bottom half as having work, called by top halves
+ *   INPUTS: nr - bottom half number
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the bottom half runs before the interrupt returns
+ */
+void bh_raise(int32_t nr)
+{
+  bh_pending |= (1 << nr);
+}
+
+/*
+ * bh_want
+ *   DESCRIPTION: asks bh_run to reschedule or halt the interrupted process
+ *                once every bottom half has run
+ *   INPUTS: what - BH_WANT_* bits
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void bh_want(uint32_t what)
+{
+  cpu_self()->bh_wants |= what;
+}
+
+/*
+ * bh_want_on
+ *   DESCRIPTION: bh_want for the process running on another CPU, which is
+ *                interrupted so it gets to it
+ *   INPUTS: cpu - index of the CPU
+ *           what - BH_WANT_* bits
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may send a reschedule IPI
+ */
+void bh_want_on(int32_t cpu, uint32_t what)
+{
+  cpus[cpu].bh_wants |= what;
+  smp_kick(&cpus[cpu]);
+}
+
+/*
+ * bh_run
+ *   DESCRIPTION: counts the interrupt and records how long the top half
+ *                kept interrupts off, then runs pending bottom halves with
+ *                interrupts on, highest priority first, until none are
+ *                left that outrank the ones it interrupted
+ *   INPUTS: irq - irq line of the stub, -1 if none
+ *           cs - code segment of the interrupted context
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may halt the interrupted process if it was in user mode,
+ *                 or switch processes; returns with interrupts off
+ */
+void bh_run(int32_t irq, uint32_t cs)
+{
+  uint64_t now;
+  uint32_t off, mask, pending, wants;
+  int32_t nr;
+
+  // interrupts have been off since the stub was entered
+  rdtsc(now);
+  off = (uint32_t)now - irq_entry_tsc;
+  if (irq >= 0 && irq < NUM_IRQS) {
+    irq_count[irq]++;
+    irq_off_total[irq] += off;
+    if (off > irq_off_max[irq]) irq_off_max[irq] = off;
+  }
+
+  // only bottom halves above the highest one running may preempt it
+  mask = bh_running ? (bh_running & -bh_running) - 1 : (1 << NUM_BH) - 1;
+  while ((pending = bh_pending & mask)) {
+    // the pending mask is rescanned after each one, so a higher bottom
+    // half raised meanwhile goes next
+    for (nr = 0; !(pending & (1 << nr)); nr++);
+    bh_pending &= ~(1 << nr);
+    bh_running |= (1 << nr);
+    sti();
+    if (bh_table[nr]) bh_table[nr]();
+    cli();
+    bh_running &= ~(1 << nr);
+  }
+
+  // the outer call finishes the work
+  if (bh_running) return;
+
+  wants = cpu_self()->bh_wants;
+  cpu_self()->bh_wants = 0;
+  // a thread group is exiting, proc_kill kicked us here; a process
+  // interrupted inside a system call still holds kernel state, so it
+  // is left to proc_check_killed on the way out of the call
+  if ((cs & 3) == 3 && pcb && pcb->killed && !pcb->exiting) sys_call_halt(0);
+  if (wants & BH_WANT_RESCHED) schedule();
+}
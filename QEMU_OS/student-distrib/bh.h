@@ -0,0 +1,42 @@
+// bh.h - declares deferred interrupt work (bottom halves)
+
+#ifndef _BH_H
+#define _BH_H
+
+#include "types.h"
+
+// bottom half numbers, one bit each in the pending mask. A lower number
+// is a higher priority and preempts a higher one that is running, so the
+// timer and RTC are not held up by keyboard echo redrawing the screen
+#define BH_TIMER                0
+#define BH_RTC                  1
+#define BH_KBD                  2
+#define NUM_BH                  3
+
+// work a bottom half can ask for once every bottom half has run
+#define BH_WANT_RESCHED         0x1
+
+// irq lines tracked for interrupts-disabled time
+#define NUM_IRQS                16
+
+// low 32 bits of the TSC when the current interrupt stub was entered
+extern uint32_t irq_entry_tsc;
+// longest time in cycles each irq kept interrupts off before bottom halves
+extern uint32_t irq_off_max[NUM_IRQS];
+// interrupts taken on each irq line since boot
+extern uint32_t irq_count[NUM_IRQS];
+// total cycles each irq kept interrupts off, for the average
+extern uint64_t irq_off_total[NUM_IRQS];
+
+// sets the function run for a bottom half
+void bh_register(int32_t nr, void (*fn)(void));
+// marks a bottom half pending, called by a top half with interrupts off
+void bh_raise(int32_t nr);
+// asks for a reschedule or halt after the bottom halves finish
+void bh_want(uint32_t what);
+// the same for whatever runs on another CPU
+void bh_want_on(int32_t cpu, uint32_t what);
+// runs pending bottom halves with interrupts on, called by every irq stub
+void bh_run(int32_t irq, uint32_t cs);
+
+#endif //_BH_H
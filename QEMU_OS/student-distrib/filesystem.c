@@ -236,3 +236,16 @@ int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length
  	}
  return cur_byte;
 }
+
+//inputs: inode - the inode of the file
+//outputs: returns the length of the file in bytes, 0 if the inode is invalid
+//side effects: none
+//looks up the length field of the inode block
+uint32_t file_length(uint32_t inode)
+{
+	if(inode >= boot->inode_num)//if inode index is invalid, file is empty
+	{
+		return 0;
+	}
+	return ((inode_t*)((uint8_t*) boot + ((inode+1) * block_size)))->length;
+}
@@ -83,4 +83,7 @@ int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry);
 //given an inode, reads length amount of bytes into buf from the start of the datablocks + offset
 int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length);
 
+//given an inode, returns the length of the file in bytes
+uint32_t file_length(uint32_t inode);
+
 #endif 
@@ -0,0 +1,124 @@
+// futex.c - wait queues keyed by a user address
+//
+// A user mutex or condition variable lives in an int the threads of a
+// group share. They change it with atomic instructions and only call in
+// here when they have to sleep or someone might be sleeping: futex_wait
+// sleeps only if the int still holds what the caller last saw, checked
+// with interrupts off so a futex_wake after that check cannot be missed.
+// Sleepers are keyed by the address and their address space, so the same
+// address in two unrelated processes never matches.
+#include "futex.h"
+#include "sched.h"
+#include "lib.h"
+
+// sleepers, hashed by address and address space, newest first
+static wait_queue_t futex_wq[FUTEX_BUCKETS];
+
+/*
+ * futex_bucket
+ *   DESCRIPTION: picks the wait queue for an address
+ *   INPUTS: addr - user address of the futex
+ *           mm_pid - leader of the address space it is in
+ *   OUTPUTS: none
+ *   RETURN VALUE: the queue
+ *   SIDE EFFECTS: none
+ */
+static wait_queue_t* futex_bucket(uint32_t addr, uint32_t mm_pid)
+{
+  return &futex_wq[((addr >> 2) + mm_pid) % FUTEX_BUCKETS];
+}
+
+/*
+ * futex_addr_ok
+ *   DESCRIPTION: checks that a futex is an aligned int in the user page
+ *   INPUTS: addr - user address
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if it is, 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int futex_addr_ok(uint32_t addr)
+{
+  return addr >= 128*MB && addr <= 132*MB - sizeof(int32_t) && !(addr & 3);
+}
+
+/*
+ * futex_unlink
+ *   DESCRIPTION: takes a sleeper off its bucket and makes it runnable.
+ *                Call with interrupts off.
+ *   INPUTS: link - the pointer in the bucket that points at it
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may send a reschedule IPI
+ */
+static void futex_unlink(pcb_t** link)
+{
+  pcb_t* proc = *link;
+  *link = proc->next;
+  proc->futex_addr = 0;
+  sched_enqueue(proc);
+}
+
+/*
+ * sys_call_futex_wait
+ *   DESCRIPTION: sleeps until futex_wake on addr, but only if *addr is
+ *                still val. Callers recheck their condition on return
+ *                either way.
+ *   INPUTS: addr - 4 byte aligned int in the user page
+ *           val - value the caller saw there
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 once woken, -1 if *addr was not val, on a bad address
+ *                 or if the thread group is exiting
+ *   SIDE EFFECTS: blocks the caller
+ */
+int32_t sys_call_futex_wait(int32_t* addr, int32_t val)
+{
+  uint32_t flags;
+
+  if (!futex_addr_ok((uint32_t)addr)) return -1;
+  cli_and_save(flags);
+  if (*addr != val || pcb->killed) {
+    restore_flags(flags);
+    return -1;
+  }
+  pcb->futex_addr = (uint32_t)addr;
+  sleep_on(futex_bucket((uint32_t)addr, pcb->mm_pid));
+  //set still if proc_kill woke us rather than futex_wake
+  pcb->futex_addr = 0;
+  restore_flags(flags);
+  return pcb->killed ? -1 : 0;
+}
+
+/*
+ * sys_call_futex_wake
+ *   DESCRIPTION: wakes processes of the caller's address space sleeping
+ *                on addr, the ones that have waited longest first
+ *   INPUTS: addr - futex address
+ *           n - most processes to wake
+ *   OUTPUTS: none
+ *   RETURN VALUE: number woken, -1 on a bad address
+ *   SIDE EFFECTS: makes the woken processes runnable
+ */
+int32_t sys_call_futex_wake(int32_t* addr, int32_t n)
+{
+  uint32_t flags;
+  pcb_t** link;
+  pcb_t** oldest;
+  wait_queue_t* wq;
+  int32_t woken = 0;
+
+  if (!futex_addr_ok((uint32_t)addr)) return -1;
+  wq = futex_bucket((uint32_t)addr, pcb->mm_pid);
+  cli_and_save(flags);
+  while (woken < n) {
+    // the bucket is newest first, so the last match has waited longest
+    oldest = NULL;
+    for (link = &wq->head; *link; link = &(*link)->next) {
+      if ((*link)->futex_addr == (uint32_t)addr && (*link)->mm_pid == pcb->mm_pid) oldest = link;
+    }
+    if (!oldest) break;
+    futex_unlink(oldest);
+    woken++;
+  }
+  restore_flags(flags);
+  return woken;
+}
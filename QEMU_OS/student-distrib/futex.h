@@ -0,0 +1,17 @@
+// futex.h - declares wait queues keyed by a user address
+
+#ifndef _FUTEX_H
+#define _FUTEX_H
+
+#include "types.h"
+#include "syscalls.h"
+
+// number of wait queues futex addresses hash into
+#define FUTEX_BUCKETS 16
+
+// sleeps if *addr still holds val
+int32_t sys_call_futex_wait(int32_t* addr, int32_t val);
+// wakes up to n processes sleeping on addr
+int32_t sys_call_futex_wake(int32_t* addr, int32_t n);
+
+#endif //_FUTEX_H
@@ -6,6 +6,7 @@
 
 #include "i8259.h"
 #include "lib.h"
+#include "apic.h"
 
 /* Interrupt masks to determine which interrupts are enabled and disabled */
 uint8_t master_mask = 0xFF; /* IRQs 0-7  */
@@ -49,9 +50,15 @@ void i8259_init(void) {
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: sends data to PIC
+ *   SIDE EFFECTS: sends data to PIC, or unmasks the IOAPIC pin once the
+ *                 APIC delivers interrupts
  */
 void enable_irq(uint32_t irq_num) {
+    if(apic_active)
+    {
+        ioapic_enable(irq_num);
+        return;
+    }
     if(irq_num >= 0 && irq_num < 8)//then we have the master PIC
     {
         //calcualte new mask
@@ -74,9 +81,15 @@ void enable_irq(uint32_t irq_num) {
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: sends data to PIC
+ *   SIDE EFFECTS: sends data to PIC, or masks the IOAPIC pin once the
+ *                 APIC delivers interrupts
  */
 void disable_irq(uint32_t irq_num) {
+    if(apic_active)
+    {
+        ioapic_disable(irq_num);
+        return;
+    }
     if(irq_num >= 0 && irq_num < 8)//then we have the master PIC
     {
         //calculate new mask
@@ -99,9 +112,15 @@ void disable_irq(uint32_t irq_num) {
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: sends data to PIC
+ *   SIDE EFFECTS: sends data to PIC, or to the local APIC once it
+ *                 delivers interrupts
  */
 void send_eoi(uint32_t irq_num) {
+    if(apic_active)
+    {
+        lapic_eoi();
+        return;
+    }
     if(irq_num >= 0 && irq_num < 8)//then we have the master PIC
     {
         outb(irq_num | EOI, MASTER_8259_PORT);//send the EOI ord with the irq through the command port
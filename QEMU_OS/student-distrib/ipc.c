@@ -0,0 +1,304 @@
+// ipc.c - synchronous rendezvous message passing between processes
+#include "ipc.h"
+#include "sched.h"
+#include "lib.h"
+
+/*
+ * user_buf_ok
+ *   DESCRIPTION: checks that a user buffer lies in the user page
+ *   INPUTS: addr - start of the buffer
+ *           len - bytes in it
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if it does, 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int user_buf_ok(uint32_t addr, uint32_t len)
+{
+  if (len == 0) return 1;
+  return addr >= 128*MB && len <= 4*MB && addr <= 132*MB - len;
+}
+
+/*
+ * ipc_deliver
+ *   DESCRIPTION: moves a message into a blocked receiver: the words go
+ *                straight into its saved ecx/edx, the body into its ipc_buf
+ *   INPUTS: from - sending process
+ *           regs - registers holding the sender's words and length
+ *           data - sender's body, in the current address space
+ *           to - receiving process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes the receiver's saved registers
+ */
+static void ipc_deliver(pcb_t* from, regs_t* regs, const uint8_t* data, pcb_t* to)
+{
+  regs_t* to_regs = USER_REGS(to->pid);
+  uint32_t len = regs->edi;
+  if (len > IPC_MAX_BUF) len = IPC_MAX_BUF;
+  to_regs->ecx = regs->ecx;
+  to_regs->edx = regs->edx;
+  memcpy(to->ipc_buf, data, len);
+  to->ipc_len = len;
+  to->ipc_peer = from->pid;
+  to->ipc_err = 0;
+}
+
+/*
+ * ipc_block
+ *   DESCRIPTION: blocks the current process on its own ipc queue and runs
+ *                next directly, or the scheduler's pick if next is NULL
+ *   INPUTS: next - process to hand the CPU to
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: switches process, call with interrupts off
+ */
+static void ipc_block(pcb_t* next)
+{
+  pcb->state = PROC_BLOCKED;
+  pcb->next = NULL;
+  pcb->ipc_wq.head = pcb;
+  pcb->sleep_wq = &pcb->ipc_wq;
+  if (next) sched_handoff(next);
+  else schedule();
+}
+
+/*
+ * ipc_take_sender
+ *   DESCRIPTION: removes the oldest queued sender a receiver accepts
+ *   INPUTS: to - receiver
+ *           from - pid accepted, -1 for any
+ *   OUTPUTS: none
+ *   RETURN VALUE: the sender, NULL if none is queued
+ *   SIDE EFFECTS: modifies to->ipc_senders
+ */
+static pcb_t* ipc_take_sender(pcb_t* to, int32_t from)
+{
+  pcb_t** link;
+  pcb_t** found = NULL;
+  pcb_t* sender;
+
+  //senders are pushed at the head so the last match waited longest
+  for (link = &to->ipc_senders.head; *link; link = &(*link)->next) {
+    if (from == -1 || (*link)->pid == from) found = link;
+  }
+  if (!found) return NULL;
+  sender = *found;
+  *found = sender->next;
+  sender->next = NULL;
+  return sender;
+}
+
+/*
+ * ipc_send_common
+ *   DESCRIPTION: body of send and call. Hands the CPU straight to the
+ *                receiver if it is waiting, otherwise queues on it.
+ *   INPUTS: pid - receiver
+ *           is_call - wait for a reply after delivery
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on fail
+ *   SIDE EFFECTS: may block and switch process
+ */
+static int32_t ipc_send_common(int32_t pid, int is_call)
+{
+  uint32_t flags;
+  regs_t* regs = USER_REGS(pcb->pid);
+  pcb_t* dest;
+
+  if (pid == pcb->pid || !proc_alive(pid)) return -1;
+  if (regs->edi > IPC_MAX_BUF || !user_buf_ok(regs->esi, regs->edi)) return -1;
+  //the reply may fill the whole buffer
+  if (is_call && !user_buf_ok(regs->esi, IPC_MAX_BUF)) return -1;
+  dest = PCB_ADDR(pid);
+
+  cli_and_save(flags);
+  pcb->ipc_err = 0;
+  if (dest->ipc_state == IPC_RECV && (dest->ipc_peer == -1 || dest->ipc_peer == pcb->pid)) {
+    //rendezvous: copy once into the receiver and run it right away
+    ipc_deliver(pcb, regs, (uint8_t*)regs->esi, dest);
+    dest->ipc_state = IPC_NONE;
+    dest->ipc_wq.head = NULL;
+    if (is_call) {
+      pcb->ipc_state = IPC_CALL;
+      pcb->ipc_peer = pid;
+      ipc_block(dest);
+    }
+    else {
+      sched_handoff(dest);
+    }
+  }
+  else {
+    //stage the body in our pcb, the receiver copies it from there
+    memcpy(pcb->ipc_buf, (uint8_t*)regs->esi, regs->edi);
+    pcb->ipc_state = is_call ? IPC_CALL_SEND : IPC_SEND;
+    pcb->ipc_peer = pid;
+    while (pcb->ipc_state == IPC_SEND || pcb->ipc_state == IPC_CALL_SEND)
+      sleep_on(&dest->ipc_senders);
+  }
+
+  //a call sleeps until reply (or the receiver halting) clears the state
+  while (pcb->ipc_state == IPC_CALL) sleep_on(&pcb->ipc_wq);
+  restore_flags(flags);
+
+  if (pcb->ipc_err) return -1;
+  if (is_call) {
+    //the reply is in ipc_buf, its words already in our ecx/edx
+    memcpy((uint8_t*)regs->esi, pcb->ipc_buf, pcb->ipc_len);
+    regs->edi = pcb->ipc_len;
+  }
+  return 0;
+}
+
+/*
+ * sys_call_send
+ *   DESCRIPTION: sends a message and returns once the receiver has it
+ *   INPUTS: pid - receiver
+ *           w0, w1 - message words (also in the saved ecx/edx)
+ *   RETURN VALUE: 0 on success, -1 on fail
+ */
+int32_t sys_call_send(int32_t pid, uint32_t w0, uint32_t w1)
+{
+  return ipc_send_common(pid, 0);
+}
+
+/*
+ * sys_call_call
+ *   DESCRIPTION: sends a message and sleeps until the receiver replies, the
+ *                reply comes back in the same registers and buffer
+ *   INPUTS: pid - receiver
+ *           w0, w1 - message words (also in the saved ecx/edx)
+ *   RETURN VALUE: 0 on success, -1 on fail
+ */
+int32_t sys_call_call(int32_t pid, uint32_t w0, uint32_t w1)
+{
+  return ipc_send_common(pid, 1);
+}
+
+/*
+ * sys_call_recv
+ *   DESCRIPTION: waits for a message from one process or any process
+ *   INPUTS: from - pid to accept, -1 for any
+ *   RETURN VALUE: pid of the sender, -1 on fail
+ */
+int32_t sys_call_recv(int32_t from, uint32_t unused0, uint32_t unused1)
+{
+  uint32_t flags;
+  regs_t* regs = USER_REGS(pcb->pid);
+  pcb_t* sender;
+
+  if (from != -1 && (from == pcb->pid || !proc_alive(from))) return -1;
+  if (!user_buf_ok(regs->esi, IPC_MAX_BUF)) return -1;
+
+  cli_and_save(flags);
+  pcb->ipc_err = 0;
+  if ((sender = ipc_take_sender(pcb, from))) {
+    //a sender was already waiting, its body is staged in its pcb
+    ipc_deliver(sender, USER_REGS(sender->pid), sender->ipc_buf, pcb);
+    if (sender->ipc_state == IPC_CALL_SEND) {
+      //stays blocked until we reply
+      sender->ipc_state = IPC_CALL;
+      sender->ipc_wq.head = sender;
+      sender->sleep_wq = &sender->ipc_wq;
+    }
+    else {
+      sender->ipc_state = IPC_NONE;
+      sched_enqueue(sender);
+    }
+  }
+  else {
+    pcb->ipc_state = IPC_RECV;
+    pcb->ipc_peer = from;
+    ipc_block(NULL);
+    while (pcb->ipc_state == IPC_RECV) sleep_on(&pcb->ipc_wq);
+  }
+  restore_flags(flags);
+
+  if (pcb->ipc_err) return -1;
+  memcpy((uint8_t*)regs->esi, pcb->ipc_buf, pcb->ipc_len);
+  regs->edi = pcb->ipc_len;
+  return pcb->ipc_peer;
+}
+
+/*
+ * sys_call_reply
+ *   DESCRIPTION: answers a process blocked in call on us and runs it right
+ *                away. Never blocks.
+ *   INPUTS: pid - caller to answer
+ *           w0, w1 - reply words (also in the saved ecx/edx)
+ *   RETURN VALUE: 0 on success, -1 if pid is not waiting for our reply
+ */
+int32_t sys_call_reply(int32_t pid, uint32_t w0, uint32_t w1)
+{
+  uint32_t flags;
+  regs_t* regs = USER_REGS(pcb->pid);
+  pcb_t* dest;
+
+  if (!proc_alive(pid)) return -1;
+  if (regs->edi > IPC_MAX_BUF || !user_buf_ok(regs->esi, regs->edi)) return -1;
+  dest = PCB_ADDR(pid);
+
+  cli_and_save(flags);
+  if (dest->ipc_state != IPC_CALL || dest->ipc_peer != pcb->pid) {
+    restore_flags(flags);
+    return -1;
+  }
+  ipc_deliver(pcb, regs, (uint8_t*)regs->esi, dest);
+  dest->ipc_state = IPC_NONE;
+  dest->ipc_wq.head = NULL;
+  sched_handoff(dest);
+  restore_flags(flags);
+  return 0;
+}
+
+/*
+ * ipc_release
+ *   DESCRIPTION: wakes every process queued to send to a halting process,
+ *                waiting for its reply or receiving only from it; their
+ *                calls return -1
+ *   INPUTS: proc - halting process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: makes those processes runnable, call with interrupts off
+ */
+void ipc_release(pcb_t* proc)
+{
+  int32_t pid;
+  pcb_t* other;
+
+  while ((other = ipc_take_sender(proc, -1))) {
+    other->ipc_state = IPC_NONE;
+    other->ipc_err = 1;
+    sched_enqueue(other);
+  }
+  for (pid = 0; pid < MAX_PROCESS_NUM; pid++) {
+    if (pid == proc->pid || !proc_alive(pid)) continue;
+    other = PCB_ADDR(pid);
+    if ((other->ipc_state == IPC_CALL || other->ipc_state == IPC_RECV) &&
+        other->ipc_peer == proc->pid) {
+      other->ipc_state = IPC_NONE;
+      other->ipc_err = 1;
+      other->ipc_wq.head = NULL;
+      sched_enqueue(other);
+    }
+  }
+}
+
+/*
+ * ipc_cancel
+ *   DESCRIPTION: fails whatever send, recv or call a process is blocked in,
+ *                so it stops waiting once woken and nobody delivers to it
+ *   INPUTS: proc - process being killed
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: its call returns -1, call before waking it
+ */
+void ipc_cancel(pcb_t* proc)
+{
+  uint32_t flags;
+
+  cli_and_save(flags);
+  if (proc->state == PROC_BLOCKED && proc->ipc_state != IPC_NONE) {
+    proc->ipc_state = IPC_NONE;
+    proc->ipc_err = 1;
+  }
+  restore_flags(flags);
+}
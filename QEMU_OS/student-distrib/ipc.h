@@ -0,0 +1,33 @@
+// ipc.h - declares synchronous message passing between processes
+
+#ifndef _IPC_H
+#define _IPC_H
+
+#include "types.h"
+#include "syscalls.h"
+
+// pcb->ipc_state values
+#define IPC_NONE      0
+// blocked in recv
+#define IPC_RECV      1
+// queued on the receiver by send
+#define IPC_SEND      2
+// queued on the receiver by call
+#define IPC_CALL_SEND 3
+// delivered by call, waiting for the reply
+#define IPC_CALL      4
+
+// fails every process blocked on a halting process
+void ipc_release(pcb_t* proc);
+// fails the IPC a process being killed is blocked in
+void ipc_cancel(pcb_t* proc);
+
+// A message is two words in ecx/edx plus up to IPC_MAX_BUF bytes at esi
+// with the length in edi. The receiver gets the words back in ecx/edx and
+// the length in edi; its buffer at esi must hold IPC_MAX_BUF bytes.
+int32_t sys_call_send(int32_t pid, uint32_t w0, uint32_t w1);
+int32_t sys_call_recv(int32_t from, uint32_t unused0, uint32_t unused1);
+int32_t sys_call_call(int32_t pid, uint32_t w0, uint32_t w1);
+int32_t sys_call_reply(int32_t pid, uint32_t w0, uint32_t w1);
+
+#endif //_IPC_H
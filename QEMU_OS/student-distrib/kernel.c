@@ -13,6 +13,13 @@
 #include "types.h"
 #include "filesystem.h"
 #include "syscalls.h"
+#include "shm.h"
+#include "sched.h"
+#include "pipe.h"
+#include "timer.h"
+#include "apic.h"
+#include "smp.h"
+#include "workqueue.h"
 
 #define RUN_TESTS
 
@@ -155,21 +162,46 @@ void entry(unsigned long magic, unsigned long addr) {
     //init paging
     paging_init();
 
+    //move irqs to the APIC if there is one, needs paging for its registers
+    apic_init();
+
     //init kbd
     keyboard_init();
 
     //init rtc
     rtc_init();
 
+    //init pit and timers
+    timer_init();
+
     //init filesystem
     filesys_init(file_start_addr);
 
+    //init shared memory
+    shm_init();
+
+    //init pipes
+    pipe_init();
+
+    //init run queue
+    sched_init();
+
+    //start the other CPUs, they wait in their idle loops
+    smp_init();
+
+    //worker threads, then the work that keeps process slots clear
+    workqueue_init();
+    proc_init();
+
     clear_and_reset();
 
     // printf("Enabling Interrupts\n");
     sti();
 
-    sys_call_execute((uint8_t*)"shell");
+    //first terminal's shell, the idle loop switches to it
+    lock_kernel();
+    start_shell(0);
+    unlock_kernel();
     /* Initialize devices, memory, filesystem, enable device interrupts on the
      * PIC, any other initialization stuff... */
 
@@ -184,6 +216,6 @@ void entry(unsigned long magic, unsigned long addr) {
 #endif
     /* Execute the first program ("shell") ... */
 
-    /* Spin (nicely, so we don't chew up cycles) */
-    asm volatile (".1: hlt; jmp .1;");
+    /* Spin (nicely, so we don't chew up cycles) while running processes */
+    sched_idle();
 }
@@ -4,21 +4,19 @@
 #include "i8259.h"
 #include "types.h"
 #include "syscalls.h"
-
-// //terminals array stores all info for every terminal
-// term_t terminals[NUM_TERMS];
-// //stores current terminal
-// int cur_term = 0;
-
-//command array of [#number of cmds][128]
-//pos 0,x always holds current kbd buffer
-unsigned char cmd_buf[MAX_CMDS][KBD_BUF_LENGTH];
-//holds index to current position in the cmd array
-int cur_cmd_idx = 0;
-//holds index for each cmd in history
-int buf_idxs[MAX_CMDS];
-//holds number of old cmds in history
-int old_cmd_num = 0;
+#include "sched.h"
+#include "poll.h"
+#include "bh.h"
+#include "timer.h"
+#include "smp.h"
+
+//terminals array stores all info for every terminal; terminal 0 starts on
+//the boot screen so printf works before keyboard_init
+term_t terminals[NUM_TERMS] = {{.term_video = (char *)VIDEO}};
+//stores current terminal
+int cur_term = 0;
+//visible terminal, switching terminals only swaps this pointer
+term_t* kbd_term = &terminals[0];
 
 ///***LINE LENGTH IS 80 CHARS/LINE***
 
@@ -41,16 +39,34 @@ unsigned char keys_pressed[KBD_BUF_LENGTH];
 //store the state of the caps lock since it toggles every time its pressed
 uint8_t caps_lock = 0;
 
-//store video memory info
-int screen_x = 0;
-int screen_y = 0;
-char* video_mem = (char *)VIDEO;
+//scancodes from the top half waiting for the bottom half. Single producer
+//and single consumer: only keyboard_IH moves head and only keyboard_bh
+//moves tail, so neither side needs to turn interrupts off
+static uint8_t kbd_ring[KBD_RING_SIZE];
+static volatile uint32_t kbd_ring_head;
+static volatile uint32_t kbd_ring_tail;
 
-//track when enter is pressed
-int enter_pressed = 0;
+static void keyboard_bh();
+static void handle_key(uint8_t key_idx);
+static void search_start(term_t* t);
+static int search_key(term_t* t, uint8_t key_idx);
+static void raw_push(term_t* t, uint8_t key_idx);
+static void line_key(term_t* t, unsigned char c);
 
-//allow writing to display or not
-int display_typing = 0;
+/*
+ * out_term
+ *   DESCRIPTION: terminal that output of the running code belongs to: the
+ *                current process's terminal, or the visible one for the kernel
+ *                and kernel threads
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the terminal
+ *   SIDE EFFECTS: none
+ */
+static term_t* out_term()
+{
+  return (pcb && !pcb->kthread) ? &terminals[pcb->term] : kbd_term;
+}
 
 /*
  * keyboard_init
@@ -63,7 +79,7 @@ int display_typing = 0;
 void
 keyboard_init()
 {
-  int i,j;
+  int i;
   // fill rest of key_arr with zeros
   for (i=54; i<256; i++){
     key_arr[i] = 0;
@@ -72,13 +88,10 @@ keyboard_init()
   key_arr[SPACE_PRESS] = ' ';
   key_arr[ENTER_PRESS] = '\n';
 
-  //fill shift arry and keys_pressed and buffer with zeros
+  //fill shift arry and keys_pressed with zeros
   for(i = 0; i < KBD_BUF_LENGTH; i++){
     shift_arr[i] = 0;
     keys_pressed[i] = 0;
-    for(j = 0; j < MAX_CMDS; j++){
-      cmd_buf[j][i] = 0;
-    }
   }
   //set shift array positions 1-9 and then 0
   shift_arr['1'] = '!';
@@ -110,6 +123,9 @@ keyboard_init()
   //init terminals
   init_terminals();
 
+  //keys are handled with interrupts on
+  bh_register(BH_KBD, keyboard_bh);
+
   //disable cursor
   disable_cursor();
 
@@ -146,13 +162,15 @@ void enable_cursor(uint8_t cursor_start, uint8_t cursor_end)
 	outb(0x0A, 0x3D4);
 	outb((inb(0x3D5) & 0xC0) | cursor_start, 0x3D5);
 
-	outb(0x3D4, 0x0B);
+	outb(0x0B, 0x3D4);
 	outb((inb(0x3D5) & 0xE0) | cursor_end, 0x3D5);
 }
 
 /*
  * update_cursor
- *   DESCRIPTION: updates the position of the cursor (from OSDEV)
+ *   DESCRIPTION: updates the position of the cursor on the visible terminal
+ *                (from OSDEV). The cursor address is absolute so it is
+ *                offset by the terminal's page and window.
  *   INPUTS: x - x position of the cursor
  *           y - y position of the cursor
  *   OUTPUTS: none
@@ -161,7 +179,7 @@ void enable_cursor(uint8_t cursor_start, uint8_t cursor_end)
  */
 void update_cursor(int x, int y)
 {
-	uint16_t pos = y * NUM_COLS + x;
+	uint16_t pos = kbd_term->term_start + (kbd_term->term_top + y) * NUM_COLS + x;
 
 	outb(0x0F, 0x3D4);
 	outb( (uint8_t) (pos & 0xFF), 0x3D5);
@@ -169,24 +187,202 @@ void update_cursor(int x, int y)
 	outb( (uint8_t) ((pos >> 8) & 0xFF), 0x3D5);
 }
 
+/*
+ * term_cursor
+ *   DESCRIPTION: moves the hardware cursor to a terminal's position if that
+ *                terminal is the visible one and is not scrolled back
+ *   INPUTS: t - terminal
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sends data to screen
+ */
+static void term_cursor(term_t* t)
+{
+  if(t == kbd_term && !t->term_view) update_cursor(t->term_screen_x, t->term_screen_y);
+}
+
+/*
+ * term_row
+ *   DESCRIPTION: finds a row of a terminal's visible window in its page
+ *   INPUTS: t - terminal
+ *           y - row of the window
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the row's first cell
+ *   SIDE EFFECTS: none
+ */
+static uint16_t* term_row(term_t* t, int y)
+{
+  return (uint16_t *)t->term_video + (t->term_top + y) * NUM_COLS;
+}
+
+/*
+ * set_display_start
+ *   DESCRIPTION: points the CRTC at the cell VGA starts scanning out from
+ *   INPUTS: start - cell offset in VGA memory
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes what is on screen
+ */
+static void set_display_start(uint16_t start)
+{
+  outb(0x0C, 0x3D4);
+  outb((uint8_t) (start >> 8), 0x3D5);
+  outb(0x0D, 0x3D4);
+  outb((uint8_t) (start & 0xFF), 0x3D5);
+}
+
+/*
+ * term_show
+ *   DESCRIPTION: points the CRTC at a terminal's window if it is the
+ *                visible terminal and is not scrolled back
+ *   INPUTS: t - terminal
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes what is on screen
+ */
+static void term_show(term_t* t)
+{
+  if(t == kbd_term && !t->term_view) set_display_start(t->term_start + t->term_top * NUM_COLS);
+}
+
+/*
+ * term_scroll_line
+ *   DESCRIPTION: slides a terminal's window down one row. The top row is
+ *                saved in the scrollback ring and the new bottom row is
+ *                cleared, so a line feed costs one row instead of a whole
+ *                screen. When the window reaches the end of the page it is
+ *                copied back to the top. Does not move the CRTC start.
+ *   INPUTS: t - terminal
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to video memory and the scrollback ring
+ */
+static void term_scroll_line(term_t* t)
+{
+  uint16_t* cells = (uint16_t *)t->term_video;
+  //save the row that scrolls off
+  memcpy(t->term_sb[t->term_sb_head], term_row(t, 0), NUM_COLS * 2);
+  t->term_sb_head = (t->term_sb_head + 1) % SCROLLBACK_LINES;
+  if(t->term_sb_count < SCROLLBACK_LINES) t->term_sb_count++;
+  //a vidmap program draws at the page start, so the window stays put and
+  //the rows move up under it
+  if(t->term_mapped){
+    memmove(term_row(t, 0), term_row(t, 1), (NUM_ROWS - 1) * NUM_COLS * 2);
+  }
+  //otherwise slide the window, wrapping to the top of the page if it would run off
+  else{
+    t->term_top++;
+    if(t->term_top + NUM_ROWS > TERM_PAGE_ROWS){
+      memmove(cells, term_row(t, 0), (NUM_ROWS - 1) * NUM_COLS * 2);
+      t->term_top = 0;
+    }
+  }
+  memset_word(term_row(t, NUM_ROWS - 1), CELL(0x00), NUM_COLS);
+}
+
 
 /*
  * keyboard_IH
- *   DESCRIPTION: interrupt handler for keyboard press
+ *   DESCRIPTION: top half of the keyboard interrupt, queues the scancode
+ *                for keyboard_bh. Drops it if the ring is full.
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: send interrupt to print character on monitor
+ *   SIDE EFFECTS: sends eoi and raises the keyboard bottom half
  */
 void
 keyboard_IH()
 {
-  int i;
-  int num_spaces;
-  // receive key input
-  unsigned char key_idx = inb(KBD_PRT);
+  uint8_t key_idx = inb(KBD_PRT);
+  if(kbd_ring_head - kbd_ring_tail < KBD_RING_SIZE){
+    kbd_ring[kbd_ring_head % KBD_RING_SIZE] = key_idx;
+    //the slot must be written before the bottom half can see it
+    asm volatile("" : : : "memory");
+    kbd_ring_head++;
+  }
+  send_eoi(KBD_IRQ);
+  bh_raise(BH_KBD);
+}
+
+/*
+ * keyboard_bh
+ *   DESCRIPTION: bottom half of the keyboard interrupt, handles every
+ *                queued scancode with interrupts on
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: see handle_key
+ */
+static void keyboard_bh()
+{
+  uint8_t key_idx;
+  while(kbd_ring_tail != kbd_ring_head){
+    key_idx = kbd_ring[kbd_ring_tail % KBD_RING_SIZE];
+    //the slot must be read before the top half can reuse it
+    asm volatile("" : : : "memory");
+    kbd_ring_tail++;
+    handle_key(key_idx);
+  }
+}
+
+/*
+ * key_char
+ *   DESCRIPTION: finds the char a key press types with the current shift
+ *                and caps lock state
+ *   INPUTS: key_idx - scancode
+ *   OUTPUTS: none
+ *   RETURN VALUE: the char, 0 if the key does not type one
+ *   SIDE EFFECTS: none
+ */
+static unsigned char key_char(uint8_t key_idx)
+{
+  //get char from array
+  unsigned char key = key_arr[key_idx];
+  //check if key is a character in range a-z
+  if(key >= 0x61 && key <= 0x7A){
+    //find if key needs to be capitalized
+    if((keys_pressed[L_SHIFT_PRESS] || keys_pressed[R_SHIFT_PRESS]) ^ caps_lock){
+      //capitalize character using bitmask 0x5F
+      key &= 0x5F;
+    }
+  }
+  //check if any shift is pressed
+  else if(key != 0 && (keys_pressed[L_SHIFT_PRESS] || keys_pressed[R_SHIFT_PRESS])){
+      //set key to the shifted version
+      key = shift_arr[key];
+  }
+  return key;
+}
+
+/*
+ * handle_key
+ *   DESCRIPTION: acts on one scancode for the visible terminal
+ *   INPUTS: key_idx - scancode
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: prints character on monitor, may switch terminals
+ */
+static void handle_key(uint8_t key_idx)
+{
+  unsigned char key;
+  //keys always go to the visible terminal
+  term_t* t = kbd_term;
   //set current state of key press. Use bitmask 0x7F to convert releases into presses
   keys_pressed[key_idx & 0x7F] ^= 0x01;
+  //any other key press goes back to the live screen
+  if(t->term_view && key_idx < 0x80 && key_idx != L_SHIFT_PRESS && key_idx != R_SHIFT_PRESS
+     && key_idx != PGUP_PRESS && key_idx != PGDN_PRESS){
+    term_scroll_view(t, -t->term_view);
+  }
+  //a raw reader gets every press and release, only Alt+Fn is kept
+  if(t->term_raw){
+    if(key_idx == CAPS_LOCK_PRESS) caps_lock ^= 0x01;
+    if(keys_pressed[ALT_PRESS] && !keys_pressed[CTRL_PRESS] && key_idx < 0x80 && check_fns()) return;
+    raw_push(t, key_idx);
+    return;
+  }
+  //keys typed during Ctrl+R edit the query
+  if(t->term_searching && search_key(t, key_idx)) return;
 
   //******check keys that do special actions******
 
@@ -196,61 +392,38 @@ keyboard_IH()
       //if so toggle caps lock and return immediately
       caps_lock ^= 0x01;
       //no need to print the buffer so just return
-      //send eoi and return
-      send_eoi(KBD_IRQ);
       return;
     //check if the key is backspace
     case BACKSPACE_PRESS:
-      //ensure the position is greater or equal to 0
-      if(buf_idxs[cur_cmd_idx] > 0){
-        //set previous char to null and decrement x position
-        cmd_buf[cur_cmd_idx][--buf_idxs[cur_cmd_idx]] = 0x00;
-        //delete the char from the screen
-        terminal_delc();
-      }
-      //send eoi and return
-      send_eoi(KBD_IRQ);
+      line_key(t, BACKSPACE);
+      //return
       return;
     //check if tab is pressed
     case TAB_PRESS:
-      //send eoi and return if display writing is disabled currently
-      if(!display_typing){
-        send_eoi(KBD_IRQ);
-        return;
-      }
-      //get number of spaces to add
-      num_spaces = fmin(4, 127 - buf_idxs[cur_cmd_idx]);
-      //tab does 4 spaces so loop up to 4 times
-      for(i = 0; i < num_spaces; i++){
-        //set the ith position after the current to space
-        cmd_buf[cur_cmd_idx][buf_idxs[cur_cmd_idx]] = ' ';
-        //print char
-        terminal_putc(' ');
-        //increment position
-        buf_idxs[cur_cmd_idx]++;
-      }
-      //send eoi and return
-      send_eoi(KBD_IRQ);
+      line_key(t, '\t');
+      //return
       return;
     case ENTER_PRESS:
-      //update enter pressed
-      enter_pressed = 1;
-      //print newline
-      terminal_putc('\n');
-      //send eoi and return
-      send_eoi(KBD_IRQ);
+      line_key(t, '\n');
+      //return
       return;
     //check if key is up arrow
     case UP_PRESS:
-      //send eoi and return
-      switch_cmd_buffer(1);
-      send_eoi(KBD_IRQ);
+      switch_cmd_buffer(t, 1);
+      //return
       return;
     //check if key is down arrow
     case DOWN_PRESS:
-      switch_cmd_buffer(-1);
-      //send eoi and return
-      send_eoi(KBD_IRQ);
+      switch_cmd_buffer(t, -1);
+      //return
+      return;
+    //Shift+PgUp and Shift+PgDn move through the scrollback a screen at a time
+    case PGUP_PRESS:
+    case PGDN_PRESS:
+      if(keys_pressed[L_SHIFT_PRESS] || keys_pressed[R_SHIFT_PRESS]){
+        term_scroll_view(t, (key_idx == PGUP_PRESS) ? NUM_ROWS - 1 : -(NUM_ROWS - 1));
+      }
+      //return
       return;
     default:
       break;
@@ -263,31 +436,32 @@ keyboard_IH()
     //CTRL + L clears screen and the buffer if terminal read is not "in progress"
     if(keys_pressed[L_PRESS]){
       //clear video mem and reset position
-      clear_and_reset();
+      term_clear(t);
       //clear display buffer if terminal read is not "in progress"
-      printf("391OS> ");
-      if(enter_pressed){
-        clear_kbd_buf();
+      term_puts(t, "391OS> ");
+      if(t->term_enter_pressed){
+        clear_kbd_buf(t);
       }
       else{
         //print message
         //printf("[mp3_group epic terminal]$ ");
         //print the buffer back
-        printf("%s", cmd_buf[0]);
-        //set the cursor
-        update_cursor(screen_x, screen_y);
+        term_write(t, t->term_line, t->term_line_len);
       }
-      //send eoi and return
-      send_eoi(KBD_IRQ);
+      //return
       return;
     }
     //CTRL + G prints out the display buffer
     //this messes with alignment so ENTER + CTRL + L should be done afterwards
     else if(keys_pressed[G_PRESS]){
       //print display buf
-      print_kbd_buf();
-      //send eoi and return
-      send_eoi(KBD_IRQ);
+      print_kbd_buf(t);
+      //return
+      return;
+    }
+    //CTRL + R searches the history backwards
+    else if(key_idx == R_PRESS){
+      if(t->term_display_typing) search_start(t);
       return;
     }
     else if(keys_pressed[ALT_PRESS]){
@@ -296,57 +470,121 @@ keyboard_IH()
       //printf("got herfdsafdsae");
     }
     else if(keys_pressed[C_PRESS]){
-      //send eoi
-      send_eoi(KBD_IRQ);
-      //halt the program
-      sys_call_halt(0);
+      //kill the foreground job of the visible terminal, even if it is
+      //blocked or runs on another CPU
+      proc_kill_term(cur_term);
       return;
     }
     //else do nothing
   }
   else if(keys_pressed[ALT_PRESS]){
     //check if F1 1 F12 pressed to switch terminal
-     check_fns();
+    if(check_fns()) return;
   }
 
   //******do this for every other key:*******
 
-  //get char from array
-  unsigned char key = key_arr[key_idx];
+  key = key_char(key_idx);
   //if key is not a printable character return immediately
   if(key == 0){
-    send_eoi(KBD_IRQ);
     return;
   }
-  //check if key is a character in range a-z
-  if(key >= 0x61 && key <= 0x7A){
-    //find if key needs to be capitalized
-    if((keys_pressed[L_SHIFT_PRESS] || keys_pressed[R_SHIFT_PRESS]) ^ caps_lock){
-      //capitalize character using bitmask 0x5F
-      key &= 0x5F;
-    }
-  }
-  //check if any shift is pressed
-  else if(keys_pressed[L_SHIFT_PRESS] || keys_pressed[R_SHIFT_PRESS]){
-      //set key to the shifted version
-      key = shift_arr[key];
-  }
 
+  line_key(t, key);
+}
+
+/*
+ * line_edit
+ *   DESCRIPTION: applies a typed char to the line being read and echoes it
+ *   INPUTS: t - terminal taking a line
+ *           c - printable char, BACKSPACE, tab or newline
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: a newline completes the line and wakes the reader
+ */
+static void line_edit(term_t* t, unsigned char c)
+{
+  int i;
+  int num_spaces;
+  switch(c){
+    case BACKSPACE:
+      //ensure the position is greater or equal to 0
+      if(t->term_line_len > 0){
+        //drop the last char
+        t->term_line_len--;
+        //delete the char from the screen
+        term_delc(t);
+      }
+      return;
+    case '\t':
+      //get number of spaces to add
+      num_spaces = fmin(4, 127 - t->term_line_len);
+      //tab does 4 spaces so loop up to 4 times
+      for(i = 0; i < num_spaces; i++){
+        //set the ith position after the current to space
+        t->term_line[t->term_line_len++] = ' ';
+      }
+      //print them
+      term_write(t, (uint8_t*)"    ", num_spaces);
+      return;
+    case '\n':
+      //update enter pressed
+      t->term_enter_pressed = 1;
+      //print newline
+      term_putc(t, '\n');
+      //let the reader run
+      wake_up(&t->term_read_wq);
+      poll_wake();
+      return;
+    default:
+      break;
+  }
   //print to display buffer if position is less or equal to 126
   //since position 127 is reserved for newline
-  if(buf_idxs[cur_cmd_idx] <= 126 && key != 0 && display_typing){
+  if(t->term_line_len <= 126){
     //print to the display buffer
-    cmd_buf[cur_cmd_idx][buf_idxs[cur_cmd_idx]] = key;
-    //inc x position
-    buf_idxs[cur_cmd_idx]++;
+    t->term_line[t->term_line_len++] = c;
     //print char
-    terminal_putc(key);
+    term_putc(t, c);
     //set the cursor
-    update_cursor(screen_x, screen_y);
+    term_cursor(t);
   }
+}
 
-  //send eoi
-  send_eoi(KBD_IRQ);
+/*
+ * line_key
+ *   DESCRIPTION: hands a typed char to the line if a read is taking one.
+ *                Otherwise, or while older chars still wait, it goes on
+ *                the type-ahead queue, unechoed so it does not land in the
+ *                running program's output. The queue is dropped into the
+ *                next line when a read starts.
+ *   INPUTS: t - visible terminal
+ *           c - printable char, BACKSPACE, tab or newline
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: see line_edit
+ */
+static void line_key(term_t* t, unsigned char c)
+{
+  if(t->term_display_typing && !t->term_enter_pressed && t->term_ahead_head == t->term_ahead_tail){
+    line_edit(t, c);
+    return;
+  }
+  //drop the char once the queue is full
+  if(t->term_ahead_head - t->term_ahead_tail < TYPEAHEAD_SIZE){
+    t->term_ahead[t->term_ahead_head++ % TYPEAHEAD_SIZE] = c;
+  }
+}
+
+/* term_clear;
+ * Inputs: t - terminal
+ * Return Value: none
+ * Function: Clears a terminal's page and sets line feed to 0,0 */
+void term_clear(term_t* t) {
+    memset_word(term_row(t, 0), CELL(' '), NUM_ROWS * NUM_COLS);
+    t->term_screen_x = 0;
+    t->term_screen_y = 0;
+    term_cursor(t);
 }
 
 /* clear_and_reset;
@@ -354,59 +592,263 @@ keyboard_IH()
  * Return Value: none
  * Function: Clears video memory and sets line feed to 0,0 */
 void clear_and_reset(void) {
-    int32_t i;
-    for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
-        *(uint8_t *)(video_mem + (i << 1)) = ' ';
-        *(uint8_t *)(video_mem + (i << 1) + 1) = ATTRIB;
-    }
-    screen_x = 0;
-    screen_y = 0;
-    update_cursor(screen_x, screen_y);
+    term_clear(out_term());
+}
+
+/*
+ * term_erase
+ *   DESCRIPTION: clears the last n cells before the screen position and
+ *                moves the position back over them
+ *   INPUTS: t -- terminal
+ *           n -- number of cells
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to video memory
+ */
+static void term_erase(term_t* t, int n){
+  int pos = t->term_screen_y * NUM_COLS + t->term_screen_x;
+  int start = fmax(pos - n, 0);
+  memset_word(term_row(t, 0) + start, CELL(0x00), pos - start);
+  t->term_screen_x = start % NUM_COLS;
+  t->term_screen_y = start / NUM_COLS;
+}
+
+/*
+ * line_set
+ *   DESCRIPTION: replaces the typed line and redraws it
+ *   INPUTS: t -- terminal
+ *           s -- new line
+ *           n -- its length
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to video memory
+ */
+static void line_set(term_t* t, const unsigned char* s, int n){
+  term_erase(t, t->term_line_len);
+  memmove(t->term_line, s, n);
+  t->term_line_len = n;
+  term_write(t, t->term_line, n);
+}
+
+/*
+ * hist_entry
+ *   DESCRIPTION: finds an entry of the history ring
+ *   INPUTS: t -- terminal
+ *           k -- 1 for the newest entry up to term_hist_count
+ *           len -- where to put the entry's length
+ *   OUTPUTS: none
+ *   RETURN VALUE: the entry
+ *   SIDE EFFECTS: none
+ */
+static unsigned char* hist_entry(term_t* t, int k, int* len){
+  int slot = (t->term_hist_head - k + MAX_CMDS) % MAX_CMDS;
+  *len = t->term_hist_len[slot];
+  return t->term_hist[slot];
 }
 
 /*
  * switch_cmd_buffer
- *   DESCRIPTION: switches up or down to an old or new cmd buffer
- *   INPUTS: n -- number of positions to move
+ *   DESCRIPTION: shows the history entry n places older (negative is
+ *                newer) in place of the typed line. Going back to 0 brings
+ *                the typed line back.
+ *   INPUTS: t -- terminal
+ *           n -- number of positions to move
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: changes the current cmd buffer
+ *   SIDE EFFECTS: changes the typed line
  */
-void switch_cmd_buffer(int n){
-  int i;
-  //clear the chars on the screen (visually only)
-  for(i = 0; i < buf_idxs[cur_cmd_idx]; i++){
-    terminal_delc();
+void switch_cmd_buffer(term_t* t, int n){
+  unsigned char* entry;
+  int len;
+  int k = fmin(fmax(t->term_hist_pos + n, 0), t->term_hist_count);
+  if(k == t->term_hist_pos || !t->term_display_typing) return;
+  //keep the typed line to come back to
+  if(t->term_hist_pos == 0){
+    memcpy(t->term_saved, t->term_line, t->term_line_len);
+    t->term_saved_len = t->term_line_len;
+  }
+  t->term_hist_pos = k;
+  if(k == 0){
+    line_set(t, t->term_saved, t->term_saved_len);
+  }
+  else{
+    entry = hist_entry(t, k, &len);
+    line_set(t, entry, len);
+  }
+}
+
+/*
+ * hist_add
+ *   DESCRIPTION: adds the typed line to the history ring, overwriting the
+ *                oldest entry once it is full
+ *   INPUTS: t -- terminal
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the history
+ */
+void hist_add(term_t* t){
+  int slot = t->term_hist_head;
+  memcpy(t->term_hist[slot], t->term_line, t->term_line_len);
+  t->term_hist_len[slot] = t->term_line_len;
+  t->term_hist_head = (slot + 1) % MAX_CMDS;
+  if(t->term_hist_count < MAX_CMDS) t->term_hist_count++;
+}
+
+/*
+ * search_find
+ *   DESCRIPTION: finds the newest history entry at least from places back
+ *                that contains the Ctrl+R query
+ *   INPUTS: t -- terminal
+ *           from -- first entry to look at, 1 is the newest
+ *   OUTPUTS: none
+ *   RETURN VALUE: the entry's place, 0 if none matches
+ *   SIDE EFFECTS: none
+ */
+static int search_find(term_t* t, int from){
+  unsigned char* entry;
+  int k, i, j, len;
+  int qlen = t->term_query_len;
+  if(qlen == 0) return 0;
+  for(k = from; k <= t->term_hist_count; k++){
+    entry = hist_entry(t, k, &len);
+    for(i = 0; i + qlen <= len; i++){
+      for(j = 0; j < qlen && entry[i + j] == t->term_query[j]; j++);
+      if(j == qlen) return k;
+    }
   }
-  //calculate the new current index
-  cur_cmd_idx = fmax(0, cur_cmd_idx + n);
-  cur_cmd_idx = fmin(old_cmd_num, cur_cmd_idx);
+  return 0;
+}
 
-  //reprint the buffer
-  for(i = 0; i < buf_idxs[cur_cmd_idx]; i++){
-    terminal_putc(cmd_buf[cur_cmd_idx][i]);
+/*
+ * search_draw
+ *   DESCRIPTION: redraws the Ctrl+R prompt with the query and the match
+ *   INPUTS: t -- terminal
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to video memory
+ */
+static void search_draw(term_t* t){
+  static const char ok[] = "(reverse-i-search)`";
+  static const char failed[] = "(failed reverse-i-search)`";
+  unsigned char prompt[sizeof(failed) + 2 * KBD_BUF_LENGTH + 3];
+  unsigned char* entry;
+  int len;
+  int n = 0;
+  //the query failed if it is not empty and found nothing
+  const char* head = (t->term_query_len && !t->term_search_hit) ? failed : ok;
+
+  n = strlen((int8_t*)head);
+  memcpy(prompt, head, n);
+  memcpy(prompt + n, t->term_query, t->term_query_len);
+  n += t->term_query_len;
+  memcpy(prompt + n, "': ", 3);
+  n += 3;
+  if(t->term_search_hit){
+    entry = hist_entry(t, t->term_search_hit, &len);
+    memcpy(prompt + n, entry, len);
+    n += len;
   }
-  //update the cursor
-  update_cursor(screen_x, screen_y);
+  term_erase(t, t->term_search_shown);
+  term_write(t, prompt, n);
+  t->term_search_shown = n;
 }
 
 /*
- * shift_old_cmds
- *   DESCRIPTION: shifts all the cmds up 1 position
- *   INPUTS: none
+ * search_start
+ *   DESCRIPTION: starts a Ctrl+R search, the prompt replaces the typed line
+ *   INPUTS: t -- terminal
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: changes the current cmd buffer
+ *   SIDE EFFECTS: writes to video memory
+ */
+static void search_start(term_t* t){
+  memcpy(t->term_saved, t->term_line, t->term_line_len);
+  t->term_saved_len = t->term_line_len;
+  term_erase(t, t->term_line_len);
+  t->term_line_len = 0;
+  t->term_searching = 1;
+  t->term_query_len = 0;
+  t->term_search_hit = 0;
+  t->term_search_shown = 0;
+  search_draw(t);
+}
+
+/*
+ * search_end
+ *   DESCRIPTION: ends a Ctrl+R search and puts the match, or the line typed
+ *                before the search, back as the typed line
+ *   INPUTS: t -- terminal
+ *           keep -- 1 to take the match, 0 to cancel
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to video memory
+ */
+static void search_end(term_t* t, int keep){
+  unsigned char* entry;
+  int len;
+  term_erase(t, t->term_search_shown);
+  t->term_searching = 0;
+  t->term_hist_pos = 0;
+  t->term_line_len = 0;
+  if(keep && t->term_search_hit){
+    entry = hist_entry(t, t->term_search_hit, &len);
+    line_set(t, entry, len);
+  }
+  else{
+    line_set(t, t->term_saved, t->term_saved_len);
+  }
+}
+
+/*
+ * search_key
+ *   DESCRIPTION: handles a key while Ctrl+R is searching. Typed chars and
+ *                backspace edit the query, Ctrl+R finds an older match, Esc
+ *                cancels, any other key takes the match and is then handled
+ *                as usual.
+ *   INPUTS: t -- terminal
+ *           key_idx -- scancode
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the key was used up, 0 if it still has to be handled
+ *   SIDE EFFECTS: writes to video memory
  */
-void shift_old_cmds(){
-  int i,j;
-  //shift cmd farther
-  for(i = MAX_CMDS - 1; i >= 1; i--){
-    for(j = 0; j < KBD_BUF_LENGTH; j++){
-      cmd_buf[i][j] = cmd_buf[i - 1][j];
-      buf_idxs[i] = buf_idxs[i - 1];
+static int search_key(term_t* t, uint8_t key_idx){
+  unsigned char key;
+  int hit;
+  //releases and modifiers do not end the search
+  if(key_idx >= 0x80 || key_idx == L_SHIFT_PRESS || key_idx == R_SHIFT_PRESS ||
+     key_idx == CTRL_PRESS || key_idx == ALT_PRESS || key_idx == CAPS_LOCK_PRESS){
+    return 0;
+  }
+  if(keys_pressed[CTRL_PRESS] && key_idx == R_PRESS){
+    //older match for the same query, stay on the current one if none
+    hit = search_find(t, t->term_search_hit + 1);
+    if(hit) t->term_search_hit = hit;
+    search_draw(t);
+    return 1;
+  }
+  if(key_idx == BACKSPACE_PRESS){
+    if(t->term_query_len > 0) t->term_query_len--;
+    t->term_search_hit = search_find(t, 1);
+    search_draw(t);
+    return 1;
+  }
+  if(key_idx == ESC_PRESS){
+    search_end(t, 0);
+    return 1;
+  }
+  key = key_char(key_idx);
+  if(key != 0 && key != '\n' && !keys_pressed[CTRL_PRESS] && !keys_pressed[ALT_PRESS]){
+    if(t->term_query_len < KBD_BUF_LENGTH - 1){
+      t->term_query[t->term_query_len++] = key;
+      //a longer query can still match the current entry
+      t->term_search_hit = search_find(t, fmax(t->term_search_hit, 1));
     }
+    search_draw(t);
+    return 1;
   }
+  //enter, arrows and the rest work on the match
+  search_end(t, 1);
+  return 0;
 }
 
 /*
@@ -415,139 +857,336 @@ void shift_old_cmds(){
  *                position within the buffer. Prints the kbd buffer
  *                within the 2 '*' characters. Any newlines are
  *                printed as '@'.
- *   INPUTS: none
+ *   INPUTS: t -- terminal
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: writes to video memory, does NOT interface with lib.c
- *                 so doing lib.c functions will likely print in a
- *                 completely different area
+ *   SIDE EFFECTS: writes to the terminal's page
  */
-void print_kbd_buf(){
+void print_kbd_buf(term_t* t){
   int i;
+  int8_t num[12];
   //print newline
-  terminal_putc('\n');
+  term_putc(t, '\n');
   //print starting char
-  terminal_putc('*');
+  term_putc(t, '*');
   //loop and putc
-  for(i = 0; i < buf_idxs[cur_cmd_idx] + 1; i++){
-    //break if null hit
-    if(cmd_buf[cur_cmd_idx][i] == 0) break;
+  for(i = 0; i < t->term_line_len; i++){
     //print special char @ if newline in buffer
-    if(cmd_buf[cur_cmd_idx][i] == '\n'){
-      terminal_putc('@');
+    if(t->term_line[i] == '\n'){
+      term_putc(t, '@');
     }
     else{
       //print char
-      terminal_putc(cmd_buf[cur_cmd_idx][i]);
+      term_putc(t, t->term_line[i]);
     }
   }
   //print ending char
-  terminal_putc('*');
+  term_putc(t, '*');
   //print index of buffer
-  printf("\nPosition: %d", buf_idxs[cur_cmd_idx]);
+  term_puts(t, "\nPosition: ");
+  term_puts(t, (char*)itoa(t->term_line_len, num, 10));
 }
 
 /*
  * clear_kbd_buf
  *   DESCRIPTION: clears the display buffer
- *   INPUTS: none
+ *   INPUTS: t -- terminal
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: clears the display buffer
+ *   SIDE EFFECTS: clears the display buffer and stops a Ctrl+R search
  */
-void clear_kbd_buf(){
-  int i;
-  //loop and set the buffer to null
-  for(i = 0; i < KBD_BUF_LENGTH; i++){
-    cmd_buf[cur_cmd_idx][i] = 0;
-  }
+void clear_kbd_buf(term_t* t){
   //set x position to 0
-  buf_idxs[cur_cmd_idx] = 0;
+  t->term_line_len = 0;
+  //the next line starts below the history
+  t->term_hist_pos = 0;
+  t->term_searching = 0;
 }
 
 /*
- * terminal_putc
- *   DESCRIPTION: puts a char to the terminal and interfaces with the buffer position
- *   INPUTS: none
+ * term_putc
+ *   DESCRIPTION: puts a char on a terminal's page and interfaces with the
+ *                buffer position
+ *   INPUTS: t - terminal
+ *           c - char to print
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: writes to video memory
  */
-void terminal_putc(uint8_t c){
+void term_putc(term_t* t, uint8_t c){
   //check if newline
   if(c == '\n' || c == '\r') {
-      screen_y++;
-      screen_x = 0;
+      t->term_screen_y++;
+      t->term_screen_x = 0;
   }
   //otherwise print it
   else {
-      *(uint8_t *)(video_mem + ((NUM_COLS * screen_y + screen_x) << 1)) = c;
-      *(uint8_t *)(video_mem + ((NUM_COLS * screen_y + screen_x) << 1) + 1) = ATTRIB;
-      screen_x++;
+      term_row(t, t->term_screen_y)[t->term_screen_x] = CELL(c);
+      t->term_screen_x++;
       //if line reaches the end of the screen
-      if(screen_x >= NUM_COLS){
-        screen_x = 0;
-        screen_y++;
+      if(t->term_screen_x >= NUM_COLS){
+        t->term_screen_x = 0;
+        t->term_screen_y++;
       }
   }
   //need scrolling
-  if(screen_y >= NUM_ROWS){
-    scroll_terminal(1);
+  if(t->term_screen_y >= NUM_ROWS){
+    term_scroll(t, 1);
   }
 }
 
 /*
- * scroll_terminal
- *   DESCRIPTION: scrolls the terminal upwards n positions, resets x and y positional data
- *   INPUTS: n - number of times to scroll the screen
+ * term_puts
+ *   DESCRIPTION: puts a string on a terminal's page
+ *   INPUTS: t - terminal
+ *           s - NUL terminated string
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: writes to video memory
  */
-void scroll_terminal(int n){
-  int x;
-  int y;
-  //reset x and set the new y position
-  screen_y -= n;
-  screen_x = 0;
-  //move every row up n positions
-  for(y = n; y < NUM_ROWS; y++){
-    for(x = 0; x < NUM_COLS; x++){
-      *(uint8_t *)(video_mem + ((NUM_COLS * (y - n) + x) << 1)) = *(uint8_t *)(video_mem + ((NUM_COLS * y + x) << 1));
-      *(uint8_t *)(video_mem + ((NUM_COLS * (y - n) + x) << 1) + 1) = ATTRIB;
+void term_puts(term_t* t, const char* s){
+  term_write(t, (const uint8_t*)s, strlen((int8_t*)s));
+}
+
+/*
+ * term_write
+ *   DESCRIPTION: puts n chars on a terminal's page. Runs of chars between
+ *                newlines are stored as 16-bit cells a row at a time and
+ *                each line feed at the bottom only slides the window; the
+ *                CRTC start and the cursor are updated once at the end.
+ *                NUL chars are skipped.
+ *   INPUTS: t - terminal
+ *           buf - chars to print
+ *           n - number of chars
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to video memory
+ */
+void term_write(term_t* t, const uint8_t* buf, int32_t n){
+  int32_t i, x, y;
+  uint8_t c;
+  uint16_t* row;
+
+  x = t->term_screen_x;
+  y = t->term_screen_y;
+  i = 0;
+  while(i < n){
+    c = buf[i];
+    if(c == '\n' || c == '\r'){
+      x = 0;
+      y++;
+      i++;
+    }
+    else{
+      row = term_row(t, y);
+      //run up to the next newline or the end of the row
+      while(i < n && x < NUM_COLS){
+        c = buf[i];
+        if(c == '\n' || c == '\r') break;
+        if(c != 0x00) row[x++] = CELL(c);
+        i++;
+      }
+      if(x >= NUM_COLS){
+        x = 0;
+        y++;
+      }
     }
+    //went past the bottom, slide the window
+    if(y >= NUM_ROWS){
+      term_scroll_line(t);
+      y--;
+    }
+  }
+
+  t->term_screen_x = x;
+  t->term_screen_y = y;
+  term_show(t);
+  term_cursor(t);
+}
+
+/*
+ * term_put_cells
+ *   DESCRIPTION: stores cells straight into a terminal's window. Unlike
+ *                term_write nothing is interpreted: the cursor does not
+ *                move and the window never scrolls. Cells outside the
+ *                window are skipped.
+ *   INPUTS: t - terminal
+ *           cells - cells to store
+ *           n - number of cells
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of cells stored
+ *   SIDE EFFECTS: writes to the terminal's page
+ */
+int32_t term_put_cells(term_t* t, const cell_update_t* cells, int32_t n){
+  int32_t i, done = 0;
+  for(i = 0; i < n; i++){
+    if(cells[i].row >= NUM_ROWS || cells[i].col >= NUM_COLS) continue;
+    term_row(t, cells[i].row)[cells[i].col] = (cells[i].attr << 8) | cells[i].ch;
+    done++;
+  }
+  return done;
+}
+
+/*
+ * terminal_putc
+ *   DESCRIPTION: puts a char to the terminal and interfaces with the buffer position
+ *   INPUTS: c - char to print
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to video memory
+ */
+void terminal_putc(uint8_t c){
+  term_putc(out_term(), c);
+}
+
+/*
+ * terminal_puts
+ *   DESCRIPTION: puts n chars to the terminal in one batch
+ *   INPUTS: buf - chars to print
+ *           n - number of chars
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to video memory
+ */
+void terminal_puts(const uint8_t* buf, int32_t n){
+  term_write(out_term(), buf, n);
+}
+
+/*
+ * term_scroll
+ *   DESCRIPTION: scrolls a terminal's page upwards n positions, resets x and
+ *                y positional data. Each line only slides the window and is
+ *                kept in the scrollback ring.
+ *   INPUTS: t - terminal
+ *           n - number of times to scroll the screen
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to video memory and moves the CRTC start
+ */
+void term_scroll(term_t* t, int n){
+  int i;
+  //reset x and set the new y position
+  t->term_screen_y -= n;
+  t->term_screen_x = 0;
+  //slide the window n rows
+  for(i = 0; i < n; i++){
+    term_scroll_line(t);
   }
   //clear all rows after and including screen_y
-  for(y = screen_y; y < NUM_ROWS; y++){
-    for(x = 0; x < NUM_COLS; x++){
-        *(uint8_t *)(video_mem + ((NUM_COLS * y + x) << 1)) = 0x00;
-        *(uint8_t *)(video_mem + ((NUM_COLS * y + x) << 1) + 1) = ATTRIB;
+  if(t->term_screen_y < NUM_ROWS){
+    memset_word(term_row(t, fmax(t->term_screen_y, 0)), CELL(0x00),
+                (NUM_ROWS - fmax(t->term_screen_y, 0)) * NUM_COLS);
+  }
+  term_show(t);
+}
+
+/*
+ * term_scroll_view
+ *   DESCRIPTION: moves the view of the visible terminal n lines back into
+ *                its scrollback (negative n moves forward). The old lines
+ *                and the top of the window are copied to spare VGA memory
+ *                and the CRTC is pointed there; at 0 the live window is
+ *                shown again. Output keeps going to the live window.
+ *   INPUTS: t - terminal
+ *           n - lines to move
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to video memory and moves the CRTC start
+ */
+void term_scroll_view(term_t* t, int n){
+  int y, line;
+  uint16_t* view = (uint16_t *)SCROLL_VIEW;
+
+  t->term_view = fmin(fmax(t->term_view + n, 0), t->term_sb_count);
+  if(t != kbd_term) return;
+
+  //back to the live window
+  if(t->term_view == 0){
+    term_show(t);
+    if(t->term_display_typing){
+      enable_cursor(0, 0);
+      term_cursor(t);
     }
+    return;
   }
+
+  //line < 0 is in the ring, -1 being the newest line
+  for(y = 0; y < NUM_ROWS; y++){
+    line = y - t->term_view;
+    if(line < 0){
+      memcpy(view + y * NUM_COLS, t->term_sb[(t->term_sb_head + SCROLLBACK_LINES + line) % SCROLLBACK_LINES], NUM_COLS * 2);
+    }
+    else{
+      memcpy(view + y * NUM_COLS, term_row(t, line), NUM_COLS * 2);
+    }
+  }
+  disable_cursor();
+  set_display_start(SCROLL_VIEW_CELLS);
 }
 
 /*
- * terminal_delc
- *   DESCRIPTION: does what backspace does
- *   INPUTS: none
+ * term_home
+ *   DESCRIPTION: copies a terminal's window to the top of its page so the
+ *                first 4KB of the page is what is on screen, used before
+ *                the page is handed to a process with vidmap
+ *   INPUTS: t - terminal
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to video memory and moves the CRTC start
+ */
+void term_home(term_t* t){
+  if(t->term_top == 0) return;
+  memmove(t->term_video, term_row(t, 0), NUM_ROWS * NUM_COLS * 2);
+  t->term_top = 0;
+  term_show(t);
+  term_cursor(t);
+}
+
+/*
+ * scroll_terminal
+ *   DESCRIPTION: scrolls the terminal upwards n positions, resets x and y positional data
+ *   INPUTS: n - number of times to scroll the screen
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: writes to video memory
  */
-void terminal_delc(){
+void scroll_terminal(int n){
+  term_scroll(out_term(), n);
+}
+
+/*
+ * term_delc
+ *   DESCRIPTION: does what backspace does on a terminal's page
+ *   INPUTS: t - terminal
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to video memory
+ */
+void term_delc(term_t* t){
   //decrement screen_x
-  screen_x--;
+  t->term_screen_x--;
   //reset x and y if backspace goes past edge
-  if(screen_x < 0){
-    screen_x = 79;
-    screen_y = fmax(--screen_y, 0);
+  if(t->term_screen_x < 0){
+    t->term_screen_x = 79;
+    t->term_screen_y = fmax(t->term_screen_y - 1, 0);
   }
   //remove char from screen
-  *(uint8_t *)(video_mem + ((NUM_COLS * screen_y + screen_x) << 1)) = 0x00;
-  *(uint8_t *)(video_mem + ((NUM_COLS * screen_y + screen_x) << 1) + 1) = ATTRIB;
+  term_row(t, t->term_screen_y)[t->term_screen_x] = CELL(0x00);
 
   //update cursor
-  update_cursor(screen_x, screen_y);
+  term_cursor(t);
+}
+
+/*
+ * terminal_delc
+ *   DESCRIPTION: does what backspace does
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to video memory
+ */
+void terminal_delc(){
+  term_delc(out_term());
 }
 
 /*
@@ -559,10 +1198,11 @@ void terminal_delc(){
  *   SIDE EFFECTS: clears video memory and kbd buffer
  */
 int32_t terminal_open(const uint8_t* filename){
+  term_t* t = out_term();
   //clear screen
-  clear_and_reset();
+  term_clear(t);
   //clear kbd buffer
-  clear_kbd_buf();
+  clear_kbd_buf(t);
   //turn on display printing
   //display_typing = 1;
   //printf("Enter something: ");
@@ -578,12 +1218,13 @@ int32_t terminal_open(const uint8_t* filename){
  *   SIDE EFFECTS: clears video memory and kbd buffer
  */
 int32_t terminal_close(int32_t fd){
+  term_t* t = out_term();
   //clear screen
-  clear_and_reset();
+  term_clear(t);
   //clear kbd buffer
-  clear_kbd_buf();
+  clear_kbd_buf(t);
   //turn off display printing
-  display_typing = 0;
+  t->term_display_typing = 0;
   return(0);
 }
 
@@ -600,28 +1241,115 @@ int32_t terminal_close(int32_t fd){
  *   SIDE EFFECTS: writes to kbd buffer
  */
 int32_t terminal_write(int32_t fd, const void* buf, int32_t nbytes){
-  int i;
-  unsigned char c;
   unsigned char * buf2 = ((unsigned char*)buf);
+  term_t* t = out_term();
   //return -1 if nbytes is out of the range [0, KBD_BUF_LENGTH] or if buf is null
   //if(nbytes <= 0 || nbytes > KBD_BUF_LENGTH || buf2 == NULL) return -1;
   if(nbytes <= 0 || buf2 == NULL) return -1;
   //clear buffer
-  clear_kbd_buf();
-  //loop nbytes number
-  for(i = 0; i < nbytes; i++){
-    c = buf2[i];
-    //print char
-    if(c != 0x00){
-      terminal_putc(c);
-    }
-  }
+  clear_kbd_buf(t);
+  //print the whole buffer at once, NUL chars are skipped
+  term_write(t, buf2, nbytes);
   //set newline at the end of the buffer
   //cmd_buf[cur_cmd_idx][fmin(buf_idxs[cur_cmd_idx], 127)] = '\n';
   //return 0 if write is completely successful
   return nbytes;
 }
 
+/*
+ * fd_mode
+ *   DESCRIPTION: input mode of one of the caller's terminal fds. An fd
+ *                set raw only reads raw while its terminal is in raw mode
+ *                for the caller's address space; a copy spawn made, or
+ *                one left over after raw mode ended, reads cooked.
+ *   INPUTS: fd - file descriptor
+ *   OUTPUTS: none
+ *   RETURN VALUE: the TERM_MODE_* word, 0 (cooked) without a process
+ *   SIDE EFFECTS: none
+ */
+static uint32_t fd_mode(int32_t fd)
+{
+  term_t* t = out_term();
+  uint32_t mode;
+
+  if(pcb == NULL || fd < 0 || fd > MAX_INDEX) return 0;
+  mode = pcb->file_array[fd].file_position;
+  if(!t->term_raw || PCB_ADDR(t->term_raw_pid)->mm_pid != pcb->mm_pid) mode &= ~TERM_MODE_RAW;
+  return mode;
+}
+
+/*
+ * raw_push
+ *   DESCRIPTION: queues a key event for the raw reader and wakes it. The
+ *                event is dropped if the reader is RAW_EVENTS behind.
+ *   INPUTS: t - terminal the key was typed on
+ *           key_idx - scancode
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: wakes raw readers and pollers
+ */
+static void raw_push(term_t* t, uint8_t key_idx)
+{
+  key_event_t* ev;
+  if(t->term_raw_head - t->term_raw_tail >= RAW_EVENTS) return;
+  ev = &t->term_raw_ev[t->term_raw_head % RAW_EVENTS];
+  ev->code = key_idx;
+  ev->ch = (key_idx < 0x80) ? key_char(key_idx) : 0;
+  ev->mods = ((keys_pressed[L_SHIFT_PRESS] || keys_pressed[R_SHIFT_PRESS]) ? KEY_MOD_SHIFT : 0)
+           | (keys_pressed[CTRL_PRESS] ? KEY_MOD_CTRL : 0)
+           | (keys_pressed[ALT_PRESS] ? KEY_MOD_ALT : 0)
+           | (caps_lock ? KEY_MOD_CAPS : 0);
+  ev->pad = 0;
+  t->term_raw_head++;
+  wake_up(&t->term_read_wq);
+  poll_wake();
+}
+
+/*
+ * raw_read
+ *   DESCRIPTION: read in raw mode. Waits for min events; with a timeout it
+ *                waits for at least one but returns once the timeout has
+ *                passed since the call. Then copies every queued event that
+ *                fits.
+ *   INPUTS: t - caller's terminal
+ *           mode - the fd's TERM_MODE_* word
+ *           ev - buffer to copy events to
+ *           max - events that fit in the buffer
+ *   OUTPUTS: writes key events to ev
+ *   RETURN VALUE: number of bytes copied, 0 on timeout, -1 if killed
+ *   SIDE EFFECTS: consumes the copied events
+ */
+static int32_t raw_read(term_t* t, uint32_t mode, key_event_t* ev, int32_t max)
+{
+  uint32_t flags;
+  uint32_t timeout = TERM_MODE_TIMEOUT(mode);
+  int32_t need = fmin(fmax(TERM_MODE_MIN(mode), timeout ? 1 : 0), max);
+  int32_t n = 0;
+  ktimer_t timer;
+
+  cli_and_save(flags);
+  //the timer wakes the reader like a key would
+  if(timeout){
+    timer_setup(&timer, timer_wake, (uint32_t)&t->term_read_wq);
+    add_timer(&timer, jiffies_now() + ms_to_jiffies(timeout) + 1);
+  }
+  while((int32_t)(t->term_raw_head - t->term_raw_tail) < need){
+    if(timeout && !timer_pending(&timer)) break;
+    if(sleep_killed()){
+      if(timeout) del_timer(&timer);
+      restore_flags(flags);
+      return -1;
+    }
+    sleep_on(&t->term_read_wq);
+  }
+  if(timeout) del_timer(&timer);
+  while(n < max && t->term_raw_tail != t->term_raw_head){
+    ev[n++] = t->term_raw_ev[t->term_raw_tail++ % RAW_EVENTS];
+  }
+  restore_flags(flags);
+  return n * sizeof(key_event_t);
+}
+
 /*
  * terminal_read
  *   DESCRIPTION: reads input of terminal until newline pressed and writes this to buf
@@ -629,262 +1357,297 @@ int32_t terminal_write(int32_t fd, const void* buf, int32_t nbytes){
  *           buf - buffer to write to
  *           nbytes - number of bytes to read
  *   OUTPUTS: writes nbytes to buffer
- *   RETURN VALUE: -1 if inputs are bad, 0 if successful
- *   SIDE EFFECTS: none
+ *   RETURN VALUE: -1 if inputs are bad or the process is killed, else the
+ *                 number of bytes read
+ *   SIDE EFFECTS: adds the line to the history
  */
 int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes){
-  unsigned char c;
-  int i,j;
+  uint32_t flags;
+  int n;
   unsigned char* buf2 = ((unsigned char*)buf);
+  term_t* t = out_term();
   //check inputs
   //return -1 if nbytes is out of the range [0, KBD_BUF_LENGTH]
   //if(buf == NULL || nbytes <= 0 || nbytes > KBD_BUF_LENGTH) return -1;
   if(buf == NULL || nbytes <= 0) return -1;
-  //sti();
-  //test_interrupts();
+  //raw mode returns key events as they come instead of a line
+  if(fd_mode(fd) & TERM_MODE_RAW){
+    if(nbytes < (int32_t)sizeof(key_event_t)) return -1;
+    return raw_read(t, fd_mode(fd), (key_event_t*)buf, nbytes / sizeof(key_event_t));
+  }
+  //start taking a line unless poll already did
+  cli_and_save(flags);
+  if(!t->term_display_typing) terminal_poll_arm(fd);
+  //sleep until enter is pressed on this terminal
+  while(!t->term_enter_pressed){
+    if(sleep_killed()){
+      restore_flags(flags);
+      return -1;
+    }
+    sleep_on(&t->term_read_wq);
+  }
+  restore_flags(flags);
+
+  //copy the line, the last byte is always a newline
+  n = fmin(fmin(t->term_line_len, nbytes - 1), KBD_BUF_LENGTH - 1);
+  memcpy(buf2, t->term_line, n);
+  buf2[n] = '\n';
+
+  //***** STUFF THAT HAPPENS AFTER BUF IS COPEID TO USER*******
+
+  //remember non empty lines
+  if(t->term_line_len > 0) hist_add(t);
+  t->term_hist_pos = 0;
+  //disable typing
+  t->term_display_typing = 0;
+  //disable cursor
+  if(t == kbd_term) disable_cursor();
+  //return number of bytes read
+  return(n + 1);
+}
+
+/*
+ * terminal_poll_arm
+ *   DESCRIPTION: starts taking a line: turns on echo and the cursor and
+ *                clears the buffer, then types in what was typed ahead.
+ *                Called by terminal_read and by poll so a poller sees
+ *                POLLIN once enter is pressed. Raw fds do not take lines.
+ *   INPUTS: fd - file descriptor
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: enables typing on the caller's terminal
+ */
+void terminal_poll_arm(int32_t fd){
+  term_t* t = out_term();
+  //already taking a line, or reading raw keys
+  if(t->term_display_typing || (fd_mode(fd) & TERM_MODE_RAW)) return;
   //enable cursor
-  enable_cursor(0, 0);
+  if(t == kbd_term) enable_cursor(0, 0);
   //enable typing
-  display_typing = 1;
+  t->term_display_typing = 1;
   //start with enter pressed being 0 so CTRL + L doesnt mess with this
-  enter_pressed = 0;
+  t->term_enter_pressed = 0;
   //clear buffer
-  clear_kbd_buf();
+  clear_kbd_buf(t);
   //set the cursor
-  update_cursor(screen_x, screen_y);
-  //loop until enter pressed or number bytes written goes out of bounds
-  while(1){
-    //if enter gets pressed
-    if(enter_pressed == 1){
-      //copy the kbd buffer into the given buffer
-      for(i = 0; i < fmin(KBD_BUF_LENGTH, nbytes); i++){
-        c = cmd_buf[cur_cmd_idx][i];
-        //copy current position
-        buf2[i] = c;
-        //stop if null or if end of bytes number is hit
-        if(i == 127 || i == nbytes - 1 || c == '\0'){
-          //set last byte to newline
-          buf2[i] = '\n';
-          break;
-        }
-      }
+  term_cursor(t);
+  //chars typed ahead go into the new line, up to the first enter
+  while(!t->term_enter_pressed && t->term_ahead_tail != t->term_ahead_head){
+    line_edit(t, t->term_ahead[t->term_ahead_tail++ % TYPEAHEAD_SIZE]);
+  }
+}
 
-      //***** STUFF THAT HAPPENS AFTER BUF IS COPEID TO USER*******
-
-      //do this if not null command
-      if(cmd_buf[cur_cmd_idx][0] != '\0' && cmd_buf[cur_cmd_idx][1] != '\0'){
-        //increment the old cmd counter
-        old_cmd_num = fmin(MAX_CMDS - 1, old_cmd_num + 1);
-        //do this if a past cmd was entered
-        if(cur_cmd_idx != 0){
-          //loop through all 128 chars
-          for(j = 0; j < KBD_BUF_LENGTH; j++){
-            //set each spot at 0 to the cmd that was used in order to copy it to history
-            cmd_buf[0][j] = cmd_buf[cur_cmd_idx][j];
-            buf_idxs[0] = buf_idxs[cur_cmd_idx];
-          }
-          //reset the buffer array position back to 0
-          cur_cmd_idx = 0;
-        }
-        //shift historical cmds upwards
-        shift_old_cmds();
+/*
+ * terminal_ready
+ *   DESCRIPTION: readiness for poll, readable once a line is complete,
+ *                or for a raw fd once a key event is queued
+ *   INPUTS: fd - file descriptor
+ *   OUTPUTS: none
+ *   RETURN VALUE: POLLIN if a line or event is waiting, always POLLOUT
+ *   SIDE EFFECTS: none
+ */
+int32_t terminal_ready(int32_t fd){
+  term_t* t = out_term();
+  if(fd_mode(fd) & TERM_MODE_RAW){
+    return POLLOUT | ((t->term_raw_head != t->term_raw_tail) ? POLLIN : 0);
+  }
+  return POLLOUT | ((t->term_display_typing && t->term_enter_pressed) ? POLLIN : 0);
+}
+
+/*
+ * terminal_ioctl
+ *   DESCRIPTION: TERM_GETMODE copies the fd's input mode to arg and
+ *                TERM_SETMODE sets it. Raw mode is per fd, but while one is
+ *                set the terminal stops echoing and queues key events
+ *                instead of building lines.
+ *   INPUTS: fd - terminal file descriptor
+ *           cmd - TERM_GETMODE or TERM_SETMODE
+ *           arg - user pointer to a term_mode_t
+ *   OUTPUTS: fills in *arg for TERM_GETMODE
+ *   RETURN VALUE: 0 on success, -1 on a bad command, pointer or mode
+ *   SIDE EFFECTS: may switch the caller's terminal in or out of raw mode
+ */
+int32_t terminal_ioctl(int32_t fd, int32_t cmd, void* arg){
+  uint32_t flags;
+  uint32_t address = (uint32_t)arg;
+  term_mode_t* m = (term_mode_t*)arg;
+  term_t* t = out_term();
+  fd_t* f;
+
+  if(pcb == NULL || address < 128*MB || address > 132*MB - sizeof(term_mode_t)) return -1;
+  f = &pcb->file_array[fd];
+
+  switch(cmd){
+    case TERM_GETMODE:
+      m->raw = fd_mode(fd) & TERM_MODE_RAW;
+      m->min = TERM_MODE_MIN(f->file_position);
+      m->timeout = TERM_MODE_TIMEOUT(f->file_position);
+      return 0;
+    case TERM_SETMODE:
+      if(m->min < 0 || m->min > 0xFF || m->timeout < 0 || m->timeout > 0xFFFF) return -1;
+      cli_and_save(flags);
+      //only one process at a time owns the terminal's key events
+      if(m->raw && t->term_raw && t->term_raw_pid != pcb->pid){
+        restore_flags(flags);
+        return -1;
       }
-      //disable typing
-      display_typing = 0;
-      //disable cursor
-      disable_cursor();
-      //return number of bytes read
-      return(i + 1);
-    }
+      f->file_position = (m->raw ? TERM_MODE_RAW : 0) | (m->min << 8) | (m->timeout << 16);
+      if(m->raw && !t->term_raw){
+        //drop any half typed line and start with no events queued
+        t->term_raw = 1;
+        t->term_raw_pid = pcb->pid;
+        t->term_raw_head = t->term_raw_tail = 0;
+        t->term_ahead_head = t->term_ahead_tail = 0;
+        if(t->term_searching) search_end(t, 0);
+        clear_kbd_buf(t);
+        t->term_display_typing = 0;
+        if(t == kbd_term) disable_cursor();
+      }
+      else if(!m->raw && t->term_raw && t->term_raw_pid == pcb->pid){
+        t->term_raw = 0;
+      }
+      restore_flags(flags);
+      return 0;
+    default:
+      return -1;
   }
-  //disable typing
-  display_typing = 0;
-  //disable cursor
-  disable_cursor();
-  return 0;
+}
+
+/*
+ * terminal_release
+ *   DESCRIPTION: takes a terminal out of raw mode when the process that
+ *                put it there exits, so the shell gets lines again, and
+ *                lets its window scroll again once nothing has it mapped
+ *   INPUTS: proc - exiting process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may turn raw mode off
+ */
+void terminal_release(pcb_t* proc){
+  term_t* t = &terminals[proc->term];
+  if(t->term_raw && t->term_raw_pid == proc->pid) t->term_raw = 0;
+  if(proc->vidmapped) t->term_mapped--;
 }
 
 /*
  * check_fns
- *   DESCRIPTION: checks if fn key was pressed and switches terminal
+ *   DESCRIPTION: checks if fn key was pressed and switches terminal. The
+ *                new terminal's page is already in VGA memory so this only
+ *                moves the CRTC start address and the cursor and swaps the
+ *                keyboard's terminal pointer. Starts the terminal's shell
+ *                the first time.
  *   INPUTS: none
  *   OUTPUTS: none
- *   RETURN VALUE: none
- *   SIDE EFFECTS: none
+ *   RETURN VALUE: 1 if the terminal was switched, 0 otherwise
+ *   SIDE EFFECTS: asks for a reschedule after the bottom halves
  */
-void check_fns()
+int check_fns()
 {
-  //local var for current terminal
-  term_t *current_term, *new_term;
-  int i,j,k;
-
-  //printf("got here\n");
+  //local var for new terminal
+  term_t* new_term;
+  int i;
 
   for(i = 0; i < NUM_TERMS + 1; i++){
     //check if none of the keys were pressed
-    if(i == NUM_TERMS) return;
+    if(i == NUM_TERMS) return 0;
     //find if any f key is pressed (not f10 or f12)
     if(keys_pressed[F1_PRESS + i]) break;
   }
 
-  //get ptrs to current and new terminal structs
-  current_term = &(terminals[cur_term]);
-  new_term = &(terminals[i]);
   //check if they are equal; do nothing if so
-  if(current_term == new_term) return;
+  new_term = &(terminals[i]);
+  if(new_term == kbd_term) return 0;
 
-  //update cur_term
+  //leaving stops looking at the scrollback
+  kbd_term->term_view = 0;
+
+  //update cur_term and the keyboard's terminal
   cur_term = i;
-  set_pcb();
-
-  //*******SAVE CURRENT VARIABLES FOR CURRENT TERMINAL*********
-
-  //save current terminal's local vars to current terminal struct
-  current_term->term_cur_cmd_idx = cur_cmd_idx;
-  current_term->term_old_cmd_num = old_cmd_num;
-  current_term->term_screen_x = screen_x;
-  current_term->term_screen_y = screen_y;
-  current_term->term_enter_pressed = enter_pressed;
-  current_term->term_display_typing = display_typing;
-  //save current terminal's old cmds
-  for(j = 0; j < MAX_CMDS; j++){
-    for(k = 0; k < KBD_BUF_LENGTH; k++){
-      current_term->term_cmd_buf[j][k] = cmd_buf[j][k];
-    }
-  }
-  //save current buf idxs
-  for(i = 0; i < MAX_CMDS; i++){
-    current_term->term_buf_idxs[i] = buf_idxs[i];
-  }
-  //save current video memory
-  for(j = 0; j < NUM_COLS; j++){
-    for(k = 0; k < NUM_ROWS; k++){
-      current_term->term_screen[j][k] = *(uint8_t *)(video_mem + ((NUM_COLS * k + j) << 1));
-    }
-  }
+  kbd_term = new_term;
 
-  //*******LOAD NEW VARIABLES FOR NEW TERMINAL*********
+  //show the new terminal's window
+  term_show(new_term);
 
-  //load new terminal's local vars
-  cur_cmd_idx = new_term->term_cur_cmd_idx;
-  old_cmd_num = new_term->term_old_cmd_num;
-  screen_x = new_term->term_screen_x;
-  screen_y = new_term->term_screen_y;
-  enter_pressed = new_term->term_enter_pressed;
-  display_typing = new_term->term_display_typing;
-  //load new terminal's old cmds
-  for(j = 0; j < MAX_CMDS; j++){
-    for(k = 0; k < KBD_BUF_LENGTH; k++){
-      cmd_buf[j][k] = new_term->term_cmd_buf[j][k];
-    }
+  //cursor only shows while the new terminal is taking a line
+  if(new_term->term_display_typing){
+    enable_cursor(0, 0);
+    update_cursor(new_term->term_screen_x, new_term->term_screen_y);
   }
-  //load new buf idx's
-  for(i = 0; i < MAX_CMDS; i++){
-    buf_idxs[i] = new_term->term_buf_idxs[i];
-  }
-  //load new video memory
-  for(j = 0; j < NUM_COLS; j++){
-    for(k = 0; k < NUM_ROWS; k++){
-      *(uint8_t *)(video_mem + ((NUM_COLS * k + j) << 1)) = new_term->term_screen[j][k];
-      *(uint8_t *)(video_mem + ((NUM_COLS * k + j) << 1) + 1) = ATTRIB;
-    }
+  else{
+    disable_cursor();
   }
 
-  //update le cursor
-  update_cursor(screen_x, screen_y);
-
-  //if the new terminal has not had a shell, execute a new one
+  //if the new terminal has not had a shell, have a worker start one
   if(!(new_term->term_has_shell)){
     //update shell tracker
     new_term->term_has_shell = 1;
-    //send eoi
-    send_eoi(KBD_IRQ);
-    //execute new shell
-    sys_call_execute((uint8_t*)"shell");
+    queue_shell(cur_term);
   }
-  else{
-    //switch_term_back();
-    //save ebp/esp for current terminal
-    asm volatile("mov %%esp, %%ecx \n\
-                  mov %%ebp, %%ebx \n\
-                  "
-                : "=c" (current_term->term_stack_ptr), "=b" (current_term->term_base_ptr));
-
-    //load ebp/esp for new terminal
-    asm volatile("mov %%ecx, %%esp \n\
-                  mov %%ebx, %%ebp \n\
-                  "
-                : "=c" (new_term->term_stack_ptr), "=b" (new_term->term_base_ptr));
-
-    //asm volatile("jmp context_switch");
-  }
-  //send eoi
-  send_eoi(KBD_IRQ);
+  //give the new terminal's processes a turn
+  bh_want(BH_WANT_RESCHED);
+  return 1;
 }
 
 /*
  * init_terminals
- *   DESCRIPTION: initializes terminals
+ *   DESCRIPTION: initializes terminals and maps the 128KB VGA window at
+ *                0xA0000 so every terminal gets its own text page
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: reprograms the graphics controller and CRTC start
  */
 void init_terminals()
 {
-  int i,j,k;
+  int i;
+  uint8_t misc;
+
+  //graphics controller misc register: memory map select 00 = A0000-BFFFF;
+  //the boot screen at B8000 was cell 0, which is now at A0000
+  outb(0x06, 0x3CE);
+  misc = inb(0x3CF);
+  outb(misc & ~0x0C, 0x3CF);
+
   //loop through all terminals
   for(i = 0; i < NUM_TERMS; i++){
     //init all vars that need to be zero
-    terminals[i].term_cur_cmd_idx = 0;
-    terminals[i].term_old_cmd_num = 0;
-    terminals[i].term_screen_x = 0;
-    terminals[i].term_screen_y = 0;
+    terminals[i].term_line_len = 0;
+    terminals[i].term_hist_head = 0;
+    terminals[i].term_hist_count = 0;
+    terminals[i].term_hist_pos = 0;
+    terminals[i].term_searching = 0;
     terminals[i].term_enter_pressed = 0;
     terminals[i].term_display_typing = 0;
+    terminals[i].term_ahead_head = 0;
+    terminals[i].term_ahead_tail = 0;
     terminals[i].term_has_shell = 0;
-
-    //clear screen array for terminal
-    for(j = 0; j < NUM_COLS; j++){
-      for(k = 0; k < NUM_ROWS; k++){
-        terminals[i].term_screen[j][k] = 0;
-      }
-    }
-
-    //clear cmd buf for terminal
-    for(j = 0; j < MAX_CMDS; j++){
-      for(k = 0; k < KBD_BUF_LENGTH; k++){
-        terminals[i].term_cmd_buf[j][k] = 0;
-      }
+    terminals[i].term_read_wq.head = NULL;
+    terminals[i].term_raw = 0;
+    terminals[i].term_mapped = 0;
+
+    //place the terminal's page in VGA memory
+    terminals[i].term_video = (char *)(VGA_MEM + i * TERM_PAGE_SIZE);
+    terminals[i].term_start = i * TERM_PAGE_CELLS;
+
+    //terminal 0 keeps the boot screen, position and scrollback
+    if(i != 0){
+      terminals[i].term_top = 0;
+      terminals[i].term_sb_head = 0;
+      terminals[i].term_sb_count = 0;
+      terminals[i].term_view = 0;
+      term_clear(&terminals[i]);
     }
+  }
 
-    // //clear pid arr
-    // for(j = 0; j < NUM_TERMS; j++){
-    //   for(k = 0; k < MAX_PROCESS_NUM; k++){
-    //     terminals[i].term_pid_arr[j][k] = 0;
-    //   }
-    // }
+  //init cur_term
+  cur_term = 0;
+  kbd_term = &terminals[0];
+  term_show(kbd_term);
 
-    //init cur_term
-    cur_term = 0;
-  }
   //set the first terminal to have a shell opened
   terminals[0].term_has_shell = 1;
 }
 
-// /*
-//  * get_cur_term
-//  *   DESCRIPTION: gets the current terminal num
-//  *   INPUTS: none
-//  *   OUTPUTS: current terminal num
-//  *   RETURN VALUE: current terminal num
-//  *   SIDE EFFECTS: none
-//  */
-// int get_cur_term()
-// {
-//   return(cur_term);
-// }
-
 /*
  * bruh
  *   DESCRIPTION: [REDACTED]
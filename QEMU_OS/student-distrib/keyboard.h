@@ -13,6 +13,8 @@
 #define CTRL_PRESS              0x1D
 #define G_PRESS                 0x22
 #define L_PRESS                 0x26
+#define R_PRESS                 0x13
+#define ESC_PRESS               0x01
 #define ALT_PRESS               0x38
 #define SPACE_PRESS             0x39
 #define ENTER_PRESS             0x1C
@@ -32,6 +34,8 @@
 #define C_PRESS                 0x2E
 #define UP_PRESS                0x48
 #define DOWN_PRESS              0x50
+#define PGUP_PRESS              0x49
+#define PGDN_PRESS              0x51
 
 //kbd buffer length
 #define KBD_BUF_LENGTH          128
@@ -43,6 +47,11 @@
 #define SINGLE_QUOTE_THING      0x27
 #define BACKSPACE               0x08
 
+//scancodes the top half can queue, power of 2
+#define KBD_RING_SIZE           64
+//chars typed ahead of the next terminal_read a terminal keeps, power of 2
+#define TYPEAHEAD_SIZE          256
+
 //kbd irq number
 #define KBD_IRQ                 0x01
 // keyboard port number for inb and outb
@@ -53,44 +62,140 @@
 #define NUM_COLS                80
 #define NUM_ROWS                25
 #define ATTRIB                  0x2 // COLOR - LIB.C
+//16-bit text cell: attribute in the high byte, char in the low byte
+#define CELL(c)                 ((uint16_t)((ATTRIB << 8) | (uint8_t)(c)))
 
 //number of terminals
 #define NUM_TERMS               10
 
-//number of processses
-#define MAX_PROCESS_NUM         24
+//VGA text memory once the graphics controller maps all 128KB at 0xA0000;
+//every terminal owns one page of it and Alt+Fn only moves the CRTC start
+#define VGA_MEM                 0xA0000
+#define TERM_PAGE_SIZE          0x3000
+#define TERM_PAGE_CELLS         (TERM_PAGE_SIZE / 2)
+//rows in a page; the visible window slides down the page as it scrolls
+#define TERM_PAGE_ROWS          (TERM_PAGE_CELLS / NUM_COLS)
+//spare VGA memory after the last page, Shift+PgUp draws the old lines here
+#define SCROLL_VIEW_CELLS       (NUM_TERMS * TERM_PAGE_CELLS)
+#define SCROLL_VIEW             (VGA_MEM + SCROLL_VIEW_CELLS * 2)
+
+//screens of scrolled off output kept per terminal
+#define SCROLLBACK_SCREENS      4
+#define SCROLLBACK_LINES        (SCROLLBACK_SCREENS * NUM_ROWS)
+
+//ioctl commands on a terminal fd, the argument is a term_mode_t
+#define TERM_GETMODE            1
+#define TERM_SETMODE            2
+
+//terminal fds keep their mode in file_position, which they do not use
+//otherwise: the raw bit, the min count in bits 8-15 and the timeout in ms
+//in bits 16-31
+#define TERM_MODE_RAW           0x1
+#define TERM_MODE_MIN(m)        (((m) >> 8) & 0xFF)
+#define TERM_MODE_TIMEOUT(m)    (((m) >> 16) & 0xFFFF)
+
+//modifier bits of a key event
+#define KEY_MOD_SHIFT           0x1
+#define KEY_MOD_CTRL            0x2
+#define KEY_MOD_ALT             0x4
+#define KEY_MOD_CAPS            0x8
+
+//key events a raw terminal can queue, power of 2
+#define RAW_EVENTS              64
+
+//argument of TERM_GETMODE and TERM_SETMODE. In raw mode read returns key
+//events: it waits for min of them, or with a timeout (ms) for at least one
+//until the timeout passes
+typedef struct term_mode_t {
+    int32_t raw;
+    int32_t min;
+    int32_t timeout;
+} term_mode_t;
+
+//what a raw read returns per key: the scancode (bit 7 set on release),
+//the char it types (0 if none) and the KEY_MOD_* bits held
+typedef struct key_event_t {
+    uint8_t code;
+    uint8_t ch;
+    uint8_t mods;
+    uint8_t pad;
+} key_event_t;
+
+//one cell for put_cells: position in the window, char and attribute
+typedef struct cell_update_t {
+    uint8_t row;
+    uint8_t col;
+    uint8_t ch;
+    uint8_t attr;
+} cell_update_t;
 
-//terminal struct
+//terminal struct, all of a terminal's screen and line discipline state
 typedef struct term_t {
-    //holds stack ptr
-    uint32_t term_stack_ptr;
-    //holds base ptr
-    uint32_t term_base_ptr;
-    //holds old cmds for terminal
-    unsigned char term_cmd_buf[MAX_CMDS][KBD_BUF_LENGTH];
-    //holds index to current position in the cmd array
-    int term_cur_cmd_idx;
-    //holds index for each cmd in history
-    int term_buf_idxs[MAX_CMDS];
-    //holds number of old cmds in history
-    int term_old_cmd_num;
+    //line being typed and its length
+    unsigned char term_line[KBD_BUF_LENGTH];
+    int term_line_len;
+    //ring of accepted lines, the newest is just before term_hist_head
+    unsigned char term_hist[MAX_CMDS][KBD_BUF_LENGTH];
+    int term_hist_len[MAX_CMDS];
+    int term_hist_head;
+    int term_hist_count;
+    //history entry Up/Down is showing, 1 is the newest, 0 the typed line
+    int term_hist_pos;
+    //typed line kept while Up/Down or Ctrl+R show history
+    unsigned char term_saved[KBD_BUF_LENGTH];
+    int term_saved_len;
+    //Ctrl+R: set while searching, the query, the matching entry (0 if
+    //none) and the cells the search prompt takes on screen
+    int term_searching;
+    unsigned char term_query[KBD_BUF_LENGTH];
+    int term_query_len;
+    int term_search_hit;
+    int term_search_shown;
     //holds screen position of cursor
     int term_screen_x;
     int term_screen_y;
-    //holds screen for terminal
-    unsigned char term_screen[NUM_COLS][NUM_ROWS];
+    //this terminal's page in VGA memory
+    char* term_video;
+    //cell offset of the page in VGA memory
+    uint16_t term_start;
+    //page row the visible window starts on, the CRTC start is at this row
+    int term_top;
+    //processes with the page vidmapped, the window stays at row 0 while set
+    int term_mapped;
+    //ring of lines that scrolled off the top of the window
+    uint16_t term_sb[SCROLLBACK_LINES][NUM_COLS];
+    //next ring slot to write and number of lines in the ring
+    int term_sb_head;
+    int term_sb_count;
+    //lines scrolled back with Shift+PgUp, 0 when showing the live window
+    int term_view;
     //store if enter is pressed
     int term_enter_pressed;
     //store if typing is allowed
     int term_display_typing;
+    //chars typed while no read was taking a line, the next read takes them
+    unsigned char term_ahead[TYPEAHEAD_SIZE];
+    uint32_t term_ahead_head;
+    uint32_t term_ahead_tail;
     //stores if terminal has had a shell opened
     int term_has_shell;
+    //processes sleeping in terminal_read until enter
+    wait_queue_t term_read_wq;
+    //set while a process reads this terminal in raw mode, and its pid
+    int term_raw;
+    int term_raw_pid;
+    //key events waiting for a raw read
+    key_event_t term_raw_ev[RAW_EVENTS];
+    uint32_t term_raw_head;
+    uint32_t term_raw_tail;
 } term_t;
 
 //terminals array stores all info for every terminal
-term_t terminals[NUM_TERMS];
-//stores current terminal
-int cur_term;
+extern term_t terminals[NUM_TERMS];
+//stores current (visible) terminal
+extern int cur_term;
+//visible terminal, the one keystrokes go to
+extern term_t* kbd_term;
 
 // initialize necessary variables for keyboard functionality
 void keyboard_init();
@@ -104,32 +209,58 @@ void update_cursor(int x, int y);
 void keyboard_IH();
 //clears screen and sets line feed to 0,0
 void clear_and_reset(void);
-//switches the current kbd buffer between current and old ones
-void switch_cmd_buffer();
-//shifts old cmds
-void shift_old_cmds();
+//clears a terminal's screen and sets its line feed to 0,0
+void term_clear(term_t* t);
+//moves n entries back (negative is forward) in the history
+void switch_cmd_buffer(term_t* t, int n);
+//adds the typed line to the history
+void hist_add(term_t* t);
 //function to print the buffer
-void print_kbd_buf();
+void print_kbd_buf(term_t* t);
 //clears the display buffer
-void clear_kbd_buf();
+void clear_kbd_buf(term_t* t);
 //open terminal
 int32_t terminal_open(const uint8_t* filename);
 //close terminal
 int32_t terminal_close(int32_t fd);
 //write char to video mem
 void terminal_putc(uint8_t c);
+//write char to a terminal's page
+void term_putc(term_t* t, uint8_t c);
+//write a string to a terminal's page
+void term_puts(term_t* t, const char* s);
+//write n chars to a terminal's page with one cursor update
+void term_write(term_t* t, const uint8_t* buf, int32_t n);
+//write n chars to the caller's terminal
+void terminal_puts(const uint8_t* buf, int32_t n);
+//store n cells into a terminal's window, no cursor move or scroll
+int32_t term_put_cells(term_t* t, const cell_update_t* cells, int32_t n);
 //scrolls the terminal upwards
 void scroll_terminal(int n);
+//scrolls a terminal's page upwards
+void term_scroll(term_t* t, int n);
+//moves the scrollback view of a terminal n lines back (negative is forward)
+void term_scroll_view(term_t* t, int n);
+//moves a terminal's window to the top of its page
+void term_home(term_t* t);
 //backspace function
 void terminal_delc();
-//copies terminal buffer to video memory
-void show_screen();
+//backspace on a terminal's page
+void term_delc(term_t* t);
 //terminal_write
 int32_t terminal_write(int32_t fd, const void* buf, int32_t nbytes);
 //terminal_read
 int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes);
+//starts taking a line for terminal_read or poll
+void terminal_poll_arm(int32_t fd);
+//readiness for poll
+int32_t terminal_ready(int32_t fd);
+//gets or sets the input mode of a terminal fd
+int32_t terminal_ioctl(int32_t fd, int32_t cmd, void* arg);
+//drops the exiting process's raw mode and vidmap of its terminal
+void terminal_release(pcb_t* proc);
 //checks if fn keys were pressed and switches terminals
-void check_fns();
+int check_fns();
 //initializes terminals
 void init_terminals();
 // //gets current terminal number
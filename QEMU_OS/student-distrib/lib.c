@@ -11,14 +11,14 @@
 
 // static int screen_x;
 // static int screen_y;
-static char* video_mem = (char *)VIDEO;
 
 /* void clear(void);
  * Inputs: void
  * Return Value: none
- * Function: Clears video memory, doenst change line feed */
+ * Function: Clears the visible terminal's page, doenst change line feed */
 void clear(void) {
     int32_t i;
+    char* video_mem = kbd_term->term_video + kbd_term->term_top * NUM_COLS * 2;
     for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
         *(uint8_t *)(video_mem + (i << 1)) = ' ';
         *(uint8_t *)(video_mem + (i << 1) + 1) = ATTRIB;
@@ -156,11 +156,8 @@ format_char_switch:
  *   Return Value: Number of bytes written
  *    Function: Output a string to the console */
 int32_t puts(int8_t* s) {
-    register int32_t index = 0;
-    while (s[index] != '\0') {
-        putc(s[index]);
-        index++;
-    }
+    register int32_t index = strlen(s);
+    terminal_puts((uint8_t*)s, index);
     return index;
 }
 
@@ -208,6 +205,27 @@ int32_t fmin(int32_t x, int32_t y){
     return y;
 }
 
+/*
+ * div64
+ *   DESCRIPTION: divides a 64-bit number by a 32-bit one with two divl,
+ *                since there is no libgcc to do 64-bit division
+ *   INPUTS: n - dividend
+ *           d - divisor, not 0
+ *           rem - where to store the remainder, may be NULL
+ *   OUTPUTS: the remainder in *rem
+ *   RETURN VALUE: n / d
+ *   SIDE EFFECTS: none
+ */
+uint64_t div64(uint64_t n, uint32_t d, uint32_t* rem){
+    uint32_t hi = n >> 32;
+    uint32_t q_hi = hi / d;
+    uint32_t q_lo, r = hi % d;
+    /* r < d so the second quotient fits in 32 bits */
+    asm ("divl %4" : "=a"(q_lo), "=d"(r) : "a"((uint32_t) n), "d"(r), "rm"(d));
+    if(rem) *rem = r;
+    return ((uint64_t) q_hi << 32) | q_lo;
+}
+
 /* int8_t* itoa(uint32_t value, int8_t* buf, int32_t radix);
  * Inputs: uint32_t value = number to convert
  *            int8_t* buf = allocated buffer to place string in
@@ -498,6 +516,7 @@ int8_t* strncpy(int8_t* dest, const int8_t* src, uint32_t n) {
  * Function: increments video memory. To be used to test rtc */
 void test_interrupts(void) {
     int32_t i;
+    char* video_mem = kbd_term->term_video + kbd_term->term_top * NUM_COLS * 2;
     for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
         video_mem[i << 1]++;
     }
@@ -16,6 +16,7 @@ uint32_t strlen(const int8_t* s);
 void clear(void);
 int32_t fmax(int32_t x, int32_t y);
 int32_t fmin(int32_t x, int32_t y);
+uint64_t div64(uint64_t n, uint32_t d, uint32_t* rem);
 
 void* memset(void* s, int32_t c, uint32_t n);
 void* memset_word(void* s, int32_t c, uint32_t n);
@@ -156,4 +157,15 @@ do {                                    \
     );                                  \
 } while (0)
 
+/* Read time stamp counter
+ * Puts the 64-bit count of cycles since reset into "val" */
+#define rdtsc(val)                      \
+do {                                    \
+    asm volatile ("rdtsc"               \
+            : "=A"(val)                 \
+            :                           \
+            : "memory"                  \
+    );                                  \
+} while (0)
+
 #endif /* _LIB_H */
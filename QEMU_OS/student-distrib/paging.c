@@ -3,9 +3,19 @@
 #include "x86_desc.h"
 #include "lib.h"
 #include "syscalls.h"
+#include "smp.h"
 
-// VIDEO memory value found in lib.c
-#define VIDEO 0xB8000
+// VGA memory window once the graphics controller maps all of it
+#define VGA_START 0xA0000
+#define VGA_END   0xC0000
+
+// one page directory per process, kernel PDEs are copied in at exec time
+static pde proc_dirs[MAX_PROCESS_NUM][NUM_ENTRIES] __attribute__((aligned(4096)));
+// private vidmap page table per process so vidmap never touches page_table
+static pte vidmap_tables[MAX_PROCESS_NUM][NUM_ENTRIES] __attribute__((aligned(4096)));
+
+// one flag per frame in the pool, 1 if allocated
+static uint8_t frame_used[NUM_FRAMES];
 
 /*
  * paging_init
@@ -29,11 +39,14 @@ paging_init()
     page_table[i].supervisor = 1;
   }
 
-  // page_table points to video memory
-  page_table[VIDEO>>12].bits = VIDEO;
-  page_table[VIDEO>>12].present = 1;
-  page_table[VIDEO>>12].read_and_write = 1;
-  // page_table[VIDEO>>12].global = 1;
+  // page_table points to all 128KB of VGA memory, every terminal has a page
+  // in it (see keyboard.h)
+  for (i=VGA_START>>12; i<VGA_END>>12; i++) {
+    page_table[i].bits = i << 12;
+    page_table[i].present = 1;
+    page_table[i].read_and_write = 1;
+    page_table[i].global = 1; // shared by every process directory
+  }
 
   // first pde should be a pointer to the page table
 	page_directory[0].bits = (uint32_t)page_table;
@@ -47,7 +60,17 @@ paging_init()
   page_directory[1].read_and_write = 1;
   page_directory[1].supervisor = 1;
   page_directory[1].page_size = 1; // enable 4MB size page
-  // page_directory[1].global = 1;
+  page_directory[1].global = 1; // kernel page survives CR3 loads
+
+  // identity map the frame pool with kernel-only 4MB pages so the kernel
+  // can fill frames before they are handed to a process
+  for (i=FRAME_POOL_START/(4*MB); i<FRAME_POOL_END/(4*MB); i++) {
+    page_directory[i].bits = i * 4 * MB;
+    page_directory[i].present = 1;
+    page_directory[i].read_and_write = 1;
+    page_directory[i].page_size = 1;
+    page_directory[i].global = 1;
+  }
 
 /*
   ***Each operation involves using EAX as a buffer***
@@ -58,6 +81,9 @@ paging_init()
   SET BIT 4 OF CR4 TO 1 TO ENABLE PAGE SIZE EXTENSION
   "movl %cr4, %eax;" "andl $0x00000010, %eax;" "movl %eax, %cr4;"
 
+  SET BIT 7 OF CR4 TO 1 TO ENABLE GLOBAL PAGES
+  "movl %cr4, %eax;" "orl $0x00000080, %eax;" "movl %eax, %cr4;"
+
   SET BIT 5 OF CR4 TO 0 TO DISABLE PHYSICAL ADDRESS SIZE EXTENSION
   "movl %cr4, %eax;" "andl $0xFFFFFFDF, %eax;" "movl %eax, %cr4;"
 
@@ -77,61 +103,306 @@ paging_init()
     "movl %cr0, %eax;"
     "orl $0x80000000, %eax;"
     "movl %eax, %cr0;"
+    "movl %cr4, %eax;"
+    "orl $0x00000080, %eax;"
+    "movl %eax, %cr4;"
   );
 }
 
 /*
- * map_page
- *   DESCRIPTION: map virtual address to physical address for 4MB page
- *   INPUTS: process_num -- current process number
+ * init_proc_dir
+ *   DESCRIPTION: builds the page directory for a process. The kernel PDEs are
+ *                shared with the boot directory and the 4MB user page at
+ *                128MB points at the process's own physical page
+ *   INPUTS: pid -- process number (also its physical page slot)
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: changes PD & PT and turns on paging
+ *   SIDE EFFECTS: overwrites proc_dirs[pid] and clears its vidmap table
  */
 void
-map_page(int process_num)
+init_proc_dir(int pid)
 {
-    // index is 32 becuase 128 MB page directory / 4 MB pages
-    //page_directory[32].pb_address = 8 * MB + 4 * MB * process_num;
-    page_directory[32].bits = 8 * MB + 4 * MB * process_num;
-    page_directory[32].page_size = 1; // b/c 4MB pages
-    page_directory[32].read_and_write = 1;
-    page_directory[32].present = 1;
-    page_directory[32].supervisor = 1;
-
-    // Flush TLB - OSDEV
-    asm volatile (
-      "movl	%cr3, %eax;"
-      "movl	%eax, %cr3;"
-    );
+  int i;
+  pde* dir = proc_dirs[pid];
+
+  // kernel PDEs are the same in every directory
+  for (i=0; i<NUM_ENTRIES; i++) {
+    dir[i].bits = page_directory[i].bits;
+    vidmap_tables[pid][i].bits = 0;
+  }
+
+  // index is 32 becuase 128 MB page directory / 4 MB pages
+  dir[USER_PDE].bits = 8 * MB + 4 * MB * pid;
+  dir[USER_PDE].page_size = 1; // b/c 4MB pages
+  dir[USER_PDE].read_and_write = 1;
+  dir[USER_PDE].present = 1;
+  dir[USER_PDE].supervisor = 1;
+
+  // no vidmap until the process asks for it
+  dir[VIDMAP_PDE].bits = 0;
+
+  // an idle CPU may still have the last user of this slot loaded
+  tlb_shootdown(pid);
+}
+
+/*
+ * switch_page_dir
+ *   DESCRIPTION: makes a process's page directory the active one
+ *   INPUTS: pid -- process number
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: loads CR3, flushing all non-global TLB entries, and
+ *                 records it for tlb_shootdown
+ */
+void
+switch_page_dir(int pid)
+{
+  asm volatile (
+    "movl %0, %%cr3;"
+    :
+    : "r"(proc_dirs[pid])
+    : "memory"
+  );
+  cpu_self()->cr3_pid = pid;
 }
 
 /*
  * map_page_vidmap
- *   DESCRIPTION: map virtual address to physical address for 4KB page
- *   INPUTS: none
+ *   DESCRIPTION: map virtual address 132MB to video memory through the
+ *                process's private 4KB page table
+ *   INPUTS: pid -- process number
+ *           phys -- 4KB aligned video page to map
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: changes PD & PT and turns on paging
+ *   SIDE EFFECTS: changes the process's PD & vidmap PT
  */
 void
-map_page_vidmap()
+map_page_vidmap(int pid, uint32_t phys)
 {
-// initialize 4KB page
-  page_table[0].bits = VIDEO;
-  page_table[0].supervisor = 1;
-  page_table[0].read_and_write = 1;
-  page_table[0].present = 1;
+  pte* table = vidmap_tables[pid];
+  pde* dir = proc_dirs[pid];
+
+  // initialize 4KB page
+  table[0].bits = phys;
+  table[0].supervisor = 1;
+  table[0].read_and_write = 1;
+  table[0].present = 1;
 
   // index is 33 because 132 MB page directory / 4 MB pages
-  page_directory[33].bits = (uint32_t) page_table; // points to page_table
-  page_directory[33].supervisor = 1;
-  page_directory[33].read_and_write = 1;
-  page_directory[33].present = 1;
+  dir[VIDMAP_PDE].bits = (uint32_t) table; // points to private table
+  dir[VIDMAP_PDE].supervisor = 1;
+  dir[VIDMAP_PDE].read_and_write = 1;
+  dir[VIDMAP_PDE].present = 1;
 
   // Flush TLB - OSDEV
   asm volatile (
     "movl    %cr3, %eax;"
     "movl    %eax, %cr3;"
   );
+  tlb_shootdown(pid);
+}
+
+/*
+ * map_kernel_low
+ *   DESCRIPTION: identity maps 4KB pages in the first 4MB for the kernel,
+ *                for reading BIOS tables. Call before the first process
+ *                directory is built.
+ *   INPUTS: start -- first address, rounded down to a page
+ *           end -- end address, exclusive
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes page_table, flushes the TLB
+ */
+void
+map_kernel_low(uint32_t start, uint32_t end)
+{
+  uint32_t i;
+  for (i = start >> 12; i < ((end + 0xFFF) >> 12) && i < NUM_ENTRIES; i++) {
+    page_table[i].bits = i << 12;
+    page_table[i].present = 1;
+    page_table[i].read_and_write = 1;
+    page_table[i].global = 1;
+  }
+  asm volatile (
+    "movl    %%cr3, %%eax;"
+    "movl    %%eax, %%cr3;"
+    : : : "eax", "memory"
+  );
+}
+
+/*
+ * map_mmio
+ *   DESCRIPTION: identity maps the 4MB page holding a device's registers
+ *                for the kernel, with caching off so every access reaches
+ *                the device. Call before the first process directory is
+ *                built.
+ *   INPUTS: phys -- any address in the register block
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the boot PD
+ */
+void
+map_mmio(uint32_t phys)
+{
+  int i = phys / (4 * MB);
+  page_directory[i].bits = i * 4 * MB;
+  page_directory[i].present = 1;
+  page_directory[i].read_and_write = 1;
+  page_directory[i].page_size = 1;
+  page_directory[i].cache_disabled = 1;
+  page_directory[i].global = 1;
+}
+
+/*
+ * alloc_frames
+ *   DESCRIPTION: first-fit allocation of physically contiguous 4KB frames
+ *   INPUTS: n -- number of frames
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address of the first frame, 0 if none fit
+ *   SIDE EFFECTS: marks frames used
+ */
+uint32_t
+alloc_frames(int n)
+{
+  int i, run = 0;
+  if (n <= 0 || n > NUM_FRAMES) return 0;
+  for (i=0; i<NUM_FRAMES; i++) {
+    run = frame_used[i] ? 0 : run + 1;
+    if (run == n) {
+      // claim the run we just found
+      for (; run > 0; run--) frame_used[i - run + 1] = 1;
+      return FRAME_POOL_START + (i - n + 1) * FRAME_SIZE;
+    }
+  }
+  return 0;
+}
+
+/*
+ * free_frames
+ *   DESCRIPTION: returns frames to the pool
+ *   INPUTS: phys -- physical address of the first frame
+ *           n -- number of frames
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: marks frames free
+ */
+void
+free_frames(uint32_t phys, int n)
+{
+  int i = (phys - FRAME_POOL_START) / FRAME_SIZE;
+  for (; n > 0 && i < NUM_FRAMES; n--, i++) frame_used[i] = 0;
+}
+
+/*
+ * map_user_page
+ *   DESCRIPTION: maps one user 4KB page in the shared memory region of a
+ *                process, allocating a page table from the pool if needed
+ *   INPUTS: pid -- process number
+ *           vaddr -- page aligned virtual address, in [136MB, 1GB)
+ *           phys -- page aligned physical address
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on fail
+ *   SIDE EFFECTS: changes the process's PD & PT
+ */
+int32_t
+map_user_page(int pid, uint32_t vaddr, uint32_t phys)
+{
+  pde* dir = proc_dirs[pid];
+  pte* table;
+  int i;
+  uint32_t pd_idx = vaddr >> 22;
+
+  if (pd_idx < SHM_PDE || pd_idx >= SHM_PDE_END) return -1;
+  if (dir[pd_idx].present && pde_kernel(dir[pd_idx])) return -1;
+
+  // get a page table for this 4MB block
+  if (!dir[pd_idx].present) {
+    uint32_t frame = alloc_frames(1);
+    if (frame == 0) return -1;
+    table = (pte*) frame;
+    for (i=0; i<NUM_ENTRIES; i++) table[i].bits = 0;
+    dir[pd_idx].bits = frame;
+    dir[pd_idx].supervisor = 1;
+    dir[pd_idx].read_and_write = 1;
+    dir[pd_idx].present = 1;
+  }
+  table = (pte*) (dir[pd_idx].bits & 0xFFFFF000);
+
+  table[(vaddr >> 12) & 0x3FF].bits = phys;
+  table[(vaddr >> 12) & 0x3FF].supervisor = 1;
+  table[(vaddr >> 12) & 0x3FF].read_and_write = 1;
+  table[(vaddr >> 12) & 0x3FF].present = 1;
+  return 0;
+}
+
+/*
+ * unmap_user_page
+ *   DESCRIPTION: removes one user 4KB page from a process directory
+ *   INPUTS: pid -- process number
+ *           vaddr -- page aligned virtual address
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address that was mapped, 0 if none
+ *   SIDE EFFECTS: changes the process's PT and flushes that TLB entry
+ */
+uint32_t
+unmap_user_page(int pid, uint32_t vaddr)
+{
+  pde* dir = proc_dirs[pid];
+  pte* table;
+  uint32_t phys;
+  uint32_t pd_idx = vaddr >> 22;
+
+  if (pd_idx < SHM_PDE || pd_idx >= SHM_PDE_END || !dir[pd_idx].present) return 0;
+  if (pde_kernel(dir[pd_idx])) return 0;
+  table = (pte*) (dir[pd_idx].bits & 0xFFFFF000);
+  if (!table[(vaddr >> 12) & 0x3FF].present) return 0;
+
+  phys = table[(vaddr >> 12) & 0x3FF].bits & 0xFFFFF000;
+  table[(vaddr >> 12) & 0x3FF].bits = 0;
+  asm volatile ("invlpg (%0)" : : "r"(vaddr) : "memory");
+  tlb_shootdown(pid);
+  return phys;
+}
+
+/*
+ * user_page_mapped
+ *   DESCRIPTION: checks whether a user 4KB page in the shared memory region
+ *                is in use
+ *   INPUTS: pid -- process number
+ *           vaddr -- virtual address
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if mapped, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t
+user_page_mapped(int pid, uint32_t vaddr)
+{
+  pde* dir = proc_dirs[pid];
+  uint32_t pd_idx = vaddr >> 22;
+  if (!dir[pd_idx].present) return 0;
+  if (pd_idx < SHM_PDE || pd_idx >= SHM_PDE_END || pde_kernel(dir[pd_idx])) return 1;
+  return ((pte*) (dir[pd_idx].bits & 0xFFFFF000))[(vaddr >> 12) & 0x3FF].present;
+}
+
+/*
+ * free_user_tables
+ *   DESCRIPTION: gives every shared memory page table of a process back to
+ *                the frame pool. Called once the process's mappings are gone
+ *   INPUTS: pid -- process number
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: clears the process's PDEs in the shared memory window
+ */
+void
+free_user_tables(int pid)
+{
+  pde* dir = proc_dirs[pid];
+  int i;
+  for (i=SHM_PDE; i<SHM_PDE_END; i++) {
+    if (dir[i].present && !pde_kernel(dir[i])) {
+      free_frames(dir[i].bits & 0xFFFFF000, 1);
+      dir[i].bits = 0;
+    }
+  }
+  tlb_shootdown(pid);
 }
@@ -1,4 +1,53 @@
+// paging.h - declares paging setup and per-process page directory functions
+
+#ifndef _PAGING_H
+#define _PAGING_H
+
+#include "types.h"
+
+// page directory index of the 4MB user program page (128MB / 4MB)
+#define USER_PDE                32
+// page directory index of the vidmap page table (132MB / 4MB)
+#define VIDMAP_PDE              33
+// first page directory index free for shared memory mappings (136MB / 4MB)
+#define SHM_PDE                 34
+// end of the shared memory window (1GB / 4MB), well below the kernel's
+// global 4MB MMIO PDEs that every directory copies
+#define SHM_PDE_END             256
+// a PDE the kernel owns in every directory, never a user page table
+#define pde_kernel(d)           ((d).page_size || (d).global)
+
+// physical 4KB frame pool above the process pages, identity mapped for the
+// kernel only (8MB + 4MB * MAX_PROCESS_NUM = 104MB)
+#define FRAME_POOL_START        0x6800000
+#define FRAME_POOL_END          0x7800000
+#define FRAME_SIZE              4096
+#define NUM_FRAMES              ((FRAME_POOL_END - FRAME_POOL_START) / FRAME_SIZE)
+
 // initialize paging
 void paging_init();
-void map_page(int process_num);
-void map_page_vidmap();
+// build a fresh page directory for a process that shares the kernel PDEs
+void init_proc_dir(int pid);
+// make a process's page directory the active one (single CR3 load)
+void switch_page_dir(int pid);
+// map video memory into a process's private vidmap page table
+void map_page_vidmap(int pid, uint32_t phys);
+// identity map the 4KB pages of [start, end) below 4MB for the kernel only
+void map_kernel_low(uint32_t start, uint32_t end);
+// identity map the 4MB page holding device registers at phys, uncached
+void map_mmio(uint32_t phys);
+
+// allocate n physically contiguous frames from the pool, 0 on failure
+uint32_t alloc_frames(int n);
+// return n frames starting at phys to the pool
+void free_frames(uint32_t phys, int n);
+// map one 4KB user page in a process directory, 0 on success
+int32_t map_user_page(int pid, uint32_t vaddr, uint32_t phys);
+// unmap one 4KB user page, returns the physical address it pointed to
+uint32_t unmap_user_page(int pid, uint32_t vaddr);
+// check if a 4KB user page is mapped
+int32_t user_page_mapped(int pid, uint32_t vaddr);
+// free every page table above the vidmap PDE of a process
+void free_user_tables(int pid);
+
+#endif //_PAGING_H
@@ -0,0 +1,292 @@
+// pipe.c - kernel pipes backed by a one page ring buffer
+#include "pipe.h"
+#include "sched.h"
+#include "poll.h"
+#include "lib.h"
+
+static pipe_t pipes[MAX_PIPES];
+
+static int32_t pipe_read(int32_t fd, void* buf, int32_t nbytes);
+static int32_t pipe_write(int32_t fd, const void* buf, int32_t nbytes);
+static int32_t pipe_close_read(int32_t fd);
+static int32_t pipe_close_write(int32_t fd);
+static void pipe_dup_read(uint32_t inode);
+static void pipe_dup_write(uint32_t inode);
+static int32_t pipe_ready_read(int32_t fd);
+static int32_t pipe_ready_write(int32_t fd);
+
+//read end jump table
+file_jump_table_t pipe_read_fn = {retfail, pipe_close_read, pipe_read, retfail,
+                                  pipe_dup_read, pipe_ready_read, NULL};
+//write end jump table
+file_jump_table_t pipe_write_fn = {retfail, pipe_close_write, retfail, pipe_write,
+                                   pipe_dup_write, pipe_ready_write, NULL};
+
+/*
+ * pipe_init
+ *   DESCRIPTION: clears the pipe table
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: all pipes marked free
+ */
+void pipe_init()
+{
+  int i;
+  for (i = 0; i < MAX_PIPES; i++) pipes[i].in_use = 0;
+}
+
+/*
+ * pipe_put
+ *   DESCRIPTION: frees the ring once both ends are closed
+ *   INPUTS: p - pipe
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may free the pipe's frame
+ */
+static void pipe_put(pipe_t* p)
+{
+  if (p->readers > 0 || p->writers > 0) return;
+  free_frames((uint32_t)p->buf, 1);
+  p->in_use = 0;
+}
+
+/*
+ * pipe_read
+ *   DESCRIPTION: copies up to nbytes out of the ring straight into the
+ *                caller's buffer, sleeping while the ring is empty and a
+ *                writer is still open
+ *   INPUTS: fd - read end
+ *           buf - user buffer
+ *           nbytes - max bytes to read
+ *   OUTPUTS: fills buf
+ *   RETURN VALUE: bytes read, 0 at end of file, -1 if buf is not in the
+ *                 user page or the process is killed
+ *   SIDE EFFECTS: may block, wakes writers
+ */
+static int32_t pipe_read(int32_t fd, void* buf, int32_t nbytes)
+{
+  uint32_t flags;
+  uint32_t n, off, first;
+  uint32_t address = (uint32_t)buf;
+  pipe_t* p = &pipes[pcb->file_array[fd].inode];
+
+  //buffer must sit in the user page
+  if (nbytes < 0 || nbytes > 4*MB || address < 128*MB || address > 132*MB - nbytes) return -1;
+
+  cli_and_save(flags);
+  while (p->tail == p->head && p->writers > 0) {
+    if (sleep_killed()) {
+      restore_flags(flags);
+      return -1;
+    }
+    sleep_on(&p->read_wq);
+  }
+
+  n = p->tail - p->head;
+  if (n > (uint32_t)nbytes) n = nbytes;
+  //copy in at most two pieces, the second one after the wrap
+  off = p->head & (PIPE_SIZE - 1);
+  first = PIPE_SIZE - off;
+  if (first > n) first = n;
+  memcpy(buf, p->buf + off, first);
+  memcpy((uint8_t*)buf + first, p->buf, n - first);
+  p->head += n;
+
+  wake_up(&p->write_wq);
+  poll_wake();
+  restore_flags(flags);
+  return n;
+}
+
+/*
+ * pipe_write
+ *   DESCRIPTION: copies the caller's buffer straight into the ring, sleeping
+ *                whenever it is full until a reader makes room
+ *   INPUTS: fd - write end
+ *           buf - user buffer
+ *           nbytes - bytes to write
+ *   OUTPUTS: none
+ *   RETURN VALUE: bytes written, -1 if buf is not in the user page, no
+ *                 reader is left or killed
+ *   SIDE EFFECTS: may block, wakes readers
+ */
+static int32_t pipe_write(int32_t fd, const void* buf, int32_t nbytes)
+{
+  uint32_t flags;
+  uint32_t n, off, first;
+  int32_t done = 0;
+  uint32_t address = (uint32_t)buf;
+  pipe_t* p = &pipes[pcb->file_array[fd].inode];
+
+  //buffer must sit in the user page
+  if (nbytes < 0 || nbytes > 4*MB || address < 128*MB || address > 132*MB - nbytes) return -1;
+
+  cli_and_save(flags);
+  while (done < nbytes) {
+    while (p->tail - p->head == PIPE_SIZE && p->readers > 0) {
+      if (sleep_killed()) {
+        restore_flags(flags);
+        return -1;
+      }
+      sleep_on(&p->write_wq);
+    }
+    if (p->readers == 0) break;
+
+    n = PIPE_SIZE - (p->tail - p->head);
+    if (n > (uint32_t)(nbytes - done)) n = nbytes - done;
+    off = p->tail & (PIPE_SIZE - 1);
+    first = PIPE_SIZE - off;
+    if (first > n) first = n;
+    memcpy(p->buf + off, (uint8_t*)buf + done, first);
+    memcpy(p->buf, (uint8_t*)buf + done + first, n - first);
+    p->tail += n;
+    done += n;
+
+    wake_up(&p->read_wq);
+    poll_wake();
+  }
+  restore_flags(flags);
+
+  //a write with nobody left to read it fails like a broken pipe
+  if (done == 0 && nbytes > 0) return -1;
+  return done;
+}
+
+/*
+ * pipe_close_read
+ *   DESCRIPTION: drops one read end, writers see -1 once all are gone
+ *   INPUTS: fd - read end
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: wakes writers, may free the pipe
+ */
+static int32_t pipe_close_read(int32_t fd)
+{
+  uint32_t flags;
+  pipe_t* p = &pipes[pcb->file_array[fd].inode];
+  cli_and_save(flags);
+  p->readers--;
+  wake_up(&p->write_wq);
+  poll_wake();
+  pipe_put(p);
+  restore_flags(flags);
+  return 0;
+}
+
+/*
+ * pipe_close_write
+ *   DESCRIPTION: drops one write end, readers see end of file once all are gone
+ *   INPUTS: fd - write end
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: wakes readers, may free the pipe
+ */
+static int32_t pipe_close_write(int32_t fd)
+{
+  uint32_t flags;
+  pipe_t* p = &pipes[pcb->file_array[fd].inode];
+  cli_and_save(flags);
+  p->writers--;
+  wake_up(&p->read_wq);
+  poll_wake();
+  pipe_put(p);
+  restore_flags(flags);
+  return 0;
+}
+
+/*
+ * pipe_dup_read / pipe_dup_write
+ *   DESCRIPTION: count an end copied into a child process
+ *   INPUTS: inode - pipe index
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: bumps the reader / writer count
+ */
+static void pipe_dup_read(uint32_t inode)
+{
+  pipes[inode].readers++;
+}
+
+static void pipe_dup_write(uint32_t inode)
+{
+  pipes[inode].writers++;
+}
+
+/*
+ * pipe_ready_read / pipe_ready_write
+ *   DESCRIPTION: readiness for poll; end of file and a missing reader count
+ *                as ready since the call returns at once
+ *   INPUTS: fd - pipe end
+ *   OUTPUTS: none
+ *   RETURN VALUE: POLLIN / POLLOUT or 0
+ *   SIDE EFFECTS: none
+ */
+static int32_t pipe_ready_read(int32_t fd)
+{
+  pipe_t* p = &pipes[pcb->file_array[fd].inode];
+  return (p->tail != p->head || p->writers == 0) ? POLLIN : 0;
+}
+
+static int32_t pipe_ready_write(int32_t fd)
+{
+  pipe_t* p = &pipes[pcb->file_array[fd].inode];
+  return (p->tail - p->head < PIPE_SIZE || p->readers == 0) ? POLLOUT : 0;
+}
+
+/*
+ * sys_call_pipe
+ *   DESCRIPTION: creates a pipe and opens both ends in the caller
+ *   INPUTS: fds - user array of two, gets the read fd then the write fd
+ *   OUTPUTS: fds[0], fds[1]
+ *   RETURN VALUE: 0 on success, -1 on fail
+ *   SIDE EFFECTS: allocates a frame and two fds
+ */
+int32_t sys_call_pipe(int32_t* fds)
+{
+  int32_t i, id, rfd = -1, wfd = -1;
+  uint32_t frame;
+  uint32_t address = (uint32_t)fds;
+  pipe_t* p;
+
+  //array must sit in the user page
+  if (address < 128*MB || address > 132*MB - 2*sizeof(int32_t)) return -1;
+
+  //find two free fds
+  for (i = 2; i <= MAX_INDEX; i++) {
+    if (pcb->file_array[i].flags != UNUSED) continue;
+    if (rfd == -1) rfd = i;
+    else { wfd = i; break; }
+  }
+  if (wfd == -1) return -1;
+
+  //find a free pipe
+  for (id = 0; id < MAX_PIPES; id++) {
+    if (!pipes[id].in_use) break;
+  }
+  if (id == MAX_PIPES) return -1;
+  if (0 == (frame = alloc_frames(1))) return -1;
+
+  p = &pipes[id];
+  p->in_use = 1;
+  p->buf = (uint8_t*)frame;
+  p->head = 0;
+  p->tail = 0;
+  p->readers = 1;
+  p->writers = 1;
+  p->read_wq.head = NULL;
+  p->write_wq.head = NULL;
+
+  pcb->file_array[rfd].jump_table_ptr = &pipe_read_fn;
+  pcb->file_array[rfd].inode = id;
+  pcb->file_array[rfd].file_position = 0;
+  pcb->file_array[rfd].flags = USED;
+  pcb->file_array[wfd].jump_table_ptr = &pipe_write_fn;
+  pcb->file_array[wfd].inode = id;
+  pcb->file_array[wfd].file_position = 0;
+  pcb->file_array[wfd].flags = USED;
+
+  fds[0] = rfd;
+  fds[1] = wfd;
+  return 0;
+}
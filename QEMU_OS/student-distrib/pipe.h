@@ -0,0 +1,39 @@
+// pipe.h - declares kernel pipes backed by a one page ring buffer
+
+#ifndef _PIPE_H
+#define _PIPE_H
+
+#include "types.h"
+#include "syscalls.h"
+#include "paging.h"
+
+// pipes that can exist at once
+#define MAX_PIPES 8
+// ring size, one frame; must be a power of two
+#define PIPE_SIZE FRAME_SIZE
+
+typedef struct pipe_t {
+  //ring buffer, one frame from the pool
+  uint8_t* buf;
+  //bytes ever read / written, index into buf with & (PIPE_SIZE - 1)
+  uint32_t head;
+  uint32_t tail;
+  //open read and write ends across all processes
+  int32_t readers;
+  int32_t writers;
+  //readers sleep here while empty, writers while full
+  wait_queue_t read_wq;
+  wait_queue_t write_wq;
+  uint8_t in_use;
+} pipe_t;
+
+//jump tables for the two ends
+extern file_jump_table_t pipe_read_fn;
+extern file_jump_table_t pipe_write_fn;
+
+// clears the pipe table
+void pipe_init();
+// creates a pipe, stores the read and write fds in fds[0] and fds[1]
+int32_t sys_call_pipe(int32_t* fds);
+
+#endif //_PIPE_H
@@ -0,0 +1,73 @@
+// poll.c - waiting on several file descriptors at once
+#include "poll.h"
+#include "sched.h"
+#include "lib.h"
+
+// every process blocked in poll; drivers wake them all and each rechecks
+// its own fds, which stays cheap with a handful of processes
+static wait_queue_t poll_wq;
+
+/*
+ * poll_wake
+ *   DESCRIPTION: wakes every poller so it rechecks its fds. Safe to call
+ *                from interrupt handlers.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: makes pollers runnable
+ */
+void poll_wake()
+{
+  if (poll_wq.head) wake_up(&poll_wq);
+}
+
+/*
+ * sys_call_poll
+ *   DESCRIPTION: fills in revents for every entry and sleeps until at least
+ *                one of them is ready. Each fd's ready function reports
+ *                POLLIN / POLLOUT; poll_arm lets a device get ready for a
+ *                read (the terminal starts taking a line).
+ *   INPUTS: fds - user array of entries
+ *           nfds - number of entries, at most 8
+ *           timeout - 0 to only check, -1 to wait
+ *   RETURN VALUE: number of entries with revents set, -1 on fail or if killed
+ *   SIDE EFFECTS: may block
+ */
+int32_t sys_call_poll(pollfd_t* fds, int32_t nfds, int32_t timeout)
+{
+  uint32_t flags;
+  uint32_t address = (uint32_t)fds;
+  file_jump_table_t* ops;
+  int32_t i, fd, count;
+
+  if (nfds <= 0 || nfds > MAX_INDEX + 1) return -1;
+  if (address < 128*MB || address > 132*MB - nfds * sizeof(pollfd_t)) return -1;
+  if (timeout != 0 && timeout != -1) return -1;
+
+  cli_and_save(flags);
+  while (1) {
+    count = 0;
+    for (i = 0; i < nfds; i++) {
+      fd = fds[i].fd;
+      fds[i].revents = 0;
+      if (fd < 0 || fd > MAX_INDEX || pcb->file_array[fd].flags == UNUSED) {
+        fds[i].revents = POLLNVAL;
+        count++;
+        continue;
+      }
+      ops = pcb->file_array[fd].jump_table_ptr;
+      if ((fds[i].events & POLLIN) && ops->poll_arm) ops->poll_arm(fd);
+      if (ops->ready) fds[i].revents = ops->ready(fd) & fds[i].events;
+      if (fds[i].revents) count++;
+    }
+    if (count || timeout == 0) break;
+    if (sleep_killed()) {
+      restore_flags(flags);
+      return -1;
+    }
+    sleep_on(&poll_wq);
+  }
+  restore_flags(flags);
+
+  return count;
+}
@@ -0,0 +1,27 @@
+// poll.h - declares waiting on several file descriptors at once
+
+#ifndef _POLL_H
+#define _POLL_H
+
+#include "types.h"
+#include "syscalls.h"
+
+// readiness bits returned by a jump table's ready function
+#define POLLIN   0x01
+#define POLLOUT  0x04
+// fd not open
+#define POLLNVAL 0x20
+
+// one entry of the array passed to poll
+typedef struct pollfd_t {
+  int32_t fd;
+  int16_t events;
+  int16_t revents;
+} pollfd_t;
+
+// drivers call this whenever one of their fds may have become ready
+void poll_wake();
+// waits until one of the fds is ready
+int32_t sys_call_poll(pollfd_t* fds, int32_t nfds, int32_t timeout);
+
+#endif //_POLL_H
@@ -2,6 +2,10 @@
 #include "i8259.h"
 #include "lib.h"
 #include "keyboard.h"
+#include "sched.h"
+#include "poll.h"
+#include "bh.h"
+#include "timer.h"
 // rtc.c - defines protocols for rtc interrupts
 
 // TURN OFF/ON (0/1) VIRTUALIZATION
@@ -13,51 +17,185 @@ int32_t int_occurred;
 // 1 or MAX_FREQ / FREQ (0 or 1)
 int32_t x; // V
 
+// free running count of RTC interrupts, used to time tests
+volatile uint32_t rtc_ticks;
+
+// processes sleeping in read until the next interrupt
+static wait_queue_t rtc_wq;
+
+// open RTC fds, periodic interrupts are only on while there are any
+static int32_t rtc_users;
+
+// ns between periodic interrupts at the programmed rate
+static uint32_t rtc_period_ns;
+// when the RTC raises its next interrupt, 0 until one has been seen
+static uint64_t rtc_due;
+// when rtc_IH ran for the oldest interrupt rtc_bh has not handled, 0 if none
+static uint64_t rtc_ih_ns;
+
+uint32_t rtc_late_max;
+uint32_t rtc_bh_late_max;
+uint32_t rtc_missed;
+
+static void rtc_bh();
+
+/*
+ * rt_due
+ *   DESCRIPTION: tells if an EDF reader's period is over by an interrupt.
+ *                Its deadline only has to be within half an RTC period, so
+ *                jitter in when rtc_bh runs does not hold a release back a
+ *                whole interrupt.
+ *   INPUTS: proc - EDF process
+ *           now - ktime_ns of the interrupt
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if its next job is due, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+rt_due (pcb_t* proc, uint64_t now)
+{
+  return (int64_t)(proc->rt_deadline - now) < (int64_t)(rtc_period_ns / 2);
+}
+
+/*
+ * rtc_periodic
+ *   DESCRIPTION: turns RTC periodic interrupts on or off
+ *   INPUTS: on - 1 to turn them on, 0 to turn them off
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes register B
+ */
+static void
+rtc_periodic (int32_t on)
+{
+  // from OSDEV
+  disable_irq(RTC_IRQ);
+  outb(0x8B, 0x70);
+  char prev = inb(0x71);
+  outb(0x8B, 0x70);
+  outb(on ? (prev|0x40) : (prev & ~0x40), 0x71);
+  // drop an interrupt latched before it was turned off
+  outb(0x0C, 0x70);
+  inb(0x71);
+  // the first interrupt restarts the lateness estimate
+  rtc_due = 0;
+  enable_irq(RTC_IRQ);
+}
+
 /*
  * rtc_init
  *   DESCRIPTION: initialize necessary variables for rtc
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: initialize global variables
+ *   SIDE EFFECTS: initialize global variables, periodic interrupts stay
+ *                 off until the first open
  */
 void
 rtc_init()
 {
   // reset interrupt flag
   int_occurred = 0;
+  rtc_users = 0;
+  // 1024Hz until the first set_freq, the rate the RTC powers up with
+  rtc_period_ns = 1000000000 / MAX_FREQ;
+
+  // readers are woken with interrupts on
+  bh_register(BH_RTC, rtc_bh);
 
   x = 1;
 
   if (VIRTUALIZE) set_freq(MAX_FREQ); // V
 
-  // from OSDEV
-  disable_irq(RTC_IRQ);
-  outb(0x8B, 0x70);
-  char prev = inb(0x71);
-  outb(0x8B, 0x70);
-  outb(prev|0x40, 0x71);
-  enable_irq(RTC_IRQ);
+  rtc_periodic(0);
 }
 
 /*
  * rtc_IH
- *   DESCRIPTION: interrupt handler for rtc
+ *   DESCRIPTION: interrupt handler for rtc. The RTC raises its interrupt on
+ *                a fixed period, so how late this runs is measured against
+ *                where that period says the interrupt fired. One that
+ *                seems early only means the estimate was late; it starts
+ *                over from there.
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: send interrupt for rtc
+ *   SIDE EFFECTS: send interrupt for rtc, updates rtc_late_max and
+ *                 rtc_missed
  */
 void
 rtc_IH()
 {
+  uint64_t now = ktime_ns();
+  uint32_t late;
+
+  if (rtc_due && now > rtc_due) {
+    late = now - rtc_due;
+    // a whole period late means the RTC fired again meanwhile and only
+    // one interrupt was latched
+    if (late >= rtc_period_ns) {
+      rtc_missed++;
+      rtc_due = now;
+    }
+    else if (late > rtc_late_max) rtc_late_max = late;
+  }
+  else rtc_due = now;
+  rtc_due += rtc_period_ns;
+  if (!rtc_ih_ns) rtc_ih_ns = now;
+
   send_eoi(RTC_IRQ);
+  rtc_ticks++;
   if (VIRTUALIZE) int_occurred++; // V
   else int_occurred = 1;
 
   // from OSDEV
   outb(0x0C, 0x70);
   inb(0x71);
+
+  bh_raise(BH_RTC);
+}
+
+/*
+ * rtc_bh
+ *   DESCRIPTION: bottom half for rtc, runs with interrupts on
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: wakes readers and pollers, updates rtc_bh_late_max
+ */
+static void
+rtc_bh()
+{
+  uint32_t flags;
+  uint32_t late;
+  uint64_t now;
+  pcb_t** link;
+  pcb_t* proc;
+
+  cli_and_save(flags);
+  late = rtc_ih_ns ? ktime_ns() - rtc_ih_ns : 0;
+  rtc_ih_ns = 0;
+  restore_flags(flags);
+  if (late > rtc_bh_late_max) rtc_bh_late_max = late;
+
+  // every reader wakes, except EDF readers whose own period has not
+  // ended: the rate is shared, and another process setting it faster
+  // must not hand them a fresh budget every interrupt. A released one is
+  // queued by its new deadline.
+  cli_and_save(flags);
+  now = ktime_ns();
+  link = &rtc_wq.head;
+  while ((proc = *link)) {
+    if (proc->rt && !rt_due(proc, now)) {
+      link = &proc->next;
+      continue;
+    }
+    *link = proc->next;
+    if (proc->rt) sched_rt_release(proc);
+    sched_enqueue(proc);
+  }
+  restore_flags(flags);
+  poll_wake();
 }
 
 /*
@@ -66,7 +204,7 @@ rtc_IH()
  *   INPUTS: unused
  *   OUTPUTS: none
  *   RETURN VALUE: 0 always?
- *   SIDE EFFECTS: sets rate to 2
+ *   SIDE EFFECTS: sets rate to 2, the first open turns interrupts on
  */
 int32_t
 open (const uint8_t* filename)
@@ -75,58 +213,144 @@ open (const uint8_t* filename)
   if (VIRTUALIZE) x = MAX_FREQ / 2; // V
   else set_freq(2);
   int_occurred = 0;
+  if (rtc_users++ == 0) rtc_periodic(1);
   return 0;
 }
 
+/*
+ * rtc_dup
+ *   DESCRIPTION: counts an fd copied into a child by spawn as another user
+ *   INPUTS: inode - unused
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+rtc_dup (uint32_t inode)
+{
+  rtc_users++;
+}
+
 /*
  * read
- *   DESCRIPTION:
+ *   DESCRIPTION: sleeps until the next interrupt. For an EDF process this
+ *                ends its job, and it sleeps until the first interrupt
+ *                that ends the job's period starts the next one.
  *   INPUTS: fd - unused
              buf - unused
              nbytes - unused
  *   OUTPUTS: none
- *   RETURN VALUE: none
- *   SIDE EFFECTS:
+ *   RETURN VALUE: 0, -1 if the process is killed while waiting
+ *   SIDE EFFECTS: blocks the caller, may count a deadline miss
  */
 int32_t
 read (int32_t fd, void* buf, int32_t nbytes)
 {
-  // only return once the RTC interrupt occurs
-  while (int_occurred != x) {}
+  uint32_t flags;
+  uint64_t end;
+  // only return once the RTC interrupt occurs, sleeping until then
+  cli_and_save(flags);
+  if (pcb && pcb->rt) {
+    sched_rt_done(pcb);
+    end = pcb->rt_deadline;
+    // the period already ended while the job ran
+    if (rt_due(pcb, ktime_ns())) sched_rt_release(pcb);
+    // rtc_bh moves the deadline on when it releases the next job
+    while (pcb->rt_deadline == end) {
+      if (sleep_killed()) {
+        restore_flags(flags);
+        return -1;
+      }
+      sleep_on(&rtc_wq);
+    }
+    restore_flags(flags);
+    return 0;
+  }
+  while (int_occurred < x) {
+    if (sleep_killed()) {
+      restore_flags(flags);
+      return -1;
+    }
+    sleep_on(&rtc_wq);
+  }
   // reset flag
   int_occurred = 0;
+  restore_flags(flags);
   return 0;
 }
 
+/*
+ * rtc_ready
+ *   DESCRIPTION: readiness for poll, readable once the interrupt a read
+ *                would wait for has happened
+ *   INPUTS: fd - unused
+ *   OUTPUTS: none
+ *   RETURN VALUE: POLLIN or 0
+ *   SIDE EFFECTS: none
+ */
+int32_t
+rtc_ready (int32_t fd)
+{
+  return (int_occurred >= x) ? POLLIN : 0;
+}
+
 /*
  * write
- *   DESCRIPTION: set the rate of periodic interrupts
+ *   DESCRIPTION: set the rate of periodic interrupts. An rtc_rt_t also
+ *                puts the caller in the EDF class, one job per period,
+ *                or takes it out with a budget of 0.
  *   INPUTS: fd - unused
-             buf - pointer to interrupt rate
-             nbytes - number of bytes to write
+             buf - pointer to interrupt rate or an rtc_rt_t
+             nbytes - number of bytes to write, 4 or sizeof(rtc_rt_t)
  *   OUTPUTS: none
- *   RETURN VALUE: 4 if successful, -1 if fail
+ *   RETURN VALUE: nbytes if successful, -1 if fail or not admitted
  *   SIDE EFFECTS: sets rate to nbytes
  */
 int32_t
 write (int32_t fd, const void* buf, int32_t nbytes)
 {
 
-  // nbytes must be 4
-  if (nbytes != 4) return -1;
+  // nbytes must be 4, or the size of a period and budget
+  if (nbytes != 4 && nbytes != sizeof(rtc_rt_t)) return -1;
 
   // buffer for frquency
   int32_t freq = *((int32_t*)buf);
   // if freq is 0 or >1024 it's invalid
-  if (freq == 0 || freq > 1024) return -1;
+  if (freq <= 0 || freq > 1024) return -1;
   // check if power of two (stack overflow)
   if (freq & (freq-1)) return -1;
 
+  // admission first, a refused process keeps the rate it had
+  if (nbytes == sizeof(rtc_rt_t)) {
+    int32_t budget_us = ((rtc_rt_t*)buf)->budget_us;
+    if (budget_us < 0 || !pcb) return -1;
+    if (budget_us == 0) sched_rt_leave(pcb);
+    else if (sched_rt_admit(pcb, 1000000 / freq, budget_us) != 0) return -1;
+  }
+
   // set rate and return # of bytes written (4)
   freq = *((int32_t*)buf);
   if (VIRTUALIZE) x = MAX_FREQ / freq; // V
   else set_freq(freq);
-  return 4;
+  return nbytes;
+}
+
+/*
+ * rtc_ioctl
+ *   DESCRIPTION: RTC_RT_MISSES tells how many jobs of the caller finished
+ *                after their deadline since it started
+ *   INPUTS: fd - unused
+ *           cmd - RTC_RT_MISSES
+ *           arg - unused
+ *   OUTPUTS: none
+ *   RETURN VALUE: the count, -1 for other commands
+ *   SIDE EFFECTS: none
+ */
+int32_t
+rtc_ioctl (int32_t fd, int32_t cmd, void* arg)
+{
+  if (cmd != RTC_RT_MISSES || !pcb) return -1;
+  return pcb->rt_misses;
 }
 
 /*
@@ -136,11 +360,12 @@ write (int32_t fd, const void* buf, int32_t nbytes)
  *   INPUTS: fd - unused
  *   OUTPUTS: none
  *   RETURN VALUE: 0 always
- *   SIDE EFFECTS:
+ *   SIDE EFFECTS: the last close turns interrupts off
  */
 int32_t
 close (int32_t fd)
 {
+  if (rtc_users > 0 && --rtc_users == 0) rtc_periodic(0);
   return 0;
 }
 
@@ -150,7 +375,8 @@ close (int32_t fd)
  *   INPUTS: frequency - desired frequency in Hz
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: sets the RTC interrupt rate
+ *   SIDE EFFECTS: sets the RTC interrupt rate and the period rtc_IH
+ *                 measures lateness against
  */
 void
 set_freq (int32_t freq) {
@@ -165,6 +391,8 @@ set_freq (int32_t freq) {
   char prev = inb(0x71);	// get initial value of register A
   outb(0x8A, 0x70);		// reset index to A
   outb((prev & 0xF0) | rate, 0x71); //write only our rate to A. Note, rate is the bottom 4 bits.
+  rtc_period_ns = 1000000000 / (32768 >> (rate-1));
+  rtc_due = 0;
   enable_irq(RTC_IRQ);
 }
 
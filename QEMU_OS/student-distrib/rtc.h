@@ -7,6 +7,27 @@
 
 #include "types.h"
 
+// rtc_ioctl command: returns how many jobs of the caller's EDF class
+// finished after their deadline
+#define RTC_RT_MISSES         1
+
+// written to an RTC fd instead of the bare rate, also asks for the EDF
+// class with one job per period of freq and budget_us of CPU time each;
+// a budget of 0 leaves the class
+typedef struct rtc_rt_t {
+  int32_t freq;
+  int32_t budget_us;
+} rtc_rt_t;
+
+// free running count of RTC interrupts
+extern volatile uint32_t rtc_ticks;
+// worst ns from the RTC raising its irq to rtc_IH running
+extern uint32_t rtc_late_max;
+// worst ns from rtc_IH to rtc_bh running
+extern uint32_t rtc_bh_late_max;
+// periods rtc_IH ran so late that an interrupt was lost
+extern uint32_t rtc_missed;
+
 // initialize necessary variables for rtc functionality
 void rtc_init();
 // interrupt handler for rtc
@@ -18,6 +39,12 @@ int32_t open (const uint8_t* filename);
 int32_t read (int32_t fd, void* buf, int32_t nbytes);
 // change refresh rate
 int32_t write (int32_t fd, const void* buf, int32_t nbytes);
+// counts an fd inherited by spawn
+void rtc_dup (uint32_t inode);
+// readiness for poll
+int32_t rtc_ready (int32_t fd);
+// RTC_RT_MISSES
+int32_t rtc_ioctl (int32_t fd, int32_t cmd, void* arg);
 // loses the specified file desriptor and makes it available for return
 // from later calls to open
 int32_t close (int32_t fd);
@@ -0,0 +1,525 @@
+// sched.c - run queue, blocking and switching between kernel stacks
+#include "sched.h"
+#include "keyboard.h"
+#include "paging.h"
+#include "x86_desc.h"
+#include "lib.h"
+#include "smp.h"
+#include "timer.h"
+#include "bh.h"
+
+// every CPU has its own run queue and idle loop in its cpu_t, processes
+// only ever run on the CPU their terminal is pinned to
+//
+// Processes admitted to the EDF class (see sched_rt_admit) have their own
+// queue, sorted by deadline, that is always served first; one woken with
+// an earlier deadline than whatever runs preempts it. Each job gets a
+// budget of CPU time per period. A job that uses it up is throttled to
+// best effort until its next release, so admitted processes cannot starve
+// the rest beyond what admission allowed.
+//
+// Best effort processes share the CPU in time slices of SCHED_SLICE_MS: a
+// CPU with a process waiting on its run queue asks itself to reschedule
+// once the running one has used up its slice, so a CPU-bound process
+// cannot keep the shell of its terminal from running.
+
+static void slice_fire(uint32_t id);
+
+/*
+ * sched_init
+ *   DESCRIPTION: clears the run queue of every CPU
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: no process is runnable
+ */
+void sched_init()
+{
+  int32_t i;
+  for (i = 0; i < MAX_CPUS; i++) {
+    cpus[i].run_head = NULL;
+    cpus[i].run_tail = NULL;
+    cpus[i].rt_head = NULL;
+    cpus[i].rt_util = 0;
+    timer_setup(&cpus[i].slice_timer, slice_fire, i);
+  }
+}
+
+/*
+ * slice_arm
+ *   DESCRIPTION: starts the time slice of the process running on a CPU,
+ *                unless one is running already
+ *   INPUTS: cpu - the CPU
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: adds its slice timer
+ */
+static void slice_arm(cpu_t* cpu)
+{
+  if (!timer_pending(&cpu->slice_timer)) {
+    add_timer(&cpu->slice_timer, jiffies_now() + ms_to_jiffies(SCHED_SLICE_MS));
+  }
+}
+
+/*
+ * slice_fire
+ *   DESCRIPTION: timer function for the end of a time slice. The CPU
+ *                reschedules if a best effort process is waiting and what
+ *                runs is not an EDF job within its budget.
+ *   INPUTS: id - the CPU
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may ask the CPU to reschedule
+ */
+static void slice_fire(uint32_t id)
+{
+  uint32_t flags;
+  cpu_t* cpu = &cpus[id];
+  pcb_t* cur;
+
+  cli_and_save(flags);
+  cur = cpu->cur;
+  if (cur && cpu->run_head && !(cur->rt && !cur->rt_throttled)) {
+    bh_want_on(id, BH_WANT_RESCHED);
+  }
+  restore_flags(flags);
+}
+
+/*
+ * sched_enqueue
+ *   DESCRIPTION: marks a process runnable and appends it to the run queue
+ *                of its CPU, waking that CPU if it is another one. An EDF
+ *                process within budget goes in deadline order on the EDF
+ *                queue instead and preempts a later deadline or a best
+ *                effort process running there. A best effort process
+ *                starts the time slice of the one running there.
+ *   INPUTS: proc - process to queue, must not be on any other queue
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the run queue, may send a reschedule IPI
+ */
+void sched_enqueue(pcb_t* proc)
+{
+  uint32_t flags;
+  cpu_t* cpu = &cpus[proc->cpu];
+  pcb_t** link;
+  pcb_t* cur;
+
+  cli_and_save(flags);
+  proc->state = PROC_RUNNABLE;
+  proc->next = NULL;
+  proc->sleep_wq = NULL;
+  if (proc->rt && !proc->rt_throttled) {
+    //behind every earlier or equal deadline
+    link = &cpu->rt_head;
+    while (*link && (int64_t)((*link)->rt_deadline - proc->rt_deadline) <= 0) link = &(*link)->next;
+    proc->next = *link;
+    *link = proc;
+    cur = cpu->cur;
+    if (cur && cur != proc &&
+        (!cur->rt || cur->rt_throttled || cur->rt_deadline > proc->rt_deadline)) {
+      bh_want_on(cpu->id, BH_WANT_RESCHED);
+    }
+  }
+  else {
+    if (cpu->run_tail) cpu->run_tail->next = proc;
+    else cpu->run_head = proc;
+    cpu->run_tail = proc;
+    //whatever runs there now has to share the CPU
+    if (cpu->cur && cpu->cur != proc) slice_arm(cpu);
+  }
+  smp_kick(cpu);
+  restore_flags(flags);
+}
+
+/*
+ * pick_next
+ *   DESCRIPTION: removes the EDF process with the earliest deadline, or
+ *                if there is none the first runnable process of the run
+ *                queue. Every terminal draws to its own VGA page so
+ *                processes of hidden terminals keep running.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the process, or NULL if none can run
+ *   SIDE EFFECTS: modifies the run queue
+ */
+static pcb_t* pick_next()
+{
+  cpu_t* cpu = cpu_self();
+  pcb_t* cur = cpu->rt_head;
+  if (cur) {
+    cpu->rt_head = cur->next;
+    cur->next = NULL;
+    return cur;
+  }
+  cur = cpu->run_head;
+  if (!cur) return NULL;
+  //unlink it
+  cpu->run_head = cur->next;
+  if (cpu->run_tail == cur) cpu->run_tail = NULL;
+  cur->next = NULL;
+  return cur;
+}
+
+/*
+ * rt_charge
+ *   DESCRIPTION: adds the time an EDF process has run since it last went
+ *                on the CPU, or was last charged, to its job
+ *   INPUTS: proc - EDF process running on this CPU
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates rt_used and rt_since
+ */
+static void rt_charge(pcb_t* proc)
+{
+  uint64_t now = ktime_ns();
+  proc->rt_used += (uint32_t)(now - proc->rt_since);
+  proc->rt_since = now;
+}
+
+/*
+ * rt_arm
+ *   DESCRIPTION: arms an EDF process's budget timer for what is left of
+ *                its job's budget, at least one jiffy out
+ *   INPUTS: proc - EDF process going on the CPU
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: adds its timer, not for a throttled job
+ */
+static void rt_arm(pcb_t* proc)
+{
+  uint32_t left;
+
+  if (proc->rt_throttled) return;
+  left = proc->rt_used < proc->rt_budget ? proc->rt_budget - proc->rt_used : 0;
+  add_timer(&proc->rt_timer, jiffies_now() + (left + NS_PER_JIFFY - 1) / NS_PER_JIFFY + 1);
+}
+
+/*
+ * rt_budget_fire
+ *   DESCRIPTION: timer function for a running job's budget. Once it is
+ *                used up the job is throttled and its CPU reschedules, so
+ *                it goes behind the other best effort processes.
+ *   INPUTS: pid - the EDF process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may ask its CPU to reschedule
+ */
+static void rt_budget_fire(uint32_t pid)
+{
+  uint32_t flags;
+  pcb_t* proc = PCB_ADDR(pid);
+
+  cli_and_save(flags);
+  if (proc->rt && !proc->rt_throttled && cpus[proc->cpu].cur == proc) {
+    rt_charge(proc);
+    if (proc->rt_used >= proc->rt_budget) {
+      proc->rt_throttled = 1;
+      bh_want_on(proc->cpu, BH_WANT_RESCHED);
+    }
+    else {
+      rt_arm(proc);
+    }
+  }
+  restore_flags(flags);
+}
+
+/*
+ * sched_rt_admit
+ *   DESCRIPTION: puts a process in the EDF class, or changes its period
+ *                and budget if it is in it. It is admitted only if the
+ *                budget/period of every EDF process on its CPU stays
+ *                within RT_UTIL_MAX, which EDF can always meet. Its first
+ *                job starts now.
+ *   INPUTS: proc - the current process
+ *           period_us - us between the starts of its jobs
+ *           budget_us - CPU time a job may use, at most period_us
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if admitted, -1 if not (it stays in its old class)
+ *   SIDE EFFECTS: arms its budget timer
+ */
+int32_t sched_rt_admit(pcb_t* proc, uint32_t period_us, uint32_t budget_us)
+{
+  uint32_t flags;
+  uint32_t util, others;
+  cpu_t* cpu = &cpus[proc->cpu];
+
+  if (proc->kthread || period_us == 0 || budget_us == 0 || budget_us > period_us) return -1;
+  // RTC periods are at most 1s, so this does not overflow
+  util = budget_us * RT_UTIL_SCALE / period_us;
+
+  cli_and_save(flags);
+  others = cpu->rt_util - (proc->rt ? proc->rt_util : 0);
+  if (others + util > RT_UTIL_MAX) {
+    restore_flags(flags);
+    return -1;
+  }
+  cpu->rt_util = others + util;
+  if (proc->rt) del_timer(&proc->rt_timer);
+  else timer_setup(&proc->rt_timer, rt_budget_fire, proc->pid);
+  proc->rt = 1;
+  proc->rt_util = util;
+  proc->rt_period = period_us * 1000;
+  proc->rt_budget = budget_us * 1000;
+  sched_rt_release(proc);
+  proc->rt_since = ktime_ns();
+  rt_arm(proc);
+  restore_flags(flags);
+  return 0;
+}
+
+/*
+ * sched_rt_leave
+ *   DESCRIPTION: takes a process out of the EDF class, back to best effort
+ *   INPUTS: proc - the current process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees its share of its CPU for admission
+ */
+void sched_rt_leave(pcb_t* proc)
+{
+  uint32_t flags;
+
+  cli_and_save(flags);
+  if (proc->rt) {
+    cpus[proc->cpu].rt_util -= proc->rt_util;
+    del_timer(&proc->rt_timer);
+    proc->rt = 0;
+  }
+  restore_flags(flags);
+}
+
+/*
+ * sched_rt_release
+ *   DESCRIPTION: starts the next job of an EDF process: a fresh budget and
+ *                a deadline one period from now. Called before it is woken
+ *                for its period so it is queued by the new deadline.
+ *   INPUTS: proc - EDF process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: lifts a throttle
+ */
+void sched_rt_release(pcb_t* proc)
+{
+  proc->rt_deadline = ktime_ns() + proc->rt_period;
+  proc->rt_used = 0;
+  proc->rt_throttled = 0;
+}
+
+/*
+ * sched_rt_done
+ *   DESCRIPTION: ends the current job of an EDF process, which is waiting
+ *                for its next period
+ *   INPUTS: proc - EDF process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: counts a deadline miss in rt_misses if it finished late
+ */
+void sched_rt_done(pcb_t* proc)
+{
+  if (ktime_ns() > proc->rt_deadline) proc->rt_misses++;
+}
+
+/*
+ * switch_proc
+ *   DESCRIPTION: switches from prev to next, either may be NULL for the idle
+ *                loop. Call with interrupts off.
+ *   INPUTS: prev - process giving up the CPU
+ *           next - process taking it
+ *   OUTPUTS: none
+ *   RETURN VALUE: none, returns when prev is switched back to
+ *   SIDE EFFECTS: changes pcb, CR3 and esp0 in the TSS, restarts the time
+ *                 slice
+ */
+static void switch_proc(pcb_t* prev, pcb_t* next)
+{
+  cpu_t* cpu = cpu_self();
+  uint32_t* prev_esp = prev ? &prev->stack_ptr : &cpu->idle_esp;
+  uint32_t next_esp;
+  int32_t depth;
+
+  //EDF jobs are charged for the time they run and stopped at their budget
+  if (prev && prev->rt) {
+    rt_charge(prev);
+    del_timer(&prev->rt_timer);
+  }
+  if (next && next->rt) {
+    next->rt_since = ktime_ns();
+    rt_arm(next);
+  }
+  //a fresh time slice, needed only while someone waits for the CPU
+  del_timer(&cpu->slice_timer);
+  if (next && cpu->run_head) slice_arm(cpu);
+
+  if (next) {
+    //load the next process's address space and kernel stack, a kernel
+    //thread keeps whichever directory is loaded
+    if (!next->kthread) switch_page_dir(next->mm_pid);
+    cpu->tss.ss0 = KERNEL_DS;
+    cpu->tss.esp0 = KSTACK_TOP(next->pid);
+    next_esp = next->stack_ptr;
+  }
+  else {
+    //nothing to run, the idle loop keeps using the last page directory
+    next_esp = cpu->idle_esp;
+  }
+  cpu->cur = next;
+  //the kernel lock nesting belongs to the context, not the CPU
+  depth = cpu->lock_depth;
+  switch_to(prev_esp, next_esp);
+  cpu_self()->lock_depth = depth;
+}
+
+/*
+ * schedule
+ *   DESCRIPTION: puts the current process back on its queue if it can
+ *                still run, then switches this CPU to the EDF process with
+ *                the earliest deadline, else to the oldest process on its
+ *                run queue, or to its idle loop if there is none
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none, returns when the caller is picked again
+ *   SIDE EFFECTS: changes pcb, CR3 and esp0 in the TSS
+ */
+void schedule()
+{
+  uint32_t flags;
+  pcb_t* prev = pcb;
+  pcb_t* next;
+
+  cli_and_save(flags);
+  if (prev && prev->state == PROC_RUNNABLE) sched_enqueue(prev);
+  next = pick_next();
+  if (next != prev) switch_proc(prev, next);
+  restore_flags(flags);
+}
+
+/*
+ * sched_handoff
+ *   DESCRIPTION: gives the CPU straight to a process that was just woken
+ *                without it passing through the run queue. The caller goes
+ *                to the back of the queue if it can still run.
+ *   INPUTS: next - process to run, not on any queue
+ *   OUTPUTS: none
+ *   RETURN VALUE: none, returns when the caller is picked again
+ *   SIDE EFFECTS: changes pcb, CR3 and esp0 in the TSS
+ */
+void sched_handoff(pcb_t* next)
+{
+  uint32_t flags;
+  pcb_t* prev = pcb;
+
+  cli_and_save(flags);
+  if (next->cpu != cpu_self()->id) {
+    //it runs elsewhere, its CPU picks it up
+    sched_enqueue(next);
+    restore_flags(flags);
+    return;
+  }
+  if (prev && prev->state == PROC_RUNNABLE) sched_enqueue(prev);
+  next->state = PROC_RUNNABLE;
+  next->next = NULL;
+  next->sleep_wq = NULL;
+  switch_proc(prev, next);
+  restore_flags(flags);
+}
+
+/*
+ * sleep_on
+ *   DESCRIPTION: blocks the current process on a wait queue until wake_up.
+ *                Callers disable interrupts, test their condition and call
+ *                this in a loop so a wakeup cannot be missed. Without a
+ *                process (kernel tests at boot) it just waits for the next
+ *                interrupt.
+ *   INPUTS: wq - queue to sleep on
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: switches to another process
+ */
+void sleep_on(wait_queue_t* wq)
+{
+  if (!pcb) {
+    asm volatile("sti; hlt; cli");
+    return;
+  }
+  pcb->state = PROC_BLOCKED;
+  pcb->next = wq->head;
+  wq->head = pcb;
+  pcb->sleep_wq = wq;
+  schedule();
+}
+
+/*
+ * sleep_cancel
+ *   DESCRIPTION: wakes one process out of whatever sleep it is in. The
+ *                sleep loop it returns to finds its condition still false,
+ *                so the caller must give it a reason to stop, like killed.
+ *   INPUTS: proc - process to wake, may not be blocked at all
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: unlinks it from its wait queue
+ */
+void sleep_cancel(pcb_t* proc)
+{
+  uint32_t flags;
+  pcb_t** link;
+
+  cli_and_save(flags);
+  if (proc->state == PROC_BLOCKED && proc->sleep_wq) {
+    for (link = &proc->sleep_wq->head; *link && *link != proc; link = &(*link)->next);
+    if (*link) {
+      *link = proc->next;
+      sched_enqueue(proc);
+    }
+  }
+  restore_flags(flags);
+}
+
+/*
+ * wake_up
+ *   DESCRIPTION: moves every process sleeping on a wait queue to the run
+ *                queue. Does not switch; safe to call from interrupts.
+ *   INPUTS: wq - queue to wake
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: empties the wait queue
+ */
+void wake_up(wait_queue_t* wq)
+{
+  uint32_t flags;
+  pcb_t* proc;
+  pcb_t* next;
+
+  cli_and_save(flags);
+  proc = wq->head;
+  wq->head = NULL;
+  while (proc) {
+    next = proc->next;
+    sched_enqueue(proc);
+    proc = next;
+  }
+  restore_flags(flags);
+}
+
+/*
+ * sched_idle
+ *   DESCRIPTION: idle loop, runs on the CPU's boot or idle stack whenever
+ *                none of its processes is runnable. It holds the kernel
+ *                lock only while it looks at the run queue.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: halts the CPU until the next interrupt
+ */
+void sched_idle()
+{
+  pcb = NULL;
+  while (1) {
+    cli();
+    lock_kernel();
+    if (cpu_self()->run_head || cpu_self()->rt_head) schedule();
+    unlock_kernel();
+    //sti only takes effect after hlt so no wakeup slips in between
+    asm volatile("sti; hlt");
+  }
+}
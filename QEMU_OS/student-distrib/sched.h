@@ -0,0 +1,51 @@
+// sched.h - declares the run queue and blocking primitives
+
+#ifndef _SCHED_H
+#define _SCHED_H
+
+#include "types.h"
+#include "syscalls.h"
+
+// a best effort process runs at most this long while others are queued
+#define SCHED_SLICE_MS          10
+
+// clears the run queue
+void sched_init();
+// marks a process runnable and puts it at the end of the run queue
+void sched_enqueue(pcb_t* proc);
+// gives this CPU to its earliest deadline EDF process, else to the oldest
+// process on its run queue
+void schedule();
+// switches straight to a woken process, skipping the run queue
+void sched_handoff(pcb_t* next);
+// blocks the current process on a wait queue, call with interrupts off
+void sleep_on(wait_queue_t* wq);
+// takes a blocked process off its wait queue and makes it runnable
+void sleep_cancel(pcb_t* proc);
+// set once proc_kill cut the current process's sleep short: blocking
+// loops check it before sleeping and fail instead
+#define sleep_killed()          (pcb && pcb->killed && !pcb->exiting)
+// makes every process on a wait queue runnable
+void wake_up(wait_queue_t* wq);
+// idle loop run on the boot stack, never returns
+void sched_idle();
+
+// budget/period is kept in 1/RT_UTIL_SCALE; a CPU admits EDF processes
+// up to RT_UTIL_MAX of it, the rest is left to best effort processes
+#define RT_UTIL_SCALE           1024
+#define RT_UTIL_MAX             (RT_UTIL_SCALE * 9 / 10)
+// puts the current process in the EDF class, -1 if its CPU cannot fit it
+int32_t sched_rt_admit(pcb_t* proc, uint32_t period_us, uint32_t budget_us);
+// takes the current process out of the EDF class
+void sched_rt_leave(pcb_t* proc);
+// starts an EDF process's next job, deadline one period from now
+void sched_rt_release(pcb_t* proc);
+// ends an EDF process's job, counting a miss if it is past its deadline
+void sched_rt_done(pcb_t* proc);
+
+// saves callee-saved registers and esp, then switches to another stack
+void switch_to(uint32_t* prev_esp, uint32_t next_esp);
+// first code a new process runs in the kernel, irets to user mode
+void proc_first_run();
+
+#endif //_SCHED_H
@@ -0,0 +1,260 @@
+// shm.c - shared memory segments mapped into several address spaces
+#include "shm.h"
+#include "paging.h"
+#include "x86_desc.h"
+#include "filesystem.h"
+#include "lib.h"
+
+// every segment in the system
+static shm_seg_t shm_segs[MAX_SHM_SEGS];
+
+/*
+ * shm_init
+ *   DESCRIPTION: clears the segment table
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: all segments marked free
+ */
+void shm_init()
+{
+  int i;
+  for (i = 0; i < MAX_SHM_SEGS; i++) {
+    shm_segs[i].in_use = 0;
+    shm_segs[i].refcnt = 0;
+  }
+}
+
+/*
+ * shm_put
+ *   DESCRIPTION: drops one reference, frees the frames on the last one
+ *   INPUTS: id - segment index
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may free the segment
+ */
+static void shm_put(int32_t id)
+{
+  shm_seg_t* seg = &shm_segs[id];
+  if (--seg->refcnt > 0) return;
+  free_frames(seg->phys, seg->npages);
+  seg->in_use = 0;
+}
+
+/*
+ * shm_unmap_slot
+ *   DESCRIPTION: removes one mapping from a process's address space
+ *   INPUTS: proc - process owning the mapping
+ *           slot - index into proc->shm_maps
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: clears PTEs and drops the mapping's reference
+ */
+static void shm_unmap_slot(pcb_t* proc, int slot)
+{
+  shm_map_t* map = &proc->shm_maps[slot];
+  uint32_t i;
+  for (i = 0; i < shm_segs[map->id].npages; i++) {
+    unmap_user_page(proc->pid, map->vaddr + i * FRAME_SIZE);
+  }
+  shm_put(map->id);
+  map->id = -1;
+}
+
+/*
+ * shm_release
+ *   DESCRIPTION: drops every handle and mapping held by a process. Handles
+ *                and mappings of a thread group are all held by its leader
+ *   INPUTS: proc - process that is halting
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: segments with no references left are freed, the process's
+ *                 shared memory page tables go back to the frame pool
+ */
+void shm_release(pcb_t* proc)
+{
+  int i;
+  for (i = 0; i < MAX_SHM_MAPS; i++) {
+    if (proc->shm_maps[i].id >= 0) shm_unmap_slot(proc, i);
+  }
+  for (i = 0; i < MAX_SHM_HANDLES; i++) {
+    if (proc->shm_handles[i] >= 0) shm_put(proc->shm_handles[i]);
+    proc->shm_handles[i] = -1;
+  }
+  //threads map nothing of their own, their address space is the leader's
+  if (proc->mm_pid == proc->pid) free_user_tables(proc->pid);
+}
+
+/*
+ * shm_find_free_range
+ *   DESCRIPTION: finds the first 4MB block above the vidmap page with no
+ *                mappings in it
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: virtual address of the block, 0 if none
+ *   SIDE EFFECTS: none
+ */
+static uint32_t shm_find_free_range()
+{
+  pcb_t* mm = mm_pcb(pcb);
+  uint32_t pd_idx;
+  for (pd_idx = SHM_PDE; pd_idx < SHM_PDE_END; pd_idx++) {
+    if (!user_page_mapped(mm->pid, pd_idx << 22)) {
+      // a block is free if no page table exists or the table is empty
+      uint32_t v = pd_idx << 22;
+      uint32_t off;
+      for (off = 0; off < 4*MB; off += FRAME_SIZE) {
+        if (user_page_mapped(mm->pid, v + off)) break;
+      }
+      if (off == 4*MB) return v;
+    }
+  }
+  return 0;
+}
+
+/*
+ * sys_call_shm_open
+ *   DESCRIPTION: opens a shared memory segment and gives the calling process
+ *                a handle to it. Named segments are found by name or created,
+ *                anonymous ones (NULL or empty name) are always created and
+ *                shared by passing the returned id. With SHM_FILE the segment
+ *                is sized and filled from the file called name
+ *   INPUTS: name - segment or file name
+ *           npages - size in 4KB pages for new segments
+ *           flags - SHM_FILE or 0
+ *   RETURN VALUE: segment id, -1 on fail
+ */
+int32_t sys_call_shm_open(const uint8_t* name, int32_t npages, int32_t flags)
+{
+  int32_t i, id = -1, handle = -1;
+  dentry_t dentry;
+  uint32_t length = 0;
+  int named = (name != NULL && name[0] != '\0');
+  pcb_t* mm = mm_pcb(pcb);
+
+  // need a free handle slot first
+  for (i = 0; i < MAX_SHM_HANDLES; i++) {
+    if (mm->shm_handles[i] < 0) {
+      handle = i;
+      break;
+    }
+  }
+  if (handle < 0) return -1;
+
+  // file backed segments take their size from the file
+  if (flags & SHM_FILE) {
+    if (!named || read_dentry_by_name(name, &dentry) != 0 || dentry.type != 2) return -1;
+    length = file_length(dentry.inode);
+    npages = (length + FRAME_SIZE - 1) / FRAME_SIZE;
+  }
+
+  // look for an existing named segment
+  if (named) {
+    for (i = 0; i < MAX_SHM_SEGS; i++) {
+      if (shm_segs[i].in_use && strncmp((int8_t*)shm_segs[i].name, (int8_t*)name, FILENAME_LEN) == 0) {
+        id = i;
+        break;
+      }
+    }
+  }
+
+  // otherwise create it
+  if (id < 0) {
+    if (npages <= 0 || npages > MAX_SHM_PAGES) return -1;
+    for (i = 0; i < MAX_SHM_SEGS; i++) {
+      if (!shm_segs[i].in_use) {
+        id = i;
+        break;
+      }
+    }
+    if (id < 0) return -1;
+    shm_segs[id].phys = alloc_frames(npages);
+    if (shm_segs[id].phys == 0) return -1;
+    shm_segs[id].npages = npages;
+    shm_segs[id].refcnt = 0;
+    shm_segs[id].in_use = 1;
+    if (named) strncpy((int8_t*)shm_segs[id].name, (int8_t*)name, FILENAME_LEN);
+    else shm_segs[id].name[0] = '\0';
+
+    // frames are identity mapped for the kernel, fill them directly
+    memset((void*)shm_segs[id].phys, 0, npages * FRAME_SIZE);
+    if (flags & SHM_FILE) read_data(dentry.inode, 0, (uint8_t*)shm_segs[id].phys, length);
+  }
+
+  shm_segs[id].refcnt++;
+  mm->shm_handles[handle] = id;
+  return id;
+}
+
+/*
+ * sys_call_shm_map
+ *   DESCRIPTION: maps a segment into the calling process at addr, or at the
+ *                first free 4MB block above 136MB when addr is NULL. Every
+ *                process mapping the segment sees the same physical frames
+ *   INPUTS: id - segment id from shm_open
+ *           addr - page aligned address in [136MB, 1GB), or NULL
+ *   RETURN VALUE: virtual address of the mapping, -1 on fail
+ */
+int32_t sys_call_shm_map(int32_t id, void* addr)
+{
+  int32_t i, slot = -1;
+  uint32_t vaddr = (uint32_t) addr;
+  shm_seg_t* seg;
+  pcb_t* mm = mm_pcb(pcb);
+
+  if (id < 0 || id >= MAX_SHM_SEGS || !shm_segs[id].in_use) return -1;
+  seg = &shm_segs[id];
+
+  for (i = 0; i < MAX_SHM_MAPS; i++) {
+    if (mm->shm_maps[i].id < 0) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) return -1;
+
+  // pick or check the address range
+  if (vaddr == NULL) {
+    vaddr = shm_find_free_range();
+    if (vaddr == 0) return -1;
+  }
+  if ((vaddr & (FRAME_SIZE - 1)) || (vaddr >> 22) < SHM_PDE) return -1;
+  if (vaddr + seg->npages * FRAME_SIZE < vaddr) return -1; // wraps past 4GB
+  if (vaddr + seg->npages * FRAME_SIZE > (uint32_t)SHM_PDE_END << 22) return -1;
+  for (i = 0; i < seg->npages; i++) {
+    if (user_page_mapped(mm->pid, vaddr + i * FRAME_SIZE)) return -1;
+  }
+
+  // same frames in every address space
+  for (i = 0; i < seg->npages; i++) {
+    if (map_user_page(mm->pid, vaddr + i * FRAME_SIZE, seg->phys + i * FRAME_SIZE) != 0) {
+      // out of page tables, undo what we did
+      while (--i >= 0) unmap_user_page(mm->pid, vaddr + i * FRAME_SIZE);
+      return -1;
+    }
+  }
+
+  seg->refcnt++;
+  mm->shm_maps[slot].id = id;
+  mm->shm_maps[slot].vaddr = vaddr;
+  return vaddr;
+}
+
+/*
+ * sys_call_shm_unmap
+ *   DESCRIPTION: removes the mapping that starts at addr
+ *   INPUTS: addr - address returned by shm_map
+ *   RETURN VALUE: 0 on success, -1 on fail
+ */
+int32_t sys_call_shm_unmap(void* addr)
+{
+  int32_t i;
+  pcb_t* mm = mm_pcb(pcb);
+  for (i = 0; i < MAX_SHM_MAPS; i++) {
+    if (mm->shm_maps[i].id >= 0 && mm->shm_maps[i].vaddr == (uint32_t) addr) {
+      shm_unmap_slot(mm, i);
+      return 0;
+    }
+  }
+  return -1;
+}
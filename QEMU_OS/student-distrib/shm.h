@@ -0,0 +1,41 @@
+// shm.h - declares shared memory segments that can be mapped into several
+// process address spaces
+
+#ifndef _SHM_H
+#define _SHM_H
+
+#include "types.h"
+#include "syscalls.h"
+
+// number of segments that can exist at once
+#define MAX_SHM_SEGS            16
+// largest segment, one page table worth of pages (4MB)
+#define MAX_SHM_PAGES           1024
+// shm_open flag: segment is initialized from the file called name
+#define SHM_FILE                0x1
+
+//shared memory segment
+typedef struct shm_seg_t {
+  //holds name, empty for anonymous segments
+  uint8_t name[FILENAME_LEN];
+  //physical address of first frame (frames are contiguous)
+  uint32_t phys;
+  //number of 4KB pages
+  uint32_t npages;
+  //number of handles plus mappings that reference the segment
+  uint32_t refcnt;
+  //set when the slot holds a live segment
+  uint32_t in_use;
+} shm_seg_t;
+
+// clears the segment table
+void shm_init();
+// drops every handle and mapping held by a process, called from halt
+void shm_release(pcb_t* proc);
+
+//sys call functions
+int32_t sys_call_shm_open(const uint8_t* name, int32_t npages, int32_t flags);
+int32_t sys_call_shm_map(int32_t id, void* addr);
+int32_t sys_call_shm_unmap(void* addr);
+
+#endif //_SHM_H
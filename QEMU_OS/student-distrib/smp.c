@@ -0,0 +1,391 @@
+// smp.c - application processor bring-up, per-CPU state and the kernel lock
+//
+// Every CPU the MP table lists is started with INIT-SIPI-SIPI into a real
+// mode trampoline (ap_boot.S) that turns on protected mode and paging and
+// lands in ap_main on its own idle stack. Each CPU has its own GDT, TSS,
+// run queue and current process; processes are pinned to a CPU by their
+// terminal, so different terminals run in parallel.
+//
+// The kernel itself was written for one CPU with cli as its only lock. It
+// keeps that model: every entry from user mode or an interrupt takes one
+// recursive kernel lock, and the lock is only let go on the way back to
+// user mode or into the idle loop's hlt. User code runs on every CPU at
+// once while kernel code runs on one at a time.
+#include "smp.h"
+#include "lib.h"
+#include "sched.h"
+#include "timer.h"
+#include "paging.h"
+
+cpu_t cpus[MAX_CPUS];
+int32_t num_cpus = 1;
+
+// real mode entry the startup IPI points at, and the GDT pseudo-descriptor
+// inside it (ap_boot.S)
+extern uint8_t ap_trampoline[];
+extern uint8_t ap_trampoline_end[];
+extern uint8_t ap_gdtr[];
+// initial esp of the CPU being started, read by ap_boot.S
+uint32_t ap_stack;
+
+// CPU ap_main is starting on
+static volatile int32_t ap_booting;
+static uint8_t idle_stacks[MAX_CPUS][IDLE_STACK_SIZE] __attribute__((aligned(16)));
+
+// the kernel lock
+static volatile uint32_t kernel_locked;
+
+// GDTR image for sgdt and lgdt
+typedef struct gdtr_t {
+  uint16_t limit;
+  uint32_t base;
+} __attribute__((packed)) gdtr_t;
+
+/*
+ * udelay
+ *   DESCRIPTION: busy waits on the TSC clock
+ *   INPUTS: us - microseconds
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void udelay(uint32_t us)
+{
+  uint64_t start = ktime_ns();
+  while (ktime_ns() - start < (uint64_t) us * 1000);
+}
+
+/*
+ * cpu_self
+ *   DESCRIPTION: every CPU loads the GDT at the start of its own cpu_t, so
+ *                the GDT base says which CPU this is. Before smp_init the
+ *                boot GDT is loaded and that is the boot CPU.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: this CPU's structure
+ *   SIDE EFFECTS: none
+ */
+cpu_t* cpu_self()
+{
+  gdtr_t gdtr;
+  asm volatile("sgdt %0" : "=m"(gdtr));
+  if (gdtr.base < (uint32_t) cpus || gdtr.base >= (uint32_t) (cpus + MAX_CPUS)) return &cpus[0];
+  return (cpu_t*) gdtr.base;
+}
+
+/*
+ * cpu_pcb
+ *   DESCRIPTION: what the pcb macro reads and writes
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: where this CPU keeps its current process
+ *   SIDE EFFECTS: none
+ */
+pcb_t** cpu_pcb()
+{
+  return &cpu_self()->cur;
+}
+
+/*
+ * cpu_setup
+ *   DESCRIPTION: gives a CPU a copy of the boot GDT whose TSS descriptor
+ *                points at the CPU's own TSS
+ *   INPUTS: cpu - CPU to set up
+ *           boot - boot GDT
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void cpu_setup(cpu_t* cpu, gdtr_t* boot)
+{
+  seg_desc_t tss_desc;
+
+  memcpy(cpu->gdt, (void*) boot->base, fmin(boot->limit + 1, sizeof(cpu->gdt)));
+  memset(&cpu->tss, 0, sizeof(tss_t));
+  cpu->tss.ldt_segment_selector = KERNEL_LDT;
+  cpu->tss.ss0 = KERNEL_DS;
+  cpu->tss.esp0 = 0x800000;
+
+  // same descriptor as the boot TSS, not busy and at this CPU's TSS
+  tss_desc = cpu->gdt[KERNEL_TSS >> 3];
+  tss_desc.type = 0x9;
+  SET_TSS_PARAMS(tss_desc, &cpu->tss, TSS_SIZE - 1);
+  cpu->gdt[KERNEL_TSS >> 3] = tss_desc;
+
+  cpu->cur = NULL;
+  cpu->lock_depth = 0;
+  cpu->cr3_pid = -1;
+  cpu->tlb_flush = 0;
+  cpu->bh_wants = 0;
+}
+
+/*
+ * cpu_load
+ *   DESCRIPTION: loads a CPU's own GDT and TSS on the CPU running this
+ *   INPUTS: cpu - this CPU's structure
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: cpu_self returns cpu from here on
+ */
+static void cpu_load(cpu_t* cpu)
+{
+  gdtr_t gdtr;
+  gdtr.limit = sizeof(cpu->gdt) - 1;
+  gdtr.base = (uint32_t) cpu->gdt;
+  // the segment registers keep their selectors, the entries are the same
+  asm volatile("lgdt %0" : : "m"(gdtr) : "memory");
+  ltr(KERNEL_TSS);
+  lldt(KERNEL_LDT);
+}
+
+/*
+ * ap_main
+ *   DESCRIPTION: first C code of an application processor, from ap_boot.S
+ *                with paging on and on its idle stack
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: the CPU joins the scheduler
+ */
+void ap_main()
+{
+  cpu_t* cpu = &cpus[ap_booting];
+
+  cpu_load(cpu);
+  lidt(idt_desc_ptr);
+  lapic_ap_init();
+  cpu->online = 1;
+  sched_idle();
+}
+
+/*
+ * smp_init
+ *   DESCRIPTION: moves the boot CPU onto its own GDT and TSS, then starts
+ *                every other CPU in the MP table one at a time. Call with
+ *                interrupts off, after timer_init and sched_init.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets num_cpus, writes the trampoline page
+ */
+void smp_init()
+{
+  gdtr_t boot;
+  gdtr_t* tramp_gdtr;
+  cpu_t* cpu;
+  uint64_t start;
+  uint32_t bsp_apic;
+  int32_t i;
+
+  asm volatile("sgdt %0" : "=m"(boot));
+  num_cpus = 1;
+  cpu_setup(&cpus[0], &boot);
+  cpus[0].id = 0;
+  cpus[0].apic_id = apic_active ? lapic_id() : 0;
+  cpu_load(&cpus[0]);
+  cpus[0].online = 1;
+  if (!apic_active || mp_num_cpus < 2) return;
+
+  // the trampoline loads the boot CPU's GDT until ap_main loads its own
+  map_kernel_low(AP_TRAMPOLINE, AP_TRAMPOLINE + 4 * KB);
+  memcpy((void*) AP_TRAMPOLINE, ap_trampoline, ap_trampoline_end - ap_trampoline);
+  tramp_gdtr = (gdtr_t*) (AP_TRAMPOLINE + (ap_gdtr - ap_trampoline));
+  tramp_gdtr->limit = sizeof(cpus[0].gdt) - 1;
+  tramp_gdtr->base = (uint32_t) cpus[0].gdt;
+
+  bsp_apic = cpus[0].apic_id;
+  for (i = 0; i < mp_num_cpus && num_cpus < MAX_CPUS; i++) {
+    if (mp_cpu_ids[i] == bsp_apic) continue;
+    cpu = &cpus[num_cpus];
+    cpu_setup(cpu, &boot);
+    cpu->id = num_cpus;
+    cpu->apic_id = mp_cpu_ids[i];
+    cpu->online = 0;
+    ap_booting = num_cpus;
+    ap_stack = (uint32_t) &idle_stacks[num_cpus][IDLE_STACK_SIZE];
+
+    lapic_send_init(cpu->apic_id);
+    udelay(INIT_DELAY_US);
+    lapic_send_startup(cpu->apic_id, AP_TRAMPOLINE >> 12);
+    udelay(SIPI_DELAY_US);
+    if (!cpu->online) lapic_send_startup(cpu->apic_id, AP_TRAMPOLINE >> 12);
+    udelay(SIPI_DELAY_US);
+
+    // one at a time: the next CPU reuses ap_stack and ap_booting
+    start = ktime_ns();
+    while (!cpu->online && ktime_ns() - start < (uint64_t) AP_WAIT_US * 1000);
+    if (cpu->online) num_cpus++;
+    // park a CPU that did not make it before it reads the next one's stack
+    else lapic_send_init(cpu->apic_id);
+  }
+}
+
+/*
+ * smp_kick
+ *   DESCRIPTION: sends a reschedule IPI so a CPU halted in its idle loop
+ *                wakes up and looks at its run queue and bh_wants
+ *   INPUTS: cpu - CPU to wake
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: interrupts the CPU
+ */
+void smp_kick(cpu_t* cpu)
+{
+  if (cpu != cpu_self() && cpu->online) lapic_send_ipi(cpu->apic_id, IPI_RESCHED_VECTOR);
+}
+
+/*
+ * flush_tlb
+ *   DESCRIPTION: reloads CR3 if a shootdown is pending for this CPU
+ *   INPUTS: cpu - this CPU
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: flushes the non-global TLB entries, acknowledges
+ */
+static void flush_tlb(cpu_t* cpu)
+{
+  if (!cpu->tlb_flush) return;
+  asm volatile (
+    "movl    %%cr3, %%eax;"
+    "movl    %%eax, %%cr3;"
+    : : : "eax", "memory"
+  );
+  cpu->tlb_flush = 0;
+}
+
+/*
+ * tlb_shootdown
+ *   DESCRIPTION: after a page directory changed, makes every other CPU
+ *                that has it loaded flush its TLB, and waits until they
+ *                have. Those CPUs are never waiting on the kernel lock
+ *                with the flush undone: lock_kernel flushes while it spins.
+ *   INPUTS: pid - process whose directory changed
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: interrupts other CPUs
+ */
+void tlb_shootdown(int32_t pid)
+{
+  cpu_t* self = cpu_self();
+  int32_t i;
+
+  for (i = 0; i < num_cpus; i++) {
+    if (&cpus[i] == self || cpus[i].cr3_pid != pid) continue;
+    cpus[i].tlb_flush = 1;
+    lapic_send_ipi(cpus[i].apic_id, IPI_TLB_VECTOR);
+  }
+  for (i = 0; i < num_cpus; i++) {
+    while (cpus[i].tlb_flush) asm volatile("pause");
+  }
+}
+
+/*
+ * lock_kernel
+ *   DESCRIPTION: takes the kernel lock. A CPU that already holds it only
+ *                counts one more level, so an interrupt in kernel code
+ *                does not deadlock against its own CPU.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may spin until another CPU leaves the kernel
+ */
+void lock_kernel()
+{
+  uint32_t flags;
+  uint32_t taken;
+  cpu_t* cpu;
+
+  // an interrupt between taking the lock and counting it would spin forever
+  cli_and_save(flags);
+  cpu = cpu_self();
+  if (cpu->lock_depth++ == 0) {
+    do {
+      // the holder may be waiting for this CPU to flush
+      while (kernel_locked) {
+        flush_tlb(cpu);
+        asm volatile("pause");
+      }
+      taken = 1;
+      asm volatile("xchgl %0, %1" : "+r"(taken), "+m"(kernel_locked) : : "memory");
+    } while (taken);
+  }
+  restore_flags(flags);
+}
+
+/*
+ * unlock_kernel
+ *   DESCRIPTION: drops one level of the kernel lock, letting other CPUs in
+ *                once it is the last
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void unlock_kernel()
+{
+  uint32_t flags;
+  cpu_t* cpu;
+
+  cli_and_save(flags);
+  cpu = cpu_self();
+  if (--cpu->lock_depth == 0) {
+    asm volatile("" : : : "memory");
+    kernel_locked = 0;
+  }
+  restore_flags(flags);
+}
+
+/*
+ * unlock_kernel_all
+ *   DESCRIPTION: a new process enters user mode from whatever depth the
+ *                context that switched to it had, and has nothing to come
+ *                back to; the levels belong to the switched out context,
+ *                which restores them when it runs again
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: lets other CPUs into the kernel
+ */
+void unlock_kernel_all()
+{
+  uint32_t flags;
+  cpu_t* cpu;
+
+  cli_and_save(flags);
+  cpu = cpu_self();
+  if (cpu->lock_depth) {
+    cpu->lock_depth = 0;
+    asm volatile("" : : : "memory");
+    kernel_locked = 0;
+  }
+  restore_flags(flags);
+}
+
+/*
+ * resched_IH
+ *   DESCRIPTION: top half of the reschedule IPI. Waking the CPU is the
+ *                point; the idle loop or bh_run does the rest.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: ends the interrupt
+ */
+void resched_IH()
+{
+  lapic_eoi();
+}
+
+/*
+ * tlb_IH
+ *   DESCRIPTION: handler of the TLB shootdown IPI. Runs without the kernel
+ *                lock, which the sender holds while it waits.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: flushes the TLB, ends the interrupt
+ */
+void tlb_IH()
+{
+  flush_tlb(cpu_self());
+  lapic_eoi();
+}
@@ -0,0 +1,95 @@
+// smp.h - declares per-CPU state, application processor bring-up and the
+// kernel lock
+
+#ifndef _SMP_H
+#define _SMP_H
+
+// physical page the application processors start in real mode at
+#define AP_TRAMPOLINE           0x7000
+// stack each application processor's idle loop runs on
+#define IDLE_STACK_SIZE         4096
+// GDT entries, the same layout as the boot GDT in x86_desc.S
+#define CPU_GDT_ENTRIES         8
+
+// interprocessor interrupt vectors
+#define IPI_RESCHED_VECTOR      0xF1
+#define IPI_TLB_VECTOR          0xF2
+
+// INIT-SIPI-SIPI timing, and how long to wait for a started CPU to report
+#define INIT_DELAY_US           10000
+#define SIPI_DELAY_US           200
+#define AP_WAIT_US              100000
+
+#ifndef ASM
+
+#include "types.h"
+#include "x86_desc.h"
+#include "syscalls.h"
+#include "apic.h"
+
+// everything one CPU needs of its own. The GDT comes first: cpu_self finds
+// the structure from the GDT base the CPU has loaded
+typedef struct cpu_t {
+  // copy of the boot GDT with the TSS descriptor pointing at tss below
+  seg_desc_t gdt[CPU_GDT_ENTRIES];
+  tss_t tss;
+  // index in cpus and local APIC id
+  int32_t id;
+  uint32_t apic_id;
+  // set by the CPU once it is running its idle loop
+  volatile int32_t online;
+  // process running here, NULL while the idle loop runs
+  pcb_t* cur;
+  // saved kernel esp of the idle loop while a process runs
+  uint32_t idle_esp;
+  // runnable processes pinned here that are not on the CPU, oldest first
+  pcb_t* run_head;
+  pcb_t* run_tail;
+  // runnable EDF processes pinned here, earliest deadline first; they run
+  // before anything on run_head
+  pcb_t* rt_head;
+  // budget/period summed over the EDF processes pinned here
+  uint32_t rt_util;
+  // kernel lock nesting of the context running here, 0 if not held
+  int32_t lock_depth;
+  // pid whose page directory CR3 holds, -1 for the boot directory
+  volatile int32_t cr3_pid;
+  // set by tlb_shootdown, cleared once this CPU has flushed
+  volatile int32_t tlb_flush;
+  // BH_WANT_* asked of this CPU's next bottom half pass
+  uint32_t bh_wants;
+  // ends the time slice of the process running here while others wait
+  ktimer_t slice_timer;
+} __attribute__((aligned(16))) cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+// CPUs brought up, 1 without an APIC
+extern int32_t num_cpus;
+
+// CPU a terminal's processes are pinned to
+#define term_cpu(term)          ((term) % num_cpus)
+
+// the structure of the CPU this runs on
+cpu_t* cpu_self();
+// gives the boot CPU its own GDT and TSS and starts the others
+void smp_init();
+// wakes another CPU so it looks at its run queue and bottom half wants
+void smp_kick(cpu_t* cpu);
+// flushes the TLB of every other CPU that has pid's page directory loaded
+void tlb_shootdown(int32_t pid);
+
+// takes the kernel lock, recursive on the same CPU
+void lock_kernel();
+// drops one level of the kernel lock
+void unlock_kernel();
+// drops the kernel lock whatever the nesting, for a new process going to
+// user mode
+void unlock_kernel_all();
+
+// top halves of the interprocessor interrupts
+void resched_IH();
+void tlb_IH();
+
+#endif /* ASM */
+
+#endif //_SMP_H
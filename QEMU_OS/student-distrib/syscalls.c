@@ -7,128 +7,281 @@
 #include "x86_desc.h"
 #include "lib.h"
 #include "rtc.h"
-
-#define MAX_PROCESS_NUM 24 // MAKE SURE TO CHANGE PID_ARR IF MODIFIED
+#include "shm.h"
+#include "sched.h"
+#include "pipe.h"
+#include "ipc.h"
+#include "poll.h"
+#include "vidbuf.h"
+#include "timer.h"
+#include "smp.h"
+#include "workqueue.h"
 
 #define DEBUG 0 // debug switch
 
 // "magic number that identifies the file as an executable."
 uint8_t exec_check[4] = {0x7F, 0x45, 0x4C, 0x46};
 
-// array of flags to see which processes are running
-static uint8_t pid_arr[NUM_TERMS][MAX_PROCESS_NUM] =
-{{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
-
-// keeps track of active process
-static uint8_t pid_active[NUM_TERMS] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-
-// keeps track of parent process
-static uint8_t pid_old[NUM_TERMS] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+// array of flags to see which process slots are in use (shared by all terminals)
+static uint8_t pid_arr[MAX_PROCESS_NUM];
+
+// 1 while a free slot's program image region is known to be all zeros, so
+// a new process can load over it without clearing it first
+static uint8_t pid_clean[MAX_PROCESS_NUM];
+// clears a freed slot's image region from a worker
+static work_t prezero_work[MAX_PROCESS_NUM];
+// starts a terminal's root shell from a worker
+static work_t shell_work[NUM_TERMS];
+
+// pid of each terminal's root shell
+static uint8_t root_pid[NUM_TERMS] = {NO_PID, NO_PID, NO_PID, NO_PID, NO_PID,
+                                      NO_PID, NO_PID, NO_PID, NO_PID, NO_PID};
+
+static int32_t ready_in(int32_t fd);
+static void pid_free(int32_t pid);
 
 //terminal jump table
-file_jump_table_t term_fn = {terminal_open, terminal_close, terminal_read, terminal_write};
+file_jump_table_t term_fn = {terminal_open, terminal_close, terminal_read, terminal_write,
+                             NULL, terminal_ready, terminal_poll_arm, terminal_ioctl};
 //rtc jump table
-file_jump_table_t rtc_fn = {open, close, read, write};
+file_jump_table_t rtc_fn = {open, close, read, write, rtc_dup, rtc_ready, NULL, rtc_ioctl};
 //file jump table
-file_jump_table_t file_fn = {file_open, file_close, file_read, file_write};
+file_jump_table_t file_fn = {file_open, file_close, file_read, file_write, NULL, ready_in, NULL};
 //directory jump table
-file_jump_table_t dir_fn = {dir_open, dir_close, dir_read, dir_write};
+file_jump_table_t dir_fn = {dir_open, dir_close, dir_read, dir_write, NULL, ready_in, NULL};
 //null jump table
 file_jump_table_t null_fn = {retfail, retfail, retfail, retfail};
 
 /*
  * sys_call_halt
- *   DESCRIPTION: terminates a process
+ *   DESCRIPTION: terminates a process. Its slot stays a zombie until the
+ *                parent collects the status with wait. A thread group
+ *                leader first has its threads exit and waits for them,
+ *                since they run in its address space.
  *   INPUTS: status - 8-bit argument stored into %BL
- *   RETURN VALUE: 0 on success, -1 on fail
+ *   RETURN VALUE: never returns
  */
 int32_t sys_call_halt(uint8_t status){
-  uint32_t bl;
+  uint32_t flags;
   int i;
+  pcb_t* pcb_cur = pcb;
+  pcb_t* child;
+  pcb_t* leader;
+  int pid_cur = pcb_cur->pid;
+  int pid_par;
+
+  //interrupts and system calls from here on must not start another halt
+  pcb_cur->exiting = 1;
+
+  if (pcb_cur->nthreads) {
+    proc_kill(pcb_cur);
+    cli_and_save(flags);
+    while (pcb_cur->nthreads) sleep_on(&pcb_cur->thread_wq);
+    restore_flags(flags);
+  }
+  //read after waiting, the parent may have halted meanwhile
+  pid_par = pcb_cur->parent_pid;
 
-  // initialize current PCB
-  int pid_cur = pid_active[cur_term];
-  int pcb_pos_cur = (cur_term+1) * pid_cur;
-  pcb_t* pcb_cur = (pcb_t*) (8*MB - (8*KB * (pcb_pos_cur + 1)));
+  if (DEBUG) printf("HALT\nPid_cur: %d\nPid_par: %d\n", pid_cur, pid_par);
 
-  // initialize parent PCB
-  int pid_par = pcb_cur->parent_pid;
-  int pcb_pos_par = (cur_term+1) * pid_par;
-  pcb_t* pcb_par = (pcb_t*) (8*MB - (8*KB * (pcb_pos_par + 1)));
+  //close every open file, terminal fds would clear the screen so skip them
+  for(i = 0; i < 8; i++){
+    if (pcb_cur->file_array[i].flags == USED && pcb_cur->file_array[i].jump_table_ptr != &term_fn)
+      pcb_cur->file_array[i].jump_table_ptr->close(i);
+    pcb_cur->file_array[i].jump_table_ptr = &null_fn;
+    pcb_cur->file_array[i].flags = UNUSED;
+  }
 
-  if (DEBUG) printf("HALT\nPid_cur: %d\nPid_par: %d\n", pcb_pos_cur, pcb_pos_par);
+  //drop shared memory handles and mappings
+  shm_release(pcb_cur);
+  //give the terminal back to line input if we left it raw
+  terminal_release(pcb_cur);
+  vidbuf_release(pcb_cur);
+  timer_release(pcb_cur);
+  sched_rt_leave(pcb_cur);
+
+  cli_and_save(flags);
+
+  //fail anyone sending to us or waiting for our reply
+  ipc_release(pcb_cur);
+
+  //children still running are no longer waited for, dead ones are freed
+  for (i = 0; i < MAX_PROCESS_NUM; i++) {
+    if (!pid_arr[i] || i == pid_cur) continue;
+    child = PCB_ADDR(i);
+    if (child->parent_pid != pid_cur) continue;
+    child->parent_pid = NO_PID;
+    if (child->state == PROC_ZOMBIE) pid_free(i);
+  }
 
-  //execute shell if try to halt shell
-  if (pid_cur == 0) {
-    pid_arr[cur_term][pid_cur] = 0;
-    printf("Closing Last Shell...\n");
-    return sys_call_execute((uint8_t*)"shell");
+  pcb_cur->exit_status = status & 0xFF;
+  pcb_cur->state = PROC_ZOMBIE;
+
+  //a thread lets its leader finish halting once it is the last
+  if (pcb_cur->mm_pid != pid_cur) {
+    leader = mm_pcb(pcb_cur);
+    leader->nthreads--;
+    wake_up(&leader->thread_wq);
   }
 
-  //init the max possible number of files (8) to the default values
-  for(i = 2; i < 8; i++){
-      if (pcb_cur->file_array[i].flags == 1) sys_call_close(i);
-      pcb_cur->file_array[i].jump_table_ptr = &null_fn;
-      pcb_cur->file_array[i].flags = 0;
+  if (pid_par == NO_PID) {
+    //restart the terminal's shell if it was the root one. A worker loads
+    //it, which cannot happen before we are off this stack
+    if (root_pid[pcb_cur->term] == pid_cur) {
+      printf("Closing Last Shell...\n");
+      root_pid[pcb_cur->term] = NO_PID;
+      queue_shell(pcb_cur->term);
+    }
+    //nobody will wait for us; the stack stays ours until the switch below
+    //since interrupts are off
+    pid_free(pid_cur);
+  }
+  else {
+    wake_up(&PCB_ADDR(pid_par)->child_wq);
   }
 
-  //map the parent page
-  map_page(pcb_pos_par);
+  schedule();
+  //not reached, zombies are never picked again
+  restore_flags(flags);
+  return 0;
+}
 
-  //set esp0 in TSS
-  tss.esp0 = 8*MB - 8*KB * (pcb_pos_par) - 4;
+/*
+ * pid_alloc
+ *   DESCRIPTION: claims a free process slot
+ *   INPUTS: none
+ *   RETURN VALUE: the pid, -1 if every slot is in use
+ */
+static int32_t pid_alloc(){
+  uint32_t flags;
+  int32_t pid;
+
+  cli_and_save(flags);
+  for (pid = 0; pid < MAX_PROCESS_NUM; pid++) {
+    if (pid_arr[pid] == 0) {
+      pid_arr[pid] = 1;
+      break;
+    }
+  }
+  restore_flags(flags);
+  return (pid == MAX_PROCESS_NUM) ? -1 : pid;
+}
 
-  //lower 8 bits of status expanded to 32 bits
-  bl = (uint32_t)(status & 0xFF);
+/*
+ * pid_free
+ *   DESCRIPTION: gives a process slot back and has a worker clear its
+ *                image region before the next process loads into it.
+ *                Safe with interrupts off.
+ *   INPUTS: pid - slot to free
+ *   RETURN VALUE: none
+ */
+static void pid_free(int32_t pid){
+  pid_arr[pid] = 0;
+  if (!pid_clean[pid]) queue_work(&prezero_work[pid]);
+}
 
-  //set old pid
-  pid_old[cur_term] = pid_cur;
+/*
+ * prezero
+ *   DESCRIPTION: work function that zeroes a free slot's program image
+ *                region through its own page directory, holding the slot
+ *                meanwhile so nothing loads into it
+ *   INPUTS: pid - slot to clear
+ *   RETURN VALUE: none
+ * SIDE EFFECT: leaves the slot's directory loaded, like the idle loop
+ */
+static void prezero(uint32_t pid){
+  uint32_t flags;
 
-  // latest process is now parent process
-  pid_active[cur_term] = pid_par;
+  cli_and_save(flags);
+  if (pid_arr[pid] || pid_clean[pid]) {
+    restore_flags(flags);
+    return;
+  }
+  pid_arr[pid] = 1;
+  restore_flags(flags);
+
+  init_proc_dir(pid);
+  switch_page_dir(pid);
+  memset((void*)PROG_IMG_ADDR, 0, MAX_FILE_SIZE);
+  pid_clean[pid] = 1;
+  pid_arr[pid] = 0;
+}
 
-  // keep track of current pcb
-  pcb = pcb_par;
+/*
+ * pcb_init
+ *   DESCRIPTION: resets everything in a new pcb a process or kernel thread
+ *                does not bring itself: no files, no shared memory, no
+ *                IPC or timers, no parent
+ *   INPUTS: proc - pcb of the new slot
+ *           pid - its pid
+ *           term - terminal it belongs to
+ *   RETURN VALUE: none
+ */
+static void pcb_init(pcb_t* proc, int32_t pid, int term){
+  int i;
 
-  // reset flag for pid that is being closed
-  pid_arr[cur_term][pid_cur] = 0;
+  //init the max possible number of files (8) to the default values
+  for(i = 0; i < 8; i++){
+    //initialize all values of fd to 0
+    proc->file_array[i].jump_table_ptr = &null_fn;
+    proc->file_array[i].inode = 0;
+    proc->file_array[i].file_position = 0;
+    proc->file_array[i].flags = 0;
+  }
 
-  if (DEBUG) printf("TSS: %d\n", tss.esp0);
+  //no shared memory yet
+  for(i = 0; i < MAX_SHM_HANDLES; i++) proc->shm_handles[i] = -1;
+  for(i = 0; i < MAX_SHM_MAPS; i++) proc->shm_maps[i].id = -1;
 
-  //set return value and jump to end of execute
-  asm volatile("mov %0, %%eax;"
-               "jmp end_of_execute;"
-               :
-               :"r"(bl)
-               :"%eax"
-              );
-  return 0;
+  //init variables in the PCB
+  proc->signal_info = 0;
+  proc->pid = pid;
+  proc->parent_pid = NO_PID;
+  proc->term = term;
+  proc->cpu = term_cpu(term);
+  proc->kthread = 0;
+  proc->mm_pid = pid;
+  proc->nthreads = 0;
+  proc->killed = 0;
+  proc->exiting = 0;
+  proc->futex_addr = 0;
+  proc->thread_wq.head = NULL;
+  proc->vidmapped = 0;
+  proc->vidbuf = 0;
+  proc->exit_status = 0;
+  proc->child_wq.head = NULL;
+  proc->ipc_state = IPC_NONE;
+  proc->ipc_wq.head = NULL;
+  proc->ipc_senders.head = NULL;
+  for(i = 0; i < MAX_USER_TIMERS; i++) timer_setup(&proc->utimers[i], NULL, 0);
+  proc->utimer_fired = 0;
+  proc->utimer_wq.head = NULL;
+  proc->rt = 0;
+  proc->rt_throttled = 0;
+  proc->rt_misses = 0;
+  timer_setup(&proc->rt_timer, NULL, 0);
+  proc->arguments[0] = '\0';
 }
 
 /*
- * sys_call_execute
- *   DESCRIPTION: attempts to load and exeute a new program, handing off the
-                  processor to the new program until it terminates
+ * proc_create
+ *   DESCRIPTION: loads a program into a new process and makes it runnable.
+                  The new kernel stack starts with an IRET frame to the entry
+                  point under a switch_to frame returning into proc_first_run.
  *   INPUTS: command - first word is filename, rest of it is handled via getargs
- *   RETURN VALUE: -1 on fail, 256 on exception, 0-255 otherwise (halt)
+ *           term - terminal the process belongs to
+ *           parent - creating process, NULL for a terminal's root shell
+ *           in_fd, out_fd - parent fds copied to the child's fd 0 and 1
+ *   RETURN VALUE: pid of the new process, -1 on fail
  */
-int32_t sys_call_execute(const uint8_t* command){
+static int32_t proc_create(const uint8_t* command, int term, pcb_t* parent,
+                           int32_t in_fd, int32_t out_fd){
 
 /********************************PARSE********************************/
-uint32_t ret;
   uint8_t fname[FILENAME_LEN]; // file name string - 32 indices
-  //uint8_t shell[FILENAME_LEN] = "shell";
   uint8_t args[BUFFER_LIM]; // argument string - 128 indices
   uint8_t buf[4]; // buf for file_read - read 4 bytes
+  uint32_t* sp; // builds the new kernel stack
   int i = 0; // index for loops
   int j = 0; // index for fname and args
 
@@ -175,58 +328,61 @@ uint32_t ret;
 
 /********************************PAGING*******************************/
 
-  // initialize pid_par and pid_cur
-  // iterate through pid_arr to check for space
-  int pid_par = pid_active[cur_term];
-  int pid_cur;
-  for (pid_cur = 0; pid_cur < MAX_PROCESS_NUM; pid_cur++) {
-    if(pid_arr[cur_term][pid_cur] == 0) {
-      pid_arr[cur_term][pid_cur] = 1;
-      break;
-    }
-  }
-
   // if pid_arr is full, can't execute any more programs
-  if (pid_cur == MAX_PROCESS_NUM) {
+  int pid_cur = pid_alloc();
+  if (pid_cur < 0) {
     printf("Max Process Number Reached!\n");
-    return 1;
+    return -1;
   }
 
-  // calculate linear position of pcb
-  int pcb_pos_cur = (cur_term+1) * pid_cur;
-
-  //map the current process number
-  map_page(pcb_pos_cur);
+  //build the new process's address space and switch to it to load the image
+  init_proc_dir(pid_cur);
+  switch_page_dir(pid_cur);
 
 /**************************LOAD USER PROGRAM**************************/
 
+  // whatever the image does not cover must read as zero (bss); a worker
+  // has usually cleared the region since the slot's last process
+  if (!pid_clean[pid_cur]) memset((void*)PROG_IMG_ADDR, 0, MAX_FILE_SIZE);
+  pid_clean[pid_cur] = 0;
+
   // The program image itself is linked to execute at 0x08048000
   // Copy entire file to memory starting at virtual address 0x08048000
-  if (read_data(dentry.inode, 0, (uint8_t*)PROG_IMG_ADDR, MAX_FILE_SIZE) == 0) return -1;
+  i = read_data(dentry.inode, 0, (uint8_t*)PROG_IMG_ADDR, MAX_FILE_SIZE);
+
+  // back to whoever is running, the idle loop and kernel threads can keep
+  // the new directory
+  if (pcb && !pcb->kthread) switch_page_dir(pcb->mm_pid);
+
+  if (i == 0) {
+    // give the slot back
+    pid_free(pid_cur);
+    return -1;
+  }
 
 /******************************CREATE PCB*****************************/
 
-  pcb_t* pcb_cur = (pcb_t*) (8*MB - (8*KB * (pcb_pos_cur + 1)));
+  pcb_t* pcb_cur = PCB_ADDR(pid_cur);
+  pcb_init(pcb_cur, pid_cur, term);
 
-  //init the max possible number of files (8) to the default values
-  for(i = 0; i < 8; i++){
-    //initialize all values of fd to 0
-    pcb_cur->file_array[i].jump_table_ptr = &null_fn;
-    pcb_cur->file_array[i].inode = 0;
-    pcb_cur->file_array[i].file_position = 0;
-    pcb_cur->file_array[i].flags = 0;
-
-    //first 2 are occupied by stdin and stdout which use terminal functions
-    if(i == 0 || i == 1){
-      pcb_cur->file_array[i].jump_table_ptr = &term_fn;
-      pcb_cur->file_array[i].flags = 1;
+  //stdin and stdout are the terminal for a root shell, otherwise copies of
+  //the parent's fds
+  if (parent == NULL) {
+    pcb_cur->file_array[0].jump_table_ptr = &term_fn;
+    pcb_cur->file_array[0].flags = USED;
+    pcb_cur->file_array[1].jump_table_ptr = &term_fn;
+    pcb_cur->file_array[1].flags = USED;
+  }
+  else {
+    pcb_cur->file_array[0] = parent->file_array[in_fd];
+    pcb_cur->file_array[1] = parent->file_array[out_fd];
+    for (i = 0; i < 2; i++) {
+      if (pcb_cur->file_array[i].jump_table_ptr->dup)
+        pcb_cur->file_array[i].jump_table_ptr->dup(pcb_cur->file_array[i].inode);
     }
   }
 
-  //init variables in the PCB
-  pcb_cur->signal_info = 0;
-  pcb_cur->pid = pid_cur;
-  pcb_cur->parent_pid = pid_par;
+  pcb_cur->parent_pid = parent ? parent->pid : NO_PID;
 
   // copy args to arguments
   i = 0;
@@ -236,92 +392,390 @@ uint32_t ret;
   }
   pcb_cur->arguments[i] = '\0';
 
-  // now set pcb to current
-  pcb = pcb_cur;
-  pid_active[cur_term] = pid_cur;
-
-  // set flag
-  pid_arr[cur_term][pid_cur] = 1;
+/***************************FIRST RUN FRAME***************************/
+
+  sp = (uint32_t*)KSTACK_TOP(pid_cur);
+  //IRET frame to the entry point
+  *--sp = USER_DS;
+  *--sp = USER_ESP;
+  *--sp = 0x202;                  // IF set
+  *--sp = USER_CS;
+  *--sp = *((uint32_t*)buf);
+  //what switch_to pops: return address, ebp, ebx, esi, edi, eflags
+  *--sp = (uint32_t)proc_first_run;
+  *--sp = 0;
+  *--sp = 0;
+  *--sp = 0;
+  *--sp = 0;
+  *--sp = 0x002;                  // IF clear until the IRET
+  pcb_cur->stack_ptr = (uint32_t)sp;
+
+  if (DEBUG) printf("CREATE --- Process #: %d\n", pid_cur);
+
+  sched_enqueue(pcb_cur);
+  return pid_cur;
+}
 
-/***************************CONTEXT SWITCH****************************/
+/*
+ * sys_call_execute
+ *   DESCRIPTION: attempts to load and exeute a new program, handing off the
+                  processor to the new program until it terminates
+ *   INPUTS: command - first word is filename, rest of it is handled via getargs
+ *   RETURN VALUE: -1 on fail, 256 on exception, 0-255 otherwise (halt)
+ */
+int32_t sys_call_execute(const uint8_t* command){
+  int32_t pid = proc_create(command, pcb->term, pcb, 0, 1);
+  if (pid < 0) return -1;
+  return sys_call_wait(pid);
+}
 
-  //set ss0 in TSS
-  tss.ss0 = KERNEL_DS;
-  //set esp0 in TSS
-  tss.esp0 = 8*MB - 8*KB * (pcb_pos_cur) - 4;
+/*
+ * sys_call_spawn
+ *   DESCRIPTION: starts a program that runs alongside the caller
+ *   INPUTS: command - same as execute
+ *           in_fd - caller fd the child gets as stdin
+ *           out_fd - caller fd the child gets as stdout
+ *   RETURN VALUE: pid of the child for wait, -1 on fail
+ */
+int32_t sys_call_spawn(const uint8_t* command, int32_t in_fd, int32_t out_fd){
+  if (in_fd < 0 || in_fd > MAX_INDEX || out_fd < 0 || out_fd > MAX_INDEX) return -1;
+  if (pcb->file_array[in_fd].flags == UNUSED || pcb->file_array[out_fd].flags == UNUSED) return -1;
+  return proc_create(command, pcb->term, pcb, in_fd, out_fd);
+}
 
-  if (DEBUG) {
-    printf("EXECUTE --- Process #: %d\n", pid_active[cur_term]);
-    printf("TSS: %d\n", tss.esp0);
+/*
+ * sys_call_wait
+ *   DESCRIPTION: sleeps until a child halts and frees its slot
+ *   INPUTS: pid - child returned by spawn
+ *   RETURN VALUE: the child's halt status, -1 on fail or if killed
+ */
+int32_t sys_call_wait(int32_t pid){
+  uint32_t flags;
+  int32_t status;
+  pcb_t* child;
+
+  if (pid < 0 || pid >= MAX_PROCESS_NUM || !pid_arr[pid]) return -1;
+  child = PCB_ADDR(pid);
+  if (child->parent_pid != pcb->pid) return -1;
+
+  cli_and_save(flags);
+  while (child->state != PROC_ZOMBIE) {
+    if (sleep_killed()) {
+      restore_flags(flags);
+      return -1;
+    }
+    sleep_on(&pcb->child_wq);
   }
+  status = child->exit_status;
+  pid_free(pid);
+  restore_flags(flags);
 
-  ret = jump_to_user(*((uint32_t*)buf));
-  pid_old[cur_term] = pid_active[cur_term];
-  return (ret);
+  return status;
 }
 
 /*
- * switch_term_back
- *   DESCRIPTION: switches back to an old terminal. Similar to execute.
- *   INPUTS: none
- *   RETURN VALUE: none
+ * start_shell
+ *   DESCRIPTION: creates the root shell of a terminal, it runs once the
+ *                terminal is visible and the scheduler picks it
+ *   INPUTS: term - terminal number
+ *   RETURN VALUE: pid of the shell, -1 on fail
  * SIDE EFFECT: none
  */
-void switch_term_back()
+int32_t start_shell(int term)
 {
-  // calculate linear position of pcb
-  int pcb_pos_cur = (cur_term+1) * pid_active[cur_term];
-  // printf("%x\n%x\n", cur_term, pid_active[cur_term]);
+  int32_t pid = proc_create((uint8_t*)"shell", term, NULL, 0, 1);
+  if (pid >= 0) root_pid[term] = pid;
+  return pid;
+}
 
-  //map the current process number
-  map_page(pcb_pos_cur);
+/*
+ * shell_work_fn
+ *   DESCRIPTION: work function that starts a terminal's root shell
+ *   INPUTS: term - terminal number
+ *   RETURN VALUE: none
+ * SIDE EFFECT: none
+ */
+static void shell_work_fn(uint32_t term)
+{
+  start_shell(term);
+}
 
-  //set ss0 in TSS
-  tss.ss0 = KERNEL_DS;
-  //set esp0 in TSS
-  tss.esp0 = 8*MB - 8*KB * (pcb_pos_cur) - 4;
+/*
+ * queue_shell
+ *   DESCRIPTION: has a worker start a terminal's root shell, so loading
+ *                the program stays out of the keyboard bottom half and
+ *                out of halt
+ *   INPUTS: term - terminal number
+ *   RETURN VALUE: none
+ * SIDE EFFECT: none
+ */
+void queue_shell(int term)
+{
+  queue_work(&shell_work[term]);
 }
 
 /*
- * get_cur_pcb
- *   DESCRIPTION: gets current pcb
+ * proc_init
+ *   DESCRIPTION: sets up the work items for process slots and terminals
+ *                and queues every slot for pre-zeroing. Call after
+ *                workqueue_init.
  *   INPUTS: none
- *   RETURN VALUE: pcb pointer to current pcb
+ *   RETURN VALUE: none
  * SIDE EFFECT: none
  */
-pcb_t* get_cur_pcb()
+void proc_init()
 {
-  int cur_pcb_pos = (cur_term+1) * pid_active[cur_term];
-  return((pcb_t*) (8*MB - (8*KB * (cur_pcb_pos + 1))));
+  int32_t i;
+  for (i = 0; i < NUM_TERMS; i++) work_setup(&shell_work[i], shell_work_fn, i);
+  for (i = 0; i < MAX_PROCESS_NUM; i++) {
+    work_setup(&prezero_work[i], prezero, i);
+    if (!pid_arr[i]) queue_work(&prezero_work[i]);
+  }
 }
 
 /*
- * set_pcb
- *   DESCRIPTION: sets pcb
- *   INPUTS: none
- *   RETURN VALUE: pcb pointer to current pcb
+ * kthread_run
+ *   DESCRIPTION: first code of a kernel thread, switch_to returns here with
+ *                fn and data above a dummy return address. The CPU holds
+ *                the kernel lock for the context that switched here; the
+ *                thread owns one level of it from now on. A thread whose
+ *                function returns frees its slot.
+ *   INPUTS: fn - thread function
+ *           data - argument for fn
+ *   RETURN VALUE: never returns
+ */
+static void kthread_run(void (*fn)(uint32_t data), uint32_t data)
+{
+  cpu_self()->lock_depth = 1;
+  sti();
+  fn(data);
+
+  cli();
+  pcb->state = PROC_ZOMBIE;
+  //the stack stays ours until the switch below since interrupts are off
+  pid_arr[pcb->pid] = 0;
+  schedule();
+}
+
+/*
+ * kthread_create
+ *   DESCRIPTION: starts a kernel thread. It takes a process slot for its
+ *                kernel stack and pcb but has no user address space: it
+ *                runs on whatever page directory the CPU has loaded, whose
+ *                kernel half is the same in all of them. It is scheduled
+ *                like a process, pinned to one CPU.
+ *   INPUTS: fn - thread function, runs with interrupts on
+ *           data - argument for fn
+ *           cpu - index of the CPU to run on
+ *   RETURN VALUE: pid of the thread, -1 if no slot is free
+ */
+int32_t kthread_create(void (*fn)(uint32_t data), uint32_t data, int32_t cpu)
+{
+  uint32_t* sp;
+  pcb_t* thread;
+  int32_t pid = pid_alloc();
+
+  if (pid < 0) return -1;
+  thread = PCB_ADDR(pid);
+  pcb_init(thread, pid, 0);
+  thread->cpu = cpu;
+  thread->kthread = 1;
+
+  sp = (uint32_t*)KSTACK_TOP(pid);
+  //kthread_run's arguments and a return address it never uses
+  *--sp = data;
+  *--sp = (uint32_t)fn;
+  *--sp = 0;
+  //what switch_to pops: return address, ebp, ebx, esi, edi, eflags
+  *--sp = (uint32_t)kthread_run;
+  *--sp = 0;
+  *--sp = 0;
+  *--sp = 0;
+  *--sp = 0;
+  *--sp = 0x002;                  // IF clear until kthread_run
+  thread->stack_ptr = (uint32_t)sp;
+
+  sched_enqueue(thread);
+  return pid;
+}
+
+/*
+ * proc_alive
+ *   DESCRIPTION: tells if a pid belongs to a process that has not halted
+ *   INPUTS: pid - process id
+ *   RETURN VALUE: 1 if alive, 0 otherwise
  * SIDE EFFECT: none
  */
-void set_pcb()
+int32_t proc_alive(int32_t pid)
+{
+  if (pid < 0 || pid >= MAX_PROCESS_NUM || !pid_arr[pid]) return 0;
+  if (PCB_ADDR(pid)->kthread) return 0;
+  return PCB_ADDR(pid)->state != PROC_ZOMBIE;
+}
+
+/*
+ * proc_kill
+ *   DESCRIPTION: tells every process sharing an address space with proc to
+ *                exit. Each halts itself the next time it returns from a
+ *                system call or interrupt; blocked ones are woken and
+ *                their blocking call fails.
+ *   INPUTS: proc - any member of the thread group
+ *   RETURN VALUE: none
+ * SIDE EFFECT: may send reschedule IPIs
+ */
+void proc_kill(pcb_t* proc)
+{
+  uint32_t flags;
+  int32_t i;
+  pcb_t* p;
+
+  cli_and_save(flags);
+  for (i = 0; i < MAX_PROCESS_NUM; i++) {
+    if (!pid_arr[i]) continue;
+    p = PCB_ADDR(i);
+    if (p->kthread || p->state == PROC_ZOMBIE || p->exiting || p->mm_pid != proc->mm_pid) continue;
+    p->killed = 1;
+    ipc_cancel(p);
+    sleep_cancel(p);
+    smp_kick(&cpus[p->cpu]);
+  }
+  restore_flags(flags);
+}
+
+/*
+ * proc_kill_term
+ *   DESCRIPTION: Ctrl+C. Kills the foreground job of a terminal: every
+ *                process on it except the root shell that has no live
+ *                child of its own outside its address space, so a shell
+ *                waiting on a pipeline stays and the pipeline goes. Blocked
+ *                processes are killed too, wherever they run.
+ *   INPUTS: term - terminal
+ *   RETURN VALUE: none
+ * SIDE EFFECT: may send reschedule IPIs
+ */
+void proc_kill_term(int32_t term)
 {
-  int cur_pcb_pos = (cur_term+1) * pid_active[cur_term];
-  pcb = (pcb_t*) (8*MB - (8*KB * (cur_pcb_pos + 1)));
+  uint32_t flags;
+  int32_t i, j;
+  pcb_t* p;
+  pcb_t* c;
+
+  cli_and_save(flags);
+  for (i = 0; i < MAX_PROCESS_NUM; i++) {
+    if (!pid_arr[i] || i == root_pid[term]) continue;
+    p = PCB_ADDR(i);
+    if (p->kthread || p->state == PROC_ZOMBIE || p->exiting || p->term != term) continue;
+    for (j = 0; j < MAX_PROCESS_NUM; j++) {
+      if (!pid_arr[j]) continue;
+      c = PCB_ADDR(j);
+      if (c->parent_pid == i && c->state != PROC_ZOMBIE && c->mm_pid != p->mm_pid) break;
+    }
+    if (j == MAX_PROCESS_NUM) proc_kill(p);
+  }
+  restore_flags(flags);
 }
 
 /*
- * get_old_pcb
- *   DESCRIPTION: gets the old pcb
+ * proc_check_killed
+ *   DESCRIPTION: halts the current process if its thread group is exiting
+ *                and it is not halting already. Called on the way out of
+ *                every system call.
  *   INPUTS: none
- *   RETURN VALUE: pcb pointer to old pcb
- * SIDE EFFECT: none
+ *   RETURN VALUE: none, does not return if killed
  */
-pcb_t* get_old_pcb()
+void proc_check_killed()
 {
-  int old_pcb_pos = (cur_term+1) * pid_old[cur_term];
-  return((pcb_t*) (8*MB - (8*KB * (old_pcb_pos + 1))));
+  if (pcb && pcb->killed && !pcb->exiting) sys_call_halt(0);
+}
+
+/*
+ * sys_call_clone
+ *   DESCRIPTION: starts a thread in the caller's address space. It gets
+ *                its own pid, kernel stack and copies of the caller's fds,
+ *                and begins at entry on the given user stack as if called
+ *                with arg. It returns by calling halt, and the caller can
+ *                wait for it like a child. It runs on the CPU after the
+ *                last thread's so a group spreads over every CPU.
+ *   INPUTS: entry - user address to start at
+ *           arg - argument pushed for entry
+ *           stack - top of the thread's user stack, 4 byte aligned
+ *   RETURN VALUE: pid of the thread, -1 on fail
+ */
+int32_t sys_call_clone(uint32_t entry, uint32_t arg, uint32_t stack){
+  uint32_t* sp;
+  pcb_t* thread;
+  pcb_t* leader = mm_pcb(pcb);
+  int32_t pid, i;
+
+  if (entry < 128*MB || entry >= 132*MB) return -1;
+  if (stack < 128*MB + 8 || stack > 132*MB || (stack & 3)) return -1;
+  if (leader->killed) return -1;
+
+  pid = pid_alloc();
+  if (pid < 0) return -1;
+  thread = PCB_ADDR(pid);
+  pcb_init(thread, pid, pcb->term);
+  thread->mm_pid = leader->pid;
+  thread->parent_pid = pcb->pid;
+  thread->cpu = (leader->cpu + leader->nthreads + 1) % num_cpus;
+  leader->nthreads++;
+
+  for (i = 0; i < 8; i++) {
+    thread->file_array[i] = pcb->file_array[i];
+    if (thread->file_array[i].flags == USED && thread->file_array[i].jump_table_ptr->dup)
+      thread->file_array[i].jump_table_ptr->dup(thread->file_array[i].inode);
+  }
+  strncpy((int8_t*)thread->arguments, (int8_t*)pcb->arguments, BUFFER_LIM);
+
+  // entry's argument and a return address it must not use
+  ((uint32_t*)stack)[-1] = arg;
+  ((uint32_t*)stack)[-2] = 0;
+
+  sp = (uint32_t*)KSTACK_TOP(pid);
+  //IRET frame to the entry point
+  *--sp = USER_DS;
+  *--sp = stack - 8;
+  *--sp = 0x202;                  // IF set
+  *--sp = USER_CS;
+  *--sp = entry;
+  //what switch_to pops: return address, ebp, ebx, esi, edi, eflags
+  *--sp = (uint32_t)proc_first_run;
+  *--sp = 0;
+  *--sp = 0;
+  *--sp = 0;
+  *--sp = 0;
+  *--sp = 0x002;                  // IF clear until the IRET
+  thread->stack_ptr = (uint32_t)sp;
+
+  sched_enqueue(thread);
+  return pid;
 }
 
+/*
+ * sys_call_isatty
+ *   DESCRIPTION: tells if an fd is the terminal
+ *   INPUTS: fd - file descriptor
+ *   RETURN VALUE: 1 if terminal, 0 if not, -1 on bad fd
+ */
+int32_t sys_call_isatty(int32_t fd){
+  if (fd < 0 || fd > MAX_INDEX || pcb->file_array[fd].flags == UNUSED) return -1;
+  return pcb->file_array[fd].jump_table_ptr == &term_fn;
+}
 
+/*
+ * sys_call_ioctl
+ *   DESCRIPTION: passes a device specific command to an fd's driver
+ *   INPUTS: fd - file descriptor
+ *           cmd - command, meaning depends on the driver
+ *           arg - command argument
+ *   RETURN VALUE: driver's return value, -1 on bad fd or if the driver
+ *                 takes no commands
+ */
+int32_t sys_call_ioctl(int32_t fd, int32_t cmd, void* arg){
+  if (fd < 0 || fd > MAX_INDEX || pcb->file_array[fd].flags == UNUSED) return -1;
+  if (pcb->file_array[fd].jump_table_ptr->ioctl == NULL) return -1;
+  return pcb->file_array[fd].jump_table_ptr->ioctl(fd, cmd, arg);
+}
 
 /*
  * sys_call_read
@@ -490,26 +944,54 @@ int32_t sys_call_getargs(uint8_t* buf, int32_t nbytes){
 
 /*
  * sys_call_vidmap
- *   DESCRIPTION: maps the text-mode video memory into user space at a pre-set
-                  virtual address
+ *   DESCRIPTION: maps the caller's terminal page of VGA memory into user
+                  space at a pre-set virtual address. Every terminal has its
+                  own page and Alt+Fn only moves the CRTC start to it, so a
+                  program on a background terminal draws off screen and
+                  shows up as soon as its terminal is switched to
  *   INPUTS: screen_start - address to map memory onto
  *   RETURN VALUE: returns address, -1 on fail
  */
 int32_t sys_call_vidmap(uint8_t** screen_start){
   uint32_t address; // virtual address that screen_start points to
+  pcb_t* mm; // owner of the address space
   // fail cases
   if (screen_start == NULL) return -1; // if screen_start doesn't exist fail
   address = (uint32_t) screen_start;
   if (address < 128*MB || 132*MB < address) return -1; // if out of bounds fail
 
-  // change paging
-  map_page_vidmap();
+  // keep the window where the program draws until it exits
+  mm = mm_pcb(pcb);
+  if (!mm->vidmapped) {
+    mm->vidmapped = 1;
+    terminals[pcb->term].term_mapped++;
+  }
+  // change paging of the calling process only, to its own terminal's page
+  // with the window moved to the start of it
+  term_home(&terminals[pcb->term]);
+  map_page_vidmap(mm->pid, (uint32_t)terminals[pcb->term].term_video);
 
   // set screen_start to be at 136MB
   *screen_start = (uint8_t*) (132*MB);
   return (132*MB);
 }
 
+/*
+ * sys_call_put_cells
+ *   DESCRIPTION: stores an array of (row, col, char, attribute) cells into
+ *                the caller's terminal window in one kernel entry, without
+ *                moving the cursor or scrolling
+ *   INPUTS: cells - array of cell_update_t
+ *           n - number of cells
+ *   RETURN VALUE: number of cells stored, -1 on a bad array
+ */
+int32_t sys_call_put_cells(const void* cells, int32_t n){
+  uint32_t address = (uint32_t) cells;
+  if (n < 0 || n > (int32_t) (4*MB / sizeof(cell_update_t))) return -1;
+  if (address < 128*MB || address > 132*MB - n * sizeof(cell_update_t)) return -1;
+  return term_put_cells(&terminals[pcb->term], (const cell_update_t*) cells, n);
+}
+
 /*
  * sys_call_set_handler
  *   DESCRIPTION: UNUSED, RETURNS -1
@@ -526,6 +1008,17 @@ int32_t sys_call_sigreturn(void){
     return -1;
 }
 
+/*
+ * ready_in
+ *   DESCRIPTION: readiness of files and directories, reads never block
+ *   INPUTS: fd - unused
+ *   RETURN VALUE: POLLIN
+ */
+static int32_t ready_in(int32_t fd)
+{
+  return POLLIN;
+}
+
 /*
  * sys_call_sigreturn
  *   DESCRIPTION: RETURNS -1
@@ -10,6 +10,8 @@
 #define MAX_FILE_SIZE 100000
 
 #define PROG_IMG_ADDR 0x08048000
+// initial user esp, the bottom of the 4MB page holding the image
+#define USER_ESP 0x83FFFF0
 
 #define KB 1024
 #define MB 0x100000
@@ -18,6 +20,52 @@
 #define UNUSED 0
 #define USED 1
 
+// total number of process slots, each owns a 4MB page, a kernel stack and
+// a page directory
+#define MAX_PROCESS_NUM 24
+// parent pid of a terminal's root shell
+#define NO_PID 0xFF
+
+// pcb sits at the bottom of the pid's 8KB kernel stack
+#define PCB_ADDR(pid) ((pcb_t*) (8*MB - (8*KB * ((pid) + 1))))
+// top of the pid's kernel stack, loaded into tss.esp0
+#define KSTACK_TOP(pid) (8*MB - 8*KB * (pid) - 4)
+
+// pcb of the process owning proc's address space: proc itself, or the
+// leader of its thread group. Shared memory and vidmap state live there
+#define mm_pcb(proc) PCB_ADDR((proc)->mm_pid)
+
+// registers the sys_call stub saved for a process that entered from user
+// mode: the IRET frame and pushal sit right under its esp0
+#define USER_REGS(pid) ((regs_t*) (KSTACK_TOP(pid) - 52))
+
+// bytes an IPC message can carry besides its two register words
+#define IPC_MAX_BUF 256
+
+// shared memory segments a process can hold open / have mapped at once
+#define MAX_SHM_HANDLES 4
+#define MAX_SHM_MAPS 4
+
+// one-shot timers a process can have armed at once
+#define MAX_USER_TIMERS 8
+
+
+// process states
+#define PROC_RUNNABLE 0
+#define PROC_BLOCKED 1
+#define PROC_ZOMBIE 2
+
+// order pushal leaves the registers in
+typedef struct regs_t {
+  uint32_t edi;
+  uint32_t esi;
+  uint32_t ebp;
+  uint32_t esp;
+  uint32_t ebx;
+  uint32_t edx;
+  uint32_t ecx;
+  uint32_t eax;
+} regs_t;
 
 //jump table for file open/close/r/w functions
 typedef struct file_jump_table_t {
@@ -26,8 +74,42 @@ typedef struct file_jump_table_t {
   int32_t (*close)(int32_t fd);
   int32_t (*read)(int32_t fd, void* buf, int32_t nbytes);
   int32_t (*write)(int32_t fd, const void* buf, int32_t nbytes);
+  //optional, called when an fd is copied into a child by spawn
+  void (*dup)(uint32_t inode);
+  //readiness query for poll, returns POLLIN / POLLOUT bits
+  int32_t (*ready)(int32_t fd);
+  //optional, called by poll before it checks for POLLIN
+  void (*poll_arm)(int32_t fd);
+  //optional, device specific commands from the ioctl system call
+  int32_t (*ioctl)(int32_t fd, int32_t cmd, void* arg);
 } file_jump_table_t;
 
+struct pcb_t;
+
+//list of processes blocked on the same event
+typedef struct wait_queue_t {
+  struct pcb_t* head;
+} wait_queue_t;
+
+// kernel timer, runs fn(data) from the timer bottom half once jiffies
+// reaches expires (see timer.c)
+typedef struct ktimer_t {
+  //neighbours in a wheel slot, next is NULL while not pending
+  struct ktimer_t* next;
+  struct ktimer_t* prev;
+  uint32_t expires;
+  void (*fn)(uint32_t data);
+  uint32_t data;
+} ktimer_t;
+
+// one shared memory segment mapped into a process
+typedef struct shm_map_t {
+  //segment index, -1 if slot unused
+  int32_t id;
+  //user virtual address of first page
+  uint32_t vaddr;
+} shm_map_t;
+
 // Appendix A 8.2 File System Abstractions - 4 bytes each
 typedef struct fd_t {
   //holds pointer to jump table
@@ -40,12 +122,43 @@ typedef struct fd_t {
   uint32_t flags;
 } fd_t;
 
-//DO NOT EDIT THE ORDER OF THE FIRST 2 OR U WILL MESS UP SOME ASM CODE
+//process control block, lives at the bottom of the process's kernel stack
 typedef struct pcb_t {
-  //stores the stack ptr
+  //stores the kernel stack ptr while switched out (see switch_to)
   uint32_t stack_ptr;
-  //stores the base ptr
-  uint32_t base_ptr;
+  //next process in the run queue or a wait queue
+  struct pcb_t* next;
+  //PROC_RUNNABLE, PROC_BLOCKED or PROC_ZOMBIE
+  uint8_t state;
+  //wait queue a blocked process is on, so proc_kill can take it off
+  struct wait_queue_t* sleep_wq;
+  //terminal the process reads from and writes to
+  uint8_t term;
+  //CPU the process runs on, picked by its terminal
+  uint8_t cpu;
+  //set for a kernel thread: no user address space and never in user mode
+  uint8_t kthread;
+  //pid whose page directory and 4MB page the process runs in: its own,
+  //or the thread group leader's for a thread started by clone
+  uint8_t mm_pid;
+  //leader only: threads still running in its address space
+  uint8_t nthreads;
+  //set once the thread group is exiting, halts on its way out of the kernel
+  uint8_t killed;
+  //set once the process is in halt, so killed does not halt it again
+  uint8_t exiting;
+  //user address the process is blocked on in futex_wait, 0 if none
+  uint32_t futex_addr;
+  //a leader sleeps here in halt until its threads are gone
+  wait_queue_t thread_wq;
+  //set once the process has its terminal's page vidmapped
+  uint8_t vidmapped;
+  //vidmap_back frames: the back buffer then the last flipped frame, 0 if none
+  uint32_t vidbuf;
+  //status passed to halt, collected by wait
+  int32_t exit_status;
+  //parent sleeps here in wait until a child halts
+  wait_queue_t child_wq;
   // process id of parent
   uint8_t parent_pid;
   //file array holds files for pcb
@@ -56,21 +169,72 @@ typedef struct pcb_t {
   uint8_t pid;
   // argument buffer
   uint8_t arguments[BUFFER_LIM];
+  // shared memory segments opened by this process, -1 if unused
+  int32_t shm_handles[MAX_SHM_HANDLES];
+  // shared memory segments mapped into this process
+  shm_map_t shm_maps[MAX_SHM_MAPS];
+  // IPC_* state of a send/recv/call in progress
+  uint8_t ipc_state;
+  // pid to send to, pid accepted by recv (-1 any) or pid the message came from
+  int32_t ipc_peer;
+  // bytes in ipc_buf
+  int32_t ipc_len;
+  // set when the peer halted before the transfer
+  int32_t ipc_err;
+  // the process sleeps here while in recv or waiting for a reply
+  wait_queue_t ipc_wq;
+  // senders blocked until this process receives
+  wait_queue_t ipc_senders;
+  // incoming message body, or the outgoing one while queued as a sender
+  uint8_t ipc_buf[IPC_MAX_BUF];
+  // one-shot timers armed with timer_arm
+  ktimer_t utimers[MAX_USER_TIMERS];
+  // bit i set once timer i fired, cleared by timer_wait
+  uint32_t utimer_fired;
+  // the process sleeps here in timer_wait
+  wait_queue_t utimer_wq;
+  // set once admitted to the EDF class by an RTC write with a budget
+  uint8_t rt;
+  // set when the current job used up its budget, it runs best effort
+  // until its next release
+  uint8_t rt_throttled;
+  // ns per period and per job, and budget/period in 1/RT_UTIL_SCALE
+  uint32_t rt_period;
+  uint32_t rt_budget;
+  uint32_t rt_util;
+  // ktime_ns deadline of the current job
+  uint64_t rt_deadline;
+  // ns the current job has run, and when it last went on the CPU
+  uint32_t rt_used;
+  uint64_t rt_since;
+  // jobs that finished after their deadline
+  uint32_t rt_misses;
+  // fires when the running job's budget runs out
+  ktimer_t rt_timer;
 } pcb_t;
 
 
-// keeps track of current pcb
-pcb_t* pcb;
-
-//get current pcb
-pcb_t* get_cur_pcb();
-//get old pcb
-pcb_t* get_old_pcb();
-
-void set_pcb();
+// keeps track of current pcb, NULL while the idle loop runs. Every CPU
+// has its own (see smp.c)
+#define pcb (*cpu_pcb())
+pcb_t** cpu_pcb();
 
-//switch back to old terminal
-void switch_term_back();
+//start a root shell on a terminal
+int32_t start_shell(int term);
+//start a root shell on a terminal from a worker thread
+void queue_shell(int term);
+//sets up deferred process work and queues every slot for pre-zeroing
+void proc_init();
+//start a kernel thread running fn(data) on a CPU
+int32_t kthread_create(void (*fn)(uint32_t data), uint32_t data, int32_t cpu);
+//marks a process and every thread sharing its address space for exit
+void proc_kill(pcb_t* proc);
+//kills the foreground job of a terminal, for Ctrl+C
+void proc_kill_term(int32_t term);
+//halts the current process if its thread group is exiting
+void proc_check_killed();
+//tells if a pid is a live (not halted) process
+int32_t proc_alive(int32_t pid);
 
 
 //sys call functions
@@ -84,6 +248,12 @@ int32_t sys_call_getargs(uint8_t* buf, int32_t nbytes);
 int32_t sys_call_vidmap(uint8_t** screen_start);
 int32_t sys_call_set_handler(int32_t signum, void* handler_address);
 int32_t sys_call_sigreturn(void);
+int32_t sys_call_spawn(const uint8_t* command, int32_t in_fd, int32_t out_fd);
+int32_t sys_call_clone(uint32_t entry, uint32_t arg, uint32_t stack);
+int32_t sys_call_wait(int32_t pid);
+int32_t sys_call_isatty(int32_t fd);
+int32_t sys_call_ioctl(int32_t fd, int32_t cmd, void* arg);
+int32_t sys_call_put_cells(const void* cells, int32_t n);
 int32_t retfail();
 
 #endif //_SYSCALLS_H
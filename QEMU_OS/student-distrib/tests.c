@@ -6,6 +6,9 @@
 #include "syscalls.h"
 
 #include "rtc.h"
+#include "bh.h"
+#include "timer.h"
+#include "apic.h"
 
 #define PASS 1
 #define FAIL 0
@@ -392,6 +395,149 @@ void testprint(){
 
 
 /* Checkpoint 4 tests */
+
+/* terminal write benchmark
+ *
+ * Prints the large text file BENCH_PASSES times char by char through putc
+ * and then through terminal_write, and reports chars/sec of each. Time is
+ * measured with the TSC clock.
+ * Inputs: None
+ * Outputs: chars/sec of both paths
+ * Side Effects: Clobbers the screen
+ * Files: keyboard.c, timer.c
+ */
+#define BENCH_PASSES 20
+void terminal_write_bench(){
+	uint8_t buf[6000];
+	int32_t length, i, pass;
+	uint64_t start;
+	uint32_t putc_us, write_us;
+	int8_t* targetFile = "verylargetextwithverylongname.tx";
+
+	length = file_read((int32_t)targetFile, buf, 6000);
+	if(length <= 0){
+		printf("could not read %s\n", targetFile);
+		return;
+	}
+
+	/* old path: one putc per char */
+	start = ktime_ns();
+	for(pass = 0; pass < BENCH_PASSES; pass++){
+		for(i = 0; i < length; i++){
+			if(buf[i] != NULL) putc(buf[i]);
+		}
+	}
+	putc_us = fmax(div64(ktime_ns() - start, 1000, NULL), 1);
+
+	/* batched path */
+	start = ktime_ns();
+	for(pass = 0; pass < BENCH_PASSES; pass++){
+		terminal_write(1, buf, length);
+	}
+	write_us = fmax(div64(ktime_ns() - start, 1000, NULL), 1);
+
+	clear_and_reset();
+	printf("cat %s x%d (%d chars)\n", targetFile, BENCH_PASSES, length * BENCH_PASSES);
+	printf("putc:           %d chars/sec\n", (uint32_t)div64((uint64_t)length * BENCH_PASSES * 1000000, putc_us, NULL));
+	printf("terminal_write: %d chars/sec\n", (uint32_t)div64((uint64_t)length * BENCH_PASSES * 1000000, write_us, NULL));
+}
+
+/* interrupts-disabled time report
+ *
+ * Prints the longest time the keyboard and RTC irqs kept interrupts off,
+ * from the stub's cli until bottom halves start. Type and let the RTC run
+ * for a while first.
+ * Inputs: None
+ * Outputs: cycles per irq
+ * Side Effects: None
+ * Files: bh.c, Linkage.S
+ */
+void irq_off_report(){
+	TEST_HEADER;
+	printf("kbd irq: max %d cycles with interrupts off\n", irq_off_max[KBD_IRQ]);
+	printf("rtc irq: max %d cycles with interrupts off\n", irq_off_max[RTC_IRQ]);
+}
+
+/* idle interrupt rate report
+ *
+ * Halts for a second with nothing to do and prints how many interrupts
+ * each line took. With one-shot timers and no RTC fd open only irq 0
+ * should show up, about TIMER_HZ / PIT_MAX_JIFFIES times, or about
+ * TIMER_HZ / TVR_SIZE with the APIC timer.
+ * Inputs: None
+ * Outputs: interrupts per second per irq
+ * Side Effects: None
+ * Files: timer.c, rtc.c, bh.c
+ */
+void idle_irq_report(){
+	TEST_HEADER;
+	uint32_t before[NUM_IRQS];
+	uint64_t start;
+	int32_t i;
+
+	for (i = 0; i < NUM_IRQS; i++) before[i] = irq_count[i];
+	start = ktime_ns();
+	while (ktime_ns() - start < 1000000000) asm volatile("sti; hlt; cli");
+	sti();
+	for (i = 0; i < NUM_IRQS; i++) {
+		if (irq_count[i] != before[i]) printf("irq %d: %d/sec\n", i, irq_count[i] - before[i]);
+	}
+}
+
+/* interrupt controller latency report
+ *
+ * For each irq taken so far, the average and worst cycles from the stub's
+ * cli until bottom halves start; that span holds the EOI, one MMIO write
+ * on the APIC against one or two port writes on the 8259. Then how late
+ * timer interrupts came after the time they were armed for. Build once
+ * with USE_APIC 0 in apic.h and run the same load to compare.
+ * Inputs: None
+ * Outputs: cycles per irq, timer lateness in ns
+ * Side Effects: None
+ * Files: apic.c, i8259.c, timer.c, bh.c
+ */
+void irq_latency_report(){
+	TEST_HEADER;
+	int32_t i;
+
+	printf("controller: %s\n", apic_active ? "local APIC + IOAPIC" : "8259");
+	for (i = 0; i < NUM_IRQS; i++) {
+		if (!irq_count[i]) continue;
+		printf("irq %d: %d taken, avg %d max %d cycles\n", i, irq_count[i],
+			(uint32_t)div64(irq_off_total[i], irq_count[i], NULL), irq_off_max[i]);
+	}
+	if (timer_late_count) {
+		printf("timer: avg %d max %d ns late\n",
+			(uint32_t)div64(timer_late_total, timer_late_count, NULL), timer_late_max);
+	}
+}
+
+/* RTC latency report
+ *
+ * Opens the RTC at 1024Hz and holds the keyboard for five seconds; type
+ * fast meanwhile. Prints the worst time from the RTC raising its irq to
+ * rtc_IH, and from rtc_IH to the RTC bottom half, which keyboard echo no
+ * longer holds up now that the RTC bottom half outranks it.
+ * Inputs: None
+ * Outputs: ns late
+ * Side Effects: None
+ * Files: rtc.c, bh.c
+ */
+void rtc_latency_report(){
+	TEST_HEADER;
+	int32_t freq = 1024;
+	uint64_t start;
+
+	open((uint8_t*)"rtc");
+	write(0, &freq, 4);
+	start = ktime_ns();
+	while (ktime_ns() - start < 5000000000ULL) asm volatile("sti; hlt; cli");
+	sti();
+	close(0);
+	printf("rtc irq to rtc_IH: max %d ns, %d lost\n", rtc_late_max, rtc_missed);
+	printf("rtc_IH to bottom half: max %d ns\n", rtc_bh_late_max);
+}
+
 /* Checkpoint 5 tests */
 
 
@@ -413,6 +559,11 @@ void launch_tests(){
 	// print_smalltxtfile();
 	// print_largetxtfile();
 	// print_exefile();
+	// terminal_write_bench();
+	// irq_off_report();
+	// idle_irq_report();
+	// irq_latency_report();
+	// rtc_latency_report();
 
 	/* RTC TESTS */
 	// rtc_open();
@@ -0,0 +1,579 @@
+// timer.c - PIT tick, TSC clock and kernel timer wheel
+//
+// Time is kept by the TSC; a jiffy is NS_PER_JIFFY of it. Nothing ticks.
+// The PIT, or the local APIC timer when the APIC delivers interrupts, is a
+// one-shot armed for the nearest pending deadline, so an idle system with
+// no timers due only wakes every PIT_MAX_JIFFIES, or every tv1 wrap with
+// the APIC timer's 32-bit count. Its top half
+// brings jiffies up to date; the bottom half runs the timers that are due.
+// Timers sit in a hierarchical wheel: tv1 has one slot per jiffy for the
+// next TVR_SIZE jiffies, and each level of tvn has slots TVN_SIZE times
+// coarser than the level below. add_timer and del_timer are O(1) list
+// operations. Running the wheel looks at one tv1 slot per jiffy passed.
+// Every TVR_SIZE jiffies one slot of the next level is cascaded down, so a
+// timer is moved at most TVN_LEVELS times before it fires.
+#include "timer.h"
+#include "i8259.h"
+#include "lib.h"
+#include "sched.h"
+#include "bh.h"
+#include "apic.h"
+
+volatile uint32_t jiffies;
+uint32_t tsc_khz;
+uint32_t timer_late_max;
+uint64_t timer_late_total;
+uint32_t timer_late_count;
+
+// TSC value ktime_ns counts from, and its ns per cycle << TSC_SHIFT
+static uint64_t tsc_base;
+static uint32_t tsc_mult;
+
+// jiffy the wheel has been run up to, trails jiffies until the bottom half
+static uint32_t timer_jiffies;
+// jiffy the PIT is armed to interrupt at, and the clock time it will
+static uint32_t timer_next;
+static uint64_t timer_due;
+// slot list heads; a head links to itself when the slot is empty
+static ktimer_t tv1[TVR_SIZE];
+static ktimer_t tvn[TVN_LEVELS][TVN_SIZE];
+
+static void timer_bh();
+
+/*
+ * list_init
+ *   DESCRIPTION: empties a slot
+ *   INPUTS: head - slot list head
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void list_init(ktimer_t* head)
+{
+  head->next = head;
+  head->prev = head;
+}
+
+/*
+ * internal_add
+ *   DESCRIPTION: puts a timer in the slot its expiry falls in relative to
+ *                timer_jiffies. Call with interrupts off.
+ *   INPUTS: timer - timer with expires set
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: links the timer into the wheel
+ */
+static void internal_add(ktimer_t* timer)
+{
+  uint32_t idx = timer->expires - timer_jiffies;
+  ktimer_t* head;
+  int32_t lvl;
+
+  // already due: the slot the next tick runs
+  if ((int32_t) idx < 0) {
+    head = &tv1[timer_jiffies & TVR_MASK];
+  }
+  else if (idx < TVR_SIZE) {
+    head = &tv1[timer->expires & TVR_MASK];
+  }
+  else {
+    // the last level takes everything further out
+    for (lvl = 0; lvl < TVN_LEVELS - 1; lvl++) {
+      if (idx < 1U << (TVR_BITS + (lvl + 1) * TVN_BITS)) break;
+    }
+    head = &tvn[lvl][(timer->expires >> (TVR_BITS + lvl * TVN_BITS)) & TVN_MASK];
+  }
+
+  timer->next = head;
+  timer->prev = head->prev;
+  head->prev->next = timer;
+  head->prev = timer;
+}
+
+/*
+ * cascade
+ *   DESCRIPTION: moves every timer in one slot of a coarse level down to
+ *                the slots it now falls in
+ *   INPUTS: lvl - tvn level
+ *           index - slot in the level
+ *   OUTPUTS: none
+ *   RETURN VALUE: index, 0 means the next level has to cascade too
+ *   SIDE EFFECTS: relinks timers
+ */
+static int32_t cascade(int32_t lvl, int32_t index)
+{
+  ktimer_t* head = &tvn[lvl][index];
+  ktimer_t* timer = head->next;
+  ktimer_t* next;
+
+  list_init(head);
+  while (timer != head) {
+    next = timer->next;
+    internal_add(timer);
+    timer = next;
+  }
+  return index;
+}
+
+/*
+ * next_expiry
+ *   DESCRIPTION: finds the jiffy the PIT has to interrupt at. That is the
+ *                first non-empty tv1 slot, or the next tv1 wrap since the
+ *                cascade there may bring timers down, whichever is sooner,
+ *                and no further than the PIT can count. Call with
+ *                interrupts off.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: jiffy to wake at
+ *   SIDE EFFECTS: none
+ */
+static uint32_t next_expiry()
+{
+  uint32_t j = timer_jiffies;
+  int32_t span = apic_active ? TVR_SIZE : PIT_MAX_JIFFIES;
+  int32_t i;
+
+  for (i = 0; i < span; i++, j++) {
+    if (i && !(j & TVR_MASK)) break;
+    if (tv1[j & TVR_MASK].next != &tv1[j & TVR_MASK]) break;
+  }
+  return j;
+}
+
+/*
+ * timer_program
+ *   DESCRIPTION: arms the PIT or local APIC timer to interrupt once when
+ *                the clock reaches the next expiry. With the APIC it is
+ *                this CPU's timer, whichever CPU this is; a timer armed
+ *                earlier on another CPU for a later expiry just fires
+ *                with nothing due. Call with interrupts off.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: restarts PIT channel 0 or the local APIC timer
+ */
+static void timer_program()
+{
+  uint64_t now = ktime_ns();
+  uint64_t at;
+  // at most TVR_SIZE jiffies ahead, so the difference fits in 32 bits
+  uint32_t ns = 0;
+  uint32_t count;
+
+  timer_next = next_expiry();
+  at = (uint64_t) timer_next * NS_PER_JIFFY;
+  if (at > now) ns = at - now;
+
+  if (apic_active) {
+    lapic_timer_arm(ns);
+    timer_due = now + ns;
+    return;
+  }
+  count = div64((uint64_t) ns * PIT_BASE_HZ, 1000000000, NULL) + 1;
+  count = fmin(fmax(count, PIT_MIN_COUNT), PIT_MAX_COUNT);
+  outb(PIT_MODE_EVENT, PIT_CMD);
+  outb(count & 0xFF, PIT_CH0);
+  outb((count >> 8) & 0xFF, PIT_CH0);
+  timer_due = now + div64((uint64_t) count * 1000000000, PIT_BASE_HZ, NULL);
+}
+
+/*
+ * tsc_calibrate
+ *   DESCRIPTION: counts TSC cycles while PIT channel 2 runs down a
+ *                CALIBRATE_MS one-shot, and sets up ktime_ns from that.
+ *                Call with interrupts off.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: uses PIT channel 2, leaves the speaker as it was
+ */
+static void tsc_calibrate()
+{
+  uint64_t start, end;
+  uint32_t count = PIT_BASE_HZ / (1000 / CALIBRATE_MS);
+  uint8_t gate = inb(PIT_GATE);
+  int32_t spin;
+
+  // gate channel 2 on with the speaker off, then load the count
+  outb((gate & ~0x02) | 0x01, PIT_GATE);
+  outb(PIT_MODE_ONESHOT, PIT_CMD);
+  outb(count & 0xFF, PIT_CH2);
+  outb((count >> 8) & 0xFF, PIT_CH2);
+  rdtsc(start);
+  for (spin = 0; spin < CALIBRATE_SPIN && !(inb(PIT_GATE) & PIT_OUT2); spin++);
+  rdtsc(end);
+  outb(gate, PIT_GATE);
+
+  tsc_khz = fmax((uint32_t) (end - start) / CALIBRATE_MS, 1);
+  tsc_mult = div64((uint64_t) 1000000 << TSC_SHIFT, tsc_khz, NULL);
+  tsc_base = end;
+}
+
+/*
+ * ktime_ns
+ *   DESCRIPTION: monotonic clock, nanoseconds since the TSC was calibrated.
+ *                A multiply and shift instead of a divide, done in two
+ *                halves so the product does not overflow.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: nanoseconds
+ *   SIDE EFFECTS: none
+ */
+uint64_t ktime_ns()
+{
+  uint64_t now;
+  rdtsc(now);
+  now -= tsc_base;
+  return (((uint64_t) (uint32_t) (now >> 32) * tsc_mult) << (32 - TSC_SHIFT))
+       + (((uint64_t) (uint32_t) now * tsc_mult) >> TSC_SHIFT);
+}
+
+/*
+ * jiffies_now
+ *   DESCRIPTION: jiffies only moves on PIT interrupts, which are far apart
+ *                when idle. Anything computing a deadline from it reads
+ *                it through here.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: jiffies since boot
+ *   SIDE EFFECTS: updates jiffies
+ */
+uint32_t jiffies_now()
+{
+  uint32_t flags;
+  uint32_t now;
+  cli_and_save(flags);
+  jiffies = div64(ktime_ns(), NS_PER_JIFFY, NULL);
+  now = jiffies;
+  restore_flags(flags);
+  return now;
+}
+
+/*
+ * timer_init
+ *   DESCRIPTION: empties the wheel, calibrates the TSC and arms PIT
+ *                channel 0, or the local APIC timer, as a one-shot. Call
+ *                after apic_init.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: enables the PIT irq when the 8259 is in use
+ */
+void timer_init()
+{
+  int32_t i, lvl;
+
+  jiffies = 0;
+  timer_jiffies = 0;
+  for (i = 0; i < TVR_SIZE; i++) list_init(&tv1[i]);
+  for (lvl = 0; lvl < TVN_LEVELS; lvl++) {
+    for (i = 0; i < TVN_SIZE; i++) list_init(&tvn[lvl][i]);
+  }
+
+  // due timers run with interrupts on
+  bh_register(BH_TIMER, timer_bh);
+
+  tsc_calibrate();
+
+  if (apic_active) lapic_timer_init();
+  timer_program();
+  if (!apic_active) enable_irq(PIT_IRQ);
+}
+
+/*
+ * timer_IH
+ *   DESCRIPTION: top half of the PIT interrupt
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates jiffies, records how late the interrupt came and
+ *                 raises the timer bottom half
+ */
+void timer_IH()
+{
+  uint64_t now = ktime_ns();
+  uint32_t late;
+
+  send_eoi(PIT_IRQ);
+  jiffies = div64(now, NS_PER_JIFFY, NULL);
+  if (now > timer_due) {
+    late = now - timer_due;
+    if (late > timer_late_max) timer_late_max = late;
+    timer_late_total += late;
+    timer_late_count++;
+  }
+  bh_raise(BH_TIMER);
+}
+
+/*
+ * timer_bh
+ *   DESCRIPTION: bottom half of the PIT interrupt. Runs the wheel up to
+ *                jiffies, calling each due timer once, then arms the PIT
+ *                for the next expiry. A timer function may add or delete
+ *                timers, itself included.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: runs timer functions
+ */
+static void timer_bh()
+{
+  uint32_t flags;
+  int32_t index, lvl;
+  ktimer_t work;
+  ktimer_t* timer;
+  void (*fn)(uint32_t data);
+  uint32_t data;
+
+  cli_and_save(flags);
+  while ((int32_t) (jiffies - timer_jiffies) >= 0) {
+    index = timer_jiffies & TVR_MASK;
+    // tv1 wrapped: refill it from the next level, and so on up
+    for (lvl = 0; !index && lvl < TVN_LEVELS; lvl++) {
+      index = cascade(lvl, (timer_jiffies >> (TVR_BITS + lvl * TVN_BITS)) & TVN_MASK);
+    }
+    index = timer_jiffies & TVR_MASK;
+    timer_jiffies++;
+
+    // take the whole slot so timers re-added by fn wait for their own slot
+    if (tv1[index].next == &tv1[index]) continue;
+    work.next = tv1[index].next;
+    work.prev = tv1[index].prev;
+    work.next->prev = &work;
+    work.prev->next = &work;
+    list_init(&tv1[index]);
+
+    while (work.next != &work) {
+      timer = work.next;
+      work.next = timer->next;
+      timer->next->prev = &work;
+      timer->next = NULL;
+      fn = timer->fn;
+      data = timer->data;
+      restore_flags(flags);
+      fn(data);
+      cli_and_save(flags);
+    }
+  }
+  timer_program();
+  restore_flags(flags);
+}
+
+/*
+ * timer_setup
+ *   DESCRIPTION: sets what a timer does when it fires
+ *   INPUTS: timer - timer, must not be pending
+ *           fn - function to run from the timer bottom half
+ *           data - argument for fn
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void timer_setup(ktimer_t* timer, void (*fn)(uint32_t data), uint32_t data)
+{
+  timer->next = NULL;
+  timer->prev = NULL;
+  timer->fn = fn;
+  timer->data = data;
+}
+
+/*
+ * add_timer
+ *   DESCRIPTION: arms a timer, moving it if it is already pending
+ *   INPUTS: timer - set up timer
+ *           expires - jiffy to fire on
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: links the timer into the wheel, re-arms the PIT if the
+ *                 timer is due before it would interrupt
+ */
+void add_timer(ktimer_t* timer, uint32_t expires)
+{
+  uint32_t flags;
+  cli_and_save(flags);
+  del_timer(timer);
+  timer->expires = expires;
+  internal_add(timer);
+  if ((int32_t) (expires - timer_next) < 0) timer_program();
+  restore_flags(flags);
+}
+
+/*
+ * del_timer
+ *   DESCRIPTION: disarms a timer
+ *   INPUTS: timer - timer
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the timer was pending, 0 if it had fired or was
+ *                 never armed
+ *   SIDE EFFECTS: unlinks the timer from the wheel
+ */
+int32_t del_timer(ktimer_t* timer)
+{
+  uint32_t flags;
+  cli_and_save(flags);
+  if (!timer_pending(timer)) {
+    restore_flags(flags);
+    return 0;
+  }
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->next = NULL;
+  restore_flags(flags);
+  return 1;
+}
+
+/*
+ * timer_wake
+ *   DESCRIPTION: timer function for sleeping until a timer fires
+ *   INPUTS: data - wait queue to wake
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: makes the queue's processes runnable
+ */
+void timer_wake(uint32_t data)
+{
+  wake_up((wait_queue_t*) data);
+}
+
+/*
+ * user_timer_fire
+ *   DESCRIPTION: timer function of a user timer, marks it fired and wakes
+ *                timer_wait
+ *   INPUTS: data - pid * MAX_USER_TIMERS + timer id
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: makes the owner runnable
+ */
+static void user_timer_fire(uint32_t data)
+{
+  pcb_t* proc = PCB_ADDR(data / MAX_USER_TIMERS);
+  proc->utimer_fired |= 1 << (data % MAX_USER_TIMERS);
+  wake_up(&proc->utimer_wq);
+}
+
+/*
+ * timer_release
+ *   DESCRIPTION: disarms the user timers of an exiting process
+ *   INPUTS: proc - exiting process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: unlinks timers from the wheel
+ */
+void timer_release(pcb_t* proc)
+{
+  int32_t i;
+  for (i = 0; i < MAX_USER_TIMERS; i++) del_timer(&proc->utimers[i]);
+}
+
+/*
+ * sys_call_gettime
+ *   DESCRIPTION: reads the monotonic clock. It is the same clock in every
+ *                process, so times can be compared across processes.
+ *   INPUTS: ns - user pointer to 8 bytes
+ *   OUTPUTS: nanoseconds since boot in *ns
+ *   RETURN VALUE: 0, -1 on a bad pointer
+ *   SIDE EFFECTS: none
+ */
+int32_t sys_call_gettime(uint64_t* ns)
+{
+  uint32_t address = (uint32_t) ns;
+  if (address < 128*MB || address > 132*MB - sizeof(uint64_t)) return -1;
+  *ns = ktime_ns();
+  return 0;
+}
+
+/*
+ * sys_call_sleep
+ *   DESCRIPTION: blocks the caller for at least ms milliseconds
+ *   INPUTS: ms - time to sleep
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0, -1 if ms is negative or over TIMER_MAX_MS, or the
+ *                 process is killed
+ *   SIDE EFFECTS: other processes run meanwhile
+ */
+int32_t sys_call_sleep(int32_t ms)
+{
+  uint32_t flags;
+  ktimer_t timer;
+  wait_queue_t wq;
+
+  if (ms < 0 || (uint32_t) ms > TIMER_MAX_MS) return -1;
+  wq.head = NULL;
+  timer_setup(&timer, timer_wake, (uint32_t) &wq);
+
+  cli_and_save(flags);
+  // the extra jiffy covers the part of the current one already gone
+  add_timer(&timer, jiffies_now() + ms_to_jiffies(ms) + 1);
+  while (timer_pending(&timer)) {
+    if (sleep_killed()) {
+      // the timer and queue are on this stack
+      del_timer(&timer);
+      restore_flags(flags);
+      return -1;
+    }
+    sleep_on(&wq);
+  }
+  restore_flags(flags);
+  return 0;
+}
+
+/*
+ * sys_call_timer_arm
+ *   DESCRIPTION: arms one of the caller's one-shot timers to fire ms from
+ *                now, or disarms it. Either way its fired bit is cleared.
+ *   INPUTS: id - timer, 0 to MAX_USER_TIMERS - 1
+ *           ms - delay, 0 to disarm, at most TIMER_MAX_MS
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on a bad id or delay
+ *   SIDE EFFECTS: links or unlinks a timer
+ */
+int32_t sys_call_timer_arm(int32_t id, int32_t ms)
+{
+  uint32_t flags;
+  ktimer_t* timer;
+
+  if (id < 0 || id >= MAX_USER_TIMERS || ms < 0 || (uint32_t) ms > TIMER_MAX_MS) return -1;
+  timer = &pcb->utimers[id];
+
+  cli_and_save(flags);
+  del_timer(timer);
+  pcb->utimer_fired &= ~(1 << id);
+  if (ms > 0) {
+    timer_setup(timer, user_timer_fire, pcb->pid * MAX_USER_TIMERS + id);
+    add_timer(timer, jiffies_now() + ms_to_jiffies(ms) + 1);
+  }
+  restore_flags(flags);
+  return 0;
+}
+
+/*
+ * sys_call_timer_wait
+ *   DESCRIPTION: blocks until at least one of the caller's timers has
+ *                fired, then reports and clears every fired one. Returns
+ *                at once if none has fired and none is armed.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: mask with bit id set for each timer that fired, -1 if
+ *                 the process is killed
+ *   SIDE EFFECTS: may block
+ */
+int32_t sys_call_timer_wait(void)
+{
+  uint32_t flags;
+  int32_t i, armed, fired;
+
+  cli_and_save(flags);
+  while (!pcb->utimer_fired) {
+    for (i = 0, armed = 0; i < MAX_USER_TIMERS; i++) armed |= timer_pending(&pcb->utimers[i]);
+    if (!armed) break;
+    if (sleep_killed()) {
+      restore_flags(flags);
+      return -1;
+    }
+    sleep_on(&pcb->utimer_wq);
+  }
+  fired = pcb->utimer_fired;
+  pcb->utimer_fired = 0;
+  restore_flags(flags);
+  return fired;
+}
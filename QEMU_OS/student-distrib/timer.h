@@ -0,0 +1,95 @@
+// timer.h - declares the PIT tick, the TSC clock and the kernel timer wheel
+
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include "types.h"
+#include "syscalls.h"
+
+#define PIT_IRQ                 0x00
+// PIT input clock, and jiffies per second of the wheel
+#define PIT_BASE_HZ             1193182
+#define TIMER_HZ                1000
+#define NS_PER_JIFFY            (1000000000 / TIMER_HZ)
+// PIT channel 0 and 2 data ports and mode/command port
+#define PIT_CH0                 0x40
+#define PIT_CH2                 0x42
+#define PIT_CMD                 0x43
+// channel 0, lobyte/hibyte, mode 0 (one interrupt when the count runs out)
+#define PIT_MODE_EVENT          0x30
+// channel 2, lobyte/hibyte, mode 0 (OUT goes high when the count runs out)
+#define PIT_MODE_ONESHOT        0xB0
+// port B: bit 0 gates channel 2, bit 1 drives the speaker, bit 5 is OUT2
+#define PIT_GATE                0x61
+#define PIT_OUT2                0x20
+
+// channel 0 counts are 16 bits, so the PIT sleeps PIT_MAX_JIFFIES at most;
+// very short counts are raised so the interrupt is not missed
+#define PIT_MAX_COUNT           0xFFFF
+#define PIT_MIN_COUNT           16
+#define PIT_MAX_JIFFIES         (PIT_MAX_COUNT * TIMER_HZ / PIT_BASE_HZ)
+
+// TSC calibration runs channel 2 for this long
+#define CALIBRATE_MS            10
+// reads of PIT_GATE before calibration stops waiting for OUT2
+#define CALIBRATE_SPIN          1000000
+// ns = cycles * tsc_mult >> TSC_SHIFT
+#define TSC_SHIFT               24
+
+// wheel geometry: a 256 slot first level for the next 256 jiffies, then
+// four 64 slot levels that each cover 64 times the span of the one below
+#define TVR_BITS                8
+#define TVN_BITS                6
+#define TVR_SIZE                (1 << TVR_BITS)
+#define TVN_SIZE                (1 << TVN_BITS)
+#define TVR_MASK                (TVR_SIZE - 1)
+#define TVN_MASK                (TVN_SIZE - 1)
+#define TVN_LEVELS              4
+
+// jiffies covering ms milliseconds, rounded up, for ms up to TIMER_MAX_MS;
+// unsigned so a long delay does not wrap negative and fire at once
+#define ms_to_jiffies(ms)       (((uint32_t)(ms) * TIMER_HZ + 999) / 1000)
+// longest delay ms_to_jiffies converts without overflow, about 71 minutes
+#define TIMER_MAX_MS            ((0xFFFFFFFFU - 999) / TIMER_HZ)
+// set while a timer is waiting to fire
+#define timer_pending(t)        ((t)->next != NULL)
+
+// jiffies since boot as of the last PIT interrupt or jiffies_now
+extern volatile uint32_t jiffies;
+// TSC cycles per millisecond, measured against the PIT at boot
+extern uint32_t tsc_khz;
+// how late timer interrupts arrived after the time they were armed for, in
+// ns: the worst, the sum and how many were measured
+extern uint32_t timer_late_max;
+extern uint64_t timer_late_total;
+extern uint32_t timer_late_count;
+
+// empties the wheel and arms the PIT or APIC timer for the first time
+void timer_init();
+// top half of the PIT interrupt
+void timer_IH();
+// monotonic nanoseconds since timer_init, from the TSC
+uint64_t ktime_ns();
+// brings jiffies up to date with the clock and returns it
+uint32_t jiffies_now();
+// sets a timer's function, not pending until add_timer
+void timer_setup(ktimer_t* timer, void (*fn)(uint32_t data), uint32_t data);
+// arms a timer to fire once jiffies reaches expires, re-arms if pending
+void add_timer(ktimer_t* timer, uint32_t expires);
+// disarms a timer, returns 1 if it was pending
+int32_t del_timer(ktimer_t* timer);
+// timer function that wakes the wait queue data points to
+void timer_wake(uint32_t data);
+// disarms the user timers of an exiting process
+void timer_release(pcb_t* proc);
+
+// copies the monotonic clock in nanoseconds to *ns
+int32_t sys_call_gettime(uint64_t* ns);
+// sleeps for ms milliseconds
+int32_t sys_call_sleep(int32_t ms);
+// arms (ms > 0) or disarms (ms == 0) one-shot user timer id
+int32_t sys_call_timer_arm(int32_t id, int32_t ms);
+// waits for armed user timers, returns the mask of those that fired
+int32_t sys_call_timer_wait(void);
+
+#endif //_TIMER_H
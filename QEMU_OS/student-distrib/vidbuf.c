@@ -0,0 +1,116 @@
+// vidbuf.c - double-buffered vidmap: a program draws into a back buffer
+// in RAM and flip presents it, so no half drawn frame is ever scanned out
+#include "vidbuf.h"
+#include "keyboard.h"
+#include "paging.h"
+#include "lib.h"
+
+// bytes of one text screen, what flip presents
+#define SCREEN_BYTES            (NUM_COLS * NUM_ROWS * 2)
+
+/*
+ * wait_retrace
+ *   DESCRIPTION: spins until the start of the next vertical retrace, or
+ *                until RETRACE_SPIN reads pass without one
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: reads the VGA status register
+ */
+static void wait_retrace()
+{
+  int32_t spin;
+  // a retrace already under way may end mid copy, wait for the next one
+  for (spin = 0; spin < RETRACE_SPIN && (inb(VGA_STATUS) & VGA_VRETRACE); spin++);
+  for (spin = 0; spin < RETRACE_SPIN && !(inb(VGA_STATUS) & VGA_VRETRACE); spin++);
+}
+
+/*
+ * sys_call_vidmap_back
+ *   DESCRIPTION: like vidmap, but what gets mapped is a back buffer in RAM.
+ *                Drawing into it changes nothing on screen until flip. It
+ *                starts as a copy of the terminal's screen. The process
+ *                gets two frames: the back buffer and a copy of the last
+ *                flipped frame that flip compares against.
+ *   INPUTS: screen_start - where to store the user address of the buffer
+ *   RETURN VALUE: the user address, -1 on fail
+ *   SIDE EFFECTS: pins the terminal's window to the top of its page
+ */
+int32_t sys_call_vidmap_back(uint8_t** screen_start)
+{
+  uint32_t address = (uint32_t) screen_start;
+  term_t* t = &terminals[pcb->term];
+  pcb_t* mm = mm_pcb(pcb);
+
+  if (address < 128*MB || address > 132*MB - sizeof(uint8_t*)) return -1;
+  if (!mm->vidbuf && !(mm->vidbuf = alloc_frames(2))) return -1;
+
+  // the window stays where flip draws until the process exits
+  if (!mm->vidmapped) {
+    mm->vidmapped = 1;
+    t->term_mapped++;
+  }
+  term_home(t);
+
+  memcpy((void*) mm->vidbuf, t->term_video, SCREEN_BYTES);
+  memcpy((void*) (mm->vidbuf + FRAME_SIZE), t->term_video, SCREEN_BYTES);
+  map_page_vidmap(mm->pid, mm->vidbuf);
+
+  *screen_start = (uint8_t*) (132*MB);
+  return (132*MB);
+}
+
+/*
+ * sys_call_flip
+ *   DESCRIPTION: presents the back buffer. If the terminal is on screen it
+ *                first waits for vertical retrace. Then only the FLIP_SPAN
+ *                byte spans that changed since the last flip are copied to
+ *                the terminal's page, so VGA sees one write per changed
+ *                span instead of one per cell drawn.
+ *   INPUTS: none
+ *   RETURN VALUE: number of spans copied, -1 without a back buffer
+ *   SIDE EFFECTS: writes to video memory
+ */
+int32_t sys_call_flip(void)
+{
+  uint32_t* back;
+  uint32_t* front;
+  uint32_t* vga;
+  int32_t i, j, spans = 0;
+  term_t* t;
+  pcb_t* mm = mm_pcb(pcb);
+
+  if (!mm->vidbuf) return -1;
+  t = &terminals[pcb->term];
+  back = (uint32_t*) mm->vidbuf;
+  front = (uint32_t*) (mm->vidbuf + FRAME_SIZE);
+  vga = (uint32_t*) t->term_video;
+
+  // background terminals are not scanned out, no need to wait
+  if (t == kbd_term) wait_retrace();
+
+  for (i = 0; i < SCREEN_BYTES / 4; i += FLIP_SPAN / 4) {
+    for (j = 0; j < FLIP_SPAN / 4 && back[i + j] == front[i + j]; j++);
+    if (j == FLIP_SPAN / 4) continue;
+    memcpy(&front[i], &back[i], FLIP_SPAN);
+    memcpy(&vga[i], &back[i], FLIP_SPAN);
+    spans++;
+  }
+  return spans;
+}
+
+/*
+ * vidbuf_release
+ *   DESCRIPTION: gives the back buffer frames of an exiting process back
+ *                to the pool
+ *   INPUTS: proc - exiting process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees frames
+ */
+void vidbuf_release(pcb_t* proc)
+{
+  if (!proc->vidbuf) return;
+  free_frames(proc->vidbuf, 2);
+  proc->vidbuf = 0;
+}
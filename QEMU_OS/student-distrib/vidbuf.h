@@ -0,0 +1,25 @@
+// vidbuf.h - declares double-buffered vidmap: programs draw into a back
+// buffer and flip it onto their terminal's page
+
+#ifndef _VIDBUF_H
+#define _VIDBUF_H
+
+#include "types.h"
+#include "syscalls.h"
+
+// flip compares and copies the screen in spans of this many bytes
+#define FLIP_SPAN               16
+// VGA input status register, bit 3 is set during vertical retrace
+#define VGA_STATUS              0x3DA
+#define VGA_VRETRACE            0x08
+// reads of VGA_STATUS before flip stops waiting for a retrace
+#define RETRACE_SPIN            100000
+
+// maps a back buffer at the vidmap address instead of video memory
+int32_t sys_call_vidmap_back(uint8_t** screen_start);
+// copies the changed parts of the back buffer to the screen at retrace
+int32_t sys_call_flip(void);
+// frees the back buffer of an exiting process
+void vidbuf_release(pcb_t* proc);
+
+#endif //_VIDBUF_H
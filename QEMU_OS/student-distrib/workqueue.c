@@ -0,0 +1,109 @@
+// workqueue.c - deferred work run by per-CPU kernel threads
+//
+// Bottom halves must not sleep and a system call should not do work its
+// caller is not waiting for. Either can hand such work to queue_work
+// instead: every CPU has a worker kernel thread that sleeps until its
+// queue has work and then runs it, oldest first, in process context where
+// it may sleep. Work goes to the worker of the CPU that queued it.
+#include "workqueue.h"
+#include "lib.h"
+#include "sched.h"
+#include "smp.h"
+
+// queued work of each CPU's worker, oldest first
+static work_t* work_head[MAX_CPUS];
+static work_t* work_tail[MAX_CPUS];
+// each worker sleeps here while its queue is empty
+static wait_queue_t work_wq[MAX_CPUS];
+
+/*
+ * worker
+ *   DESCRIPTION: body of a worker thread, runs its CPU's queued work
+ *                forever
+ *   INPUTS: cpu - index of the CPU whose queue it runs
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: runs work functions
+ */
+static void worker(uint32_t cpu)
+{
+  uint32_t flags;
+  work_t* work;
+
+  while (1) {
+    cli_and_save(flags);
+    while (!work_head[cpu]) sleep_on(&work_wq[cpu]);
+    work = work_head[cpu];
+    work_head[cpu] = work->next;
+    if (!work_head[cpu]) work_tail[cpu] = NULL;
+    //it may be queued again from here on, even by its own function
+    work->pending = 0;
+    restore_flags(flags);
+    work->fn(work->data);
+  }
+}
+
+/*
+ * workqueue_init
+ *   DESCRIPTION: starts one worker thread pinned to each CPU. Call after
+ *                smp_init. Work queued before this waits for it.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: takes a process slot per CPU
+ */
+void workqueue_init()
+{
+  int32_t i;
+  for (i = 0; i < num_cpus; i++) {
+    if (kthread_create(worker, i, i) < 0) printf("No slot for worker %d\n", i);
+  }
+}
+
+/*
+ * work_setup
+ *   DESCRIPTION: sets what a work item does when it runs
+ *   INPUTS: work - work item, must not be pending
+ *           fn - function for the worker to run
+ *           data - argument for fn
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void work_setup(work_t* work, void (*fn)(uint32_t data), uint32_t data)
+{
+  work->next = NULL;
+  work->fn = fn;
+  work->data = data;
+  work->pending = 0;
+}
+
+/*
+ * queue_work
+ *   DESCRIPTION: appends work to this CPU's worker queue. Safe to call
+ *                from bottom halves and with interrupts off.
+ *   INPUTS: work - set up work item
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if queued, 0 if it was already waiting to run
+ *   SIDE EFFECTS: wakes the worker
+ */
+int32_t queue_work(work_t* work)
+{
+  uint32_t flags;
+  int32_t cpu;
+
+  cli_and_save(flags);
+  if (work->pending) {
+    restore_flags(flags);
+    return 0;
+  }
+  cpu = cpu_self()->id;
+  work->pending = 1;
+  work->next = NULL;
+  if (work_tail[cpu]) work_tail[cpu]->next = work;
+  else work_head[cpu] = work;
+  work_tail[cpu] = work;
+  wake_up(&work_wq[cpu]);
+  restore_flags(flags);
+  return 1;
+}
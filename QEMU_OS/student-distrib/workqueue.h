@@ -0,0 +1,26 @@
+// workqueue.h - declares deferred work run by per-CPU kernel threads
+
+#ifndef _WORKQUEUE_H
+#define _WORKQUEUE_H
+
+#include "types.h"
+#include "syscalls.h"
+
+// a piece of work for a worker thread, runs fn(data) once per queue_work
+typedef struct work_t {
+  //next in the worker's queue
+  struct work_t* next;
+  void (*fn)(uint32_t data);
+  uint32_t data;
+  //set from queue_work until the worker takes it off the queue
+  uint8_t pending;
+} work_t;
+
+// starts a worker thread on every CPU
+void workqueue_init();
+// sets a work item's function, not pending until queue_work
+void work_setup(work_t* work, void (*fn)(uint32_t data), uint32_t data);
+// hands work to this CPU's worker, returns 0 if it was already pending
+int32_t queue_work(work_t* work);
+
+#endif //_WORKQUEUE_H
@@ -0,0 +1,92 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define SECONDS 2
+#define RUN_US (SECONDS * 1000000)
+#define WIDTH 78
+#define ROW 12
+#define ATTR 0x02
+#define SPRITE '@'
+
+/*
+ * Moves one character back and forth across the screen as fast as it can
+ * for SECONDS each way: first the way pingpong does it, writing the whole
+ * 80 character line (and scrolling) per move, then with put_cells
+ * erasing the old cell and drawing the new one in one call.  Prints the
+ * moves per second of both, timed with gettime.
+ */
+
+/* next sprite column bouncing between 0 and WIDTH - 1 */
+static int32_t
+step (int32_t col, int32_t* dir)
+{
+    if (col + *dir < 0 || col + *dir >= WIDTH)
+        *dir = -*dir;
+    return col + *dir;
+}
+
+static uint32_t
+bench_write (void)
+{
+    uint8_t line[WIDTH + 2];
+    int32_t col = 0, dir = 1, i;
+    uint32_t moves = 0, us;
+    uint64_t start;
+
+    for (i = 0; i < WIDTH; i++)
+        line[i] = ' ';
+    line[WIDTH] = '\n';
+    line[WIDTH + 1] = '\0';
+
+    start = ece391_now_ns ();
+    do {
+        line[col] = ' ';
+        col = step (col, &dir);
+        line[col] = SPRITE;
+        ece391_write (1, line, WIDTH + 1);
+        moves++;
+    } while ((us = ece391_elapsed_us (start)) < RUN_US);
+    return (uint32_t)ece391_div64 ((uint64_t)moves * 1000000, us);
+}
+
+static uint32_t
+bench_cells (void)
+{
+    ece391_cell_t cells[2];
+    int32_t col = 0, dir = 1;
+    uint32_t moves = 0, us;
+    uint64_t start;
+
+    cells[0].row = cells[1].row = ROW;
+    cells[0].ch = ' ';
+    cells[1].ch = SPRITE;
+    cells[0].attr = cells[1].attr = ATTR;
+
+    start = ece391_now_ns ();
+    do {
+        cells[0].col = col;
+        col = step (col, &dir);
+        cells[1].col = col;
+        ece391_put_cells (cells, 2);
+        moves++;
+    } while ((us = ece391_elapsed_us (start)) < RUN_US);
+    return (uint32_t)ece391_div64 ((uint64_t)moves * 1000000, us);
+}
+
+int main ()
+{
+    uint8_t num[16];
+    uint32_t by_write, by_cells;
+
+    by_write = bench_write ();
+    by_cells = bench_cells ();
+
+    ece391_fdputs (1, (uint8_t*)"\nwrite:     ");
+    ece391_fdputs (1, ece391_itoa (by_write, num, 10));
+    ece391_fdputs (1, (uint8_t*)" moves/s\nput_cells: ");
+    ece391_fdputs (1, ece391_itoa (by_cells, num, 10));
+    ece391_fdputs (1, (uint8_t*)" moves/s\n");
+    return 0;
+}
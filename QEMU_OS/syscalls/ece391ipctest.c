@@ -0,0 +1,145 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define ROUNDS 10000
+#define BODY 64
+#define QUIT 0xFFFFFFFF
+
+static uint8_t body[IPC_MAX_BUF];
+
+static inline uint32_t rdtsc_lo (void)
+{
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo;
+}
+
+static void print_num (const char* label, uint32_t value)
+{
+    uint8_t num[16];
+    ece391_fdputs (1, (uint8_t*)label);
+    ece391_fdputs (1, ece391_itoa (value, num, 10));
+    ece391_fdputs (1, (uint8_t*)"\n");
+}
+
+/* Echo every message back to its sender until told to quit. */
+static int32_t ipc_server (void)
+{
+    ipc_msg_t msg;
+    int32_t from;
+
+    while (1) {
+        msg.buf = body;
+        msg.len = 0;
+        if (-1 == (from = ece391_recv (-1, &msg)))
+            return 2;
+        if (QUIT == msg.w0) {
+            msg.len = 0;
+            ece391_reply (from, &msg);
+            return 0;
+        }
+        msg.w1++;
+        if (-1 == ece391_reply (from, &msg))
+            return 2;
+    }
+}
+
+/* Same echo over a pair of pipes, until stdin hits end of file. */
+static int32_t pipe_server (void)
+{
+    uint32_t word;
+
+    while (4 == ece391_read (0, &word, 4)) {
+        word++;
+        if (4 != ece391_write (1, &word, 4))
+            return 2;
+    }
+    return 0;
+}
+
+/* Cycles per round trip of call/reply carrying len body bytes. */
+static uint32_t ipc_round_trips (int32_t server, int32_t len)
+{
+    ipc_msg_t msg;
+    uint32_t i, start;
+
+    start = rdtsc_lo ();
+    for (i = 0; i < ROUNDS; i++) {
+        msg.w0 = 0;
+        msg.w1 = i;
+        msg.buf = body;
+        msg.len = len;
+        if (-1 == ece391_call (server, &msg) || i + 1 != msg.w1)
+            return 0;
+    }
+    return (rdtsc_lo () - start) / ROUNDS;
+}
+
+/* Cycles per round trip of one word through two pipes. */
+static uint32_t pipe_round_trips (void)
+{
+    int32_t to[2], from[2], pid;
+    uint32_t i, word, start, cycles = 0;
+
+    if (-1 == ece391_pipe (to))
+        return 0;
+    if (-1 == ece391_pipe (from)) {
+        ece391_close (to[0]);
+        ece391_close (to[1]);
+        return 0;
+    }
+    pid = ece391_spawn ((uint8_t*)"ipctest pipe", to[0], from[1]);
+    ece391_close (to[0]);
+    ece391_close (from[1]);
+
+    if (-1 != pid) {
+        start = rdtsc_lo ();
+        for (i = 0; i < ROUNDS; i++) {
+            word = i;
+            if (4 != ece391_write (to[1], &word, 4) ||
+                4 != ece391_read (from[0], &word, 4) || i + 1 != word)
+                break;
+        }
+        if (ROUNDS == i)
+            cycles = (rdtsc_lo () - start) / ROUNDS;
+    }
+    ece391_close (to[1]);
+    ece391_close (from[0]);
+    if (-1 != pid)
+        ece391_wait (pid);
+    return cycles;
+}
+
+int main ()
+{
+    uint8_t buf[32];
+    ipc_msg_t msg;
+    int32_t server;
+
+    if (0 == ece391_getargs (buf, 32)) {
+        if (0 == ece391_strcmp (buf, (uint8_t*)"server"))
+            return ipc_server ();
+        if (0 == ece391_strcmp (buf, (uint8_t*)"pipe"))
+            return pipe_server ();
+        ece391_fdputs (1, (uint8_t*)"usage: ipctest\n");
+        return 3;
+    }
+
+    if (-1 == (server = ece391_spawn ((uint8_t*)"ipctest server", 0, 1))) {
+        ece391_fdputs (1, (uint8_t*)"could not start server\n");
+        return 2;
+    }
+
+    print_num ("call/reply cycles per round trip, registers only: ", ipc_round_trips (server, 0));
+    print_num ("call/reply cycles per round trip, 64 byte body: ", ipc_round_trips (server, BODY));
+    print_num ("pipe cycles per round trip, one word: ", pipe_round_trips ());
+
+    msg.w0 = QUIT;
+    msg.buf = body;
+    msg.len = 0;
+    ece391_call (server, &msg);
+    ece391_wait (server);
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define MAX_EVENTS 16
+#define TIMEOUT_MS 2000
+
+/*
+ * Puts the terminal in raw mode and prints every key event as it comes,
+ * or a note after two seconds without keys.  Press q to quit.
+ */
+int main ()
+{
+    ece391_term_mode_t mode;
+    ece391_key_event_t ev[MAX_EVENTS];
+    uint8_t num[16];
+    uint8_t ch[2];
+    int32_t cnt, i, done = 0;
+
+    mode.raw = 1;
+    mode.min = 1;
+    mode.timeout = TIMEOUT_MS;
+    if (-1 == ece391_ioctl (0, TERM_SETMODE, &mode)) {
+        ece391_fdputs (1, (uint8_t*)"could not set raw mode\n");
+        return 2;
+    }
+    ece391_fdputs (1, (uint8_t*)"press keys, q quits\n");
+
+    while (!done) {
+        cnt = ece391_read (0, ev, sizeof (ev));
+        if (-1 == cnt) {
+            ece391_fdputs (1, (uint8_t*)"read failed\n");
+            return 2;
+        }
+        if (0 == cnt) {
+            ece391_fdputs (1, (uint8_t*)"(no keys)\n");
+            continue;
+        }
+        for (i = 0; i < cnt / (int32_t)sizeof (ev[0]); i++) {
+            ece391_fdputs (1, (ev[i].code & KEY_RELEASE) ? (uint8_t*)"up   " : (uint8_t*)"down ");
+            ece391_fdputs (1, ece391_itoa (ev[i].code & ~KEY_RELEASE, num, 16));
+            if (0 != ev[i].ch) {
+                ch[0] = ev[i].ch;
+                ch[1] = '\0';
+                ece391_fdputs (1, (uint8_t*)" '");
+                ece391_fdputs (1, ch);
+                ece391_fdputs (1, (uint8_t*)"'");
+            }
+            if (ev[i].mods & KEY_MOD_SHIFT)
+                ece391_fdputs (1, (uint8_t*)" shift");
+            if (ev[i].mods & KEY_MOD_CTRL)
+                ece391_fdputs (1, (uint8_t*)" ctrl");
+            if (ev[i].mods & KEY_MOD_ALT)
+                ece391_fdputs (1, (uint8_t*)" alt");
+            if (ev[i].mods & KEY_MOD_CAPS)
+                ece391_fdputs (1, (uint8_t*)" caps");
+            ece391_fdputs (1, (uint8_t*)"\n");
+            if ('q' == ev[i].ch && !(ev[i].code & KEY_RELEASE))
+                done = 1;
+        }
+    }
+
+    mode.raw = 0;
+    ece391_ioctl (0, TERM_SETMODE, &mode);
+    return 0;
+}
@@ -21,6 +21,7 @@ int main ()
     int ret_val;
     int garbage;
     int rtc_fd;
+    ece391_rtc_rt_t rt;
     uint8_t buf[BUFMAX];
     
     // Clear buffer
@@ -33,10 +34,14 @@ int main ()
     buf[BUFMAX-3]='|';
     buf[START]='|';
 
-    // Open and set RTC Frequency
+    // Open and set RTC Frequency, asking to run each frame on time with
+    // a 2ms budget and falling back to the plain rate if not admitted
     rtc_fd = ece391_open((uint8_t*)"rtc");
-    ret_val = 32;
-    ret_val = ece391_write(rtc_fd, &ret_val, 4);
+    rt.freq = 32;
+    rt.budget_us = 2000;
+    ret_val = ece391_write(rtc_fd, &rt, sizeof(rt));
+    if (ret_val == -1)
+        ret_val = ece391_write(rtc_fd, &rt.freq, 4);
 
     while(1)
     {
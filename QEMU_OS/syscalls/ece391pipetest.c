@@ -0,0 +1,101 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define ROUNDS 4
+#define BUFSIZE 4096
+#define FNAME "verylargetextwithverylongname.txt"
+
+static uint8_t buf[BUFSIZE];
+
+static inline uint32_t rdtsc_lo (void)
+{
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo;
+}
+
+static void print_num (const char* label, uint32_t value)
+{
+    uint8_t num[16];
+    ece391_fdputs (1, (uint8_t*)label);
+    ece391_fdputs (1, ece391_itoa (value, num, 10));
+    ece391_fdputs (1, (uint8_t*)"\n");
+}
+
+/* Bytes in the input file, read straight from the file system. */
+static int32_t file_bytes (void)
+{
+    int32_t fd, cnt, total = 0;
+
+    if (-1 == (fd = ece391_open ((uint8_t*)FNAME)))
+        return -1;
+    while (0 < (cnt = ece391_read (fd, buf, BUFSIZE)))
+        total += cnt;
+    ece391_close (fd);
+    return total;
+}
+
+/*
+ * Run "cat FNAME | grep x" with grep's output going into a second pipe
+ * that we drain, so the terminal does not slow the measurement down.
+ * Returns the number of bytes grep wrote, or -1.
+ */
+static int32_t run_once (void)
+{
+    int32_t p1[2], p2[2];
+    int32_t cat_pid, grep_pid, cnt, total = 0;
+
+    if (-1 == ece391_pipe (p1))
+        return -1;
+    if (-1 == ece391_pipe (p2)) {
+        ece391_close (p1[0]);
+        ece391_close (p1[1]);
+        return -1;
+    }
+    cat_pid = ece391_spawn ((uint8_t*)"cat " FNAME, 0, p1[1]);
+    grep_pid = ece391_spawn ((uint8_t*)"grep x", p1[0], p2[1]);
+    /* only the children may hold the ends we do not read */
+    ece391_close (p1[0]);
+    ece391_close (p1[1]);
+    ece391_close (p2[1]);
+
+    while (0 < (cnt = ece391_read (p2[0], buf, BUFSIZE)))
+        total += cnt;
+    ece391_close (p2[0]);
+
+    if (-1 == cat_pid || -1 == grep_pid)
+        total = -1;
+    if (-1 != cat_pid)
+        ece391_wait (cat_pid);
+    if (-1 != grep_pid)
+        ece391_wait (grep_pid);
+    return total;
+}
+
+int main ()
+{
+    int32_t in_bytes, out_bytes = 0, r;
+    uint32_t start, cycles;
+
+    if (-1 == (in_bytes = file_bytes ())) {
+        ece391_fdputs (1, (uint8_t*)"file not found\n");
+        return 2;
+    }
+
+    start = rdtsc_lo ();
+    for (r = 0; r < ROUNDS; r++) {
+        if (-1 == (out_bytes = run_once ())) {
+            ece391_fdputs (1, (uint8_t*)"pipeline failed\n");
+            return 2;
+        }
+    }
+    cycles = rdtsc_lo () - start;
+
+    print_num ("input bytes per run: ", in_bytes);
+    print_num ("grep output bytes per run: ", out_bytes);
+    print_num ("cycles per run: ", cycles / ROUNDS);
+    print_num ("pipeline cycles/KB of input: ", cycles / (ROUNDS * in_bytes / 1024 + 1));
+    return 0;
+}
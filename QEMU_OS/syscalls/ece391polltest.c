@@ -0,0 +1,66 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE 128
+#define RTC_FREQ 8
+
+/*
+ * Counts RTC ticks while echoing typed lines, with one poll waiting on
+ * both.  Type "q" to quit.
+ */
+int main ()
+{
+    ece391_pollfd_t fds[2];
+    uint8_t buf[BUFSIZE];
+    uint8_t num[16];
+    uint32_t ticks = 0, wakeups = 0;
+    int32_t rtc_fd, cnt, garbage;
+
+    if (-1 == (rtc_fd = ece391_open ((uint8_t*)"rtc"))) {
+        ece391_fdputs (1, (uint8_t*)"rtc open failed\n");
+        return 2;
+    }
+    cnt = RTC_FREQ;
+    ece391_write (rtc_fd, &cnt, 4);
+
+    ece391_fdputs (1, (uint8_t*)"type lines, q quits\n");
+    fds[0].fd = 0;
+    fds[0].events = POLLIN;
+    fds[1].fd = rtc_fd;
+    fds[1].events = POLLIN;
+
+    while (1) {
+        if (-1 == ece391_poll (fds, 2, -1)) {
+            ece391_fdputs (1, (uint8_t*)"poll failed\n");
+            return 2;
+        }
+        wakeups++;
+        if (fds[1].revents & POLLIN) {
+            ece391_read (rtc_fd, &garbage, 4);
+            ticks++;
+        }
+        if (fds[0].revents & POLLIN) {
+            cnt = ece391_read (0, buf, BUFSIZE - 1);
+            if (cnt > 0 && '\n' == buf[cnt - 1])
+                cnt--;
+            buf[cnt] = '\0';
+            if (0 == ece391_strcmp (buf, (uint8_t*)"q"))
+                break;
+            ece391_fdputs (1, (uint8_t*)"got \"");
+            ece391_fdputs (1, buf);
+            ece391_fdputs (1, (uint8_t*)"\" after ");
+            ece391_fdputs (1, ece391_itoa (ticks, num, 10));
+            ece391_fdputs (1, (uint8_t*)" ticks\n");
+        }
+    }
+
+    ece391_fdputs (1, (uint8_t*)"ticks: ");
+    ece391_fdputs (1, ece391_itoa (ticks, num, 10));
+    ece391_fdputs (1, (uint8_t*)", wakeups: ");
+    ece391_fdputs (1, ece391_itoa (wakeups, num, 10));
+    ece391_fdputs (1, (uint8_t*)"\n");
+    ece391_close (rtc_fd);
+    return 0;
+}
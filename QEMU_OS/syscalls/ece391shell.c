@@ -4,6 +4,70 @@
 #include "ece391syscall.h"
 
 #define BUFSIZE 1024
+#define MAXSTAGES 8
+
+/*
+ * Run "a | b | ..." with every stage started at once, each one reading
+ * the previous stage's output through a pipe.  Returns the status of the
+ * last stage or -1 if a stage could not be started.
+ */
+int32_t
+run_pipeline (uint8_t* buf)
+{
+    uint8_t* stage[MAXSTAGES];
+    int32_t pid[MAXSTAGES];
+    int32_t fds[2];
+    int32_t n, i, in, out, end, rval;
+
+    /* split on '|' and drop the spaces before each bar */
+    n = 0;
+    stage[n++] = buf;
+    for (i = 0; '\0' != buf[i]; i++) {
+        if ('|' != buf[i])
+	    continue;
+	if (MAXSTAGES == n)
+	    return -1;
+	for (end = i; end > 0 && ' ' == buf[end - 1]; end--)
+	    ;
+	buf[end] = '\0';
+	buf[i] = '\0';
+	stage[n++] = buf + i + 1;
+    }
+
+    in = 0;
+    rval = 0;
+    for (i = 0; i < n; i++) {
+	if (i == n - 1) {
+	    out = 1;
+	} else if (-1 == ece391_pipe (fds)) {
+	    ece391_fdputs (1, (uint8_t*)"pipe failed\n");
+	    break;
+	} else {
+	    out = fds[1];
+	}
+	pid[i] = ece391_spawn (stage[i], in, out);
+	/* the children hold their own copies of the ends */
+	if (0 != in)
+	    ece391_close (in);
+	in = 0;
+	if (1 != out) {
+	    ece391_close (out);
+	    in = fds[0];
+	}
+	if (-1 == pid[i])
+	    break;
+    }
+    /* a stage failed: its reader sees end of file once we let go */
+    if (0 != in)
+        ece391_close (in);
+
+    /* collect every stage that started, report the last one */
+    for (end = 0; end < i; end++)
+	rval = ece391_wait (pid[end]);
+    if (i < n)
+        rval = -1;
+    return rval;
+}
 
 int main ()
 {
@@ -24,7 +88,12 @@ int main ()
 	    return 0;
 	if ('\0' == buf[0])
 	    continue;
-	rval = ece391_execute (buf);
+	for (rval = 0; '\0' != buf[rval] && '|' != buf[rval]; rval++)
+	    ;
+	if ('|' == buf[rval])
+	    rval = run_pipeline (buf);
+	else
+	    rval = ece391_execute (buf);
 	if (-1 == rval)
 	    ece391_fdputs (1, (uint8_t*)"no such command\n");
 	else if (256 == rval)
@@ -33,4 +102,3 @@ int main ()
 	    ece391_fdputs (1, (uint8_t*)"program terminated abnormally\n");
     }
 }
-
@@ -0,0 +1,115 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define SHM_PAGES 64
+#define SHM_BYTES (SHM_PAGES * 4096)
+#define ROUNDS 16
+#define BUFSIZE 4096
+
+static uint8_t fd_buf[BUFSIZE];
+
+static inline uint32_t rdtsc_lo (void)
+{
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo;
+}
+
+static void print_num (const char* label, uint32_t value)
+{
+    uint8_t num[16];
+    ece391_fdputs (1, (uint8_t*)label);
+    ece391_fdputs (1, ece391_itoa (value, num, 10));
+    ece391_fdputs (1, (uint8_t*)"\n");
+}
+
+/* Producer: fill an anonymous segment and hand its id to a consumer. */
+static int32_t producer (void)
+{
+    int32_t id, rval;
+    uint32_t* data;
+    uint32_t i, start;
+    uint8_t cmd[32];
+
+    if (-1 == (id = ece391_shm_open (0, SHM_PAGES, 0))) {
+        ece391_fdputs (1, (uint8_t*)"shm_open failed\n");
+        return 2;
+    }
+    if (-1 == (int32_t)(data = (uint32_t*)ece391_shm_map (id, 0))) {
+        ece391_fdputs (1, (uint8_t*)"shm_map failed\n");
+        return 2;
+    }
+
+    start = rdtsc_lo ();
+    for (i = 0; i < SHM_BYTES / 4; i++)
+        data[i] = i;
+    print_num ("producer fill cycles/KB: ", (rdtsc_lo () - start) / (SHM_BYTES / 1024));
+
+    /* the consumer maps the same frames by id */
+    ece391_strcpy (cmd, (uint8_t*)"shmtest ");
+    ece391_itoa (id, cmd + 8, 10);
+    rval = ece391_execute (cmd);
+    ece391_shm_unmap (data);
+    return rval;
+}
+
+/* Consumer: read the segment in place, then move the same bytes through an fd. */
+static int32_t consumer (int32_t id)
+{
+    uint32_t* data;
+    uint32_t i, r, sum = 0, start, shm_cycles, fd_cycles, moved;
+    int32_t fd, cnt;
+
+    if (-1 == (int32_t)(data = (uint32_t*)ece391_shm_map (id, 0))) {
+        ece391_fdputs (1, (uint8_t*)"shm_map failed\n");
+        return 2;
+    }
+    for (i = 0; i < SHM_BYTES / 4; i++) {
+        if (data[i] != i) {
+            ece391_fdputs (1, (uint8_t*)"segment contents wrong\n");
+            return 1;
+        }
+    }
+
+    start = rdtsc_lo ();
+    for (r = 0; r < ROUNDS; r++)
+        for (i = 0; i < SHM_BYTES / 4; i++)
+            sum += data[i];
+    shm_cycles = rdtsc_lo () - start;
+
+    /* same number of bytes copied out of the kernel through read() */
+    moved = 0;
+    start = rdtsc_lo ();
+    while (moved < ROUNDS * SHM_BYTES) {
+        if (-1 == (fd = ece391_open ((uint8_t*)"verylargetextwithverylongname.txt")))
+            return 2;
+        while (moved < ROUNDS * SHM_BYTES && 0 < (cnt = ece391_read (fd, fd_buf, BUFSIZE))) {
+            for (i = 0; i < cnt; i++)
+                sum += fd_buf[i];
+            moved += cnt;
+        }
+        ece391_close (fd);
+    }
+    fd_cycles = rdtsc_lo () - start;
+
+    print_num ("consumer shm cycles/KB: ", shm_cycles / (ROUNDS * SHM_BYTES / 1024));
+    print_num ("consumer fd  cycles/KB: ", fd_cycles / (ROUNDS * SHM_BYTES / 1024));
+    print_num ("checksum: ", sum);
+    return 0;
+}
+
+int main ()
+{
+    uint8_t buf[32];
+    int32_t id = 0;
+    uint32_t i;
+
+    if (0 != ece391_getargs (buf, 32))
+        return producer ();
+
+    for (i = 0; buf[i] >= '0' && buf[i] <= '9'; i++)
+        id = id * 10 + buf[i] - '0';
+    return consumer (id);
+}
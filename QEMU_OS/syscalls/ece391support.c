@@ -102,3 +102,335 @@ uint8_t* ece391_strrev(uint8_t* s)
    return s;
 }
 
+
+/* 64-bit by 32-bit divide; there is no libgcc to do it for us */
+uint64_t ece391_div64(uint64_t n, uint32_t d)
+{
+    uint32_t hi = n >> 32;
+    uint32_t q_hi = hi / d;
+    uint32_t q_lo, r = hi % d;
+
+    /* r < d, so the low quotient fits in 32 bits */
+    asm ("divl %4" : "=a"(q_lo), "=d"(r) : "a"((uint32_t)n), "d"(r), "rm"(d));
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
+/* Monotonic nanoseconds, comparable between processes; 0 on failure */
+uint64_t ece391_now_ns(void)
+{
+    uint64_t ns;
+
+    if (0 != ece391_gettime (&ns))
+        return 0;
+    return ns;
+}
+
+/* Microseconds since a time from ece391_now_ns */
+uint32_t ece391_elapsed_us(uint64_t since_ns)
+{
+    return (uint32_t)ece391_div64 (ece391_now_ns () - since_ns, 1000);
+}
+
+
+/*
+ * Thread stacks are carved from the top of the user page below the
+ * THREAD_MAIN_STACK bytes left to the first thread, so they need no
+ * memory from the program image.
+ */
+#define USER_PAGE_END 0x8400000
+#define THREAD_MAIN_STACK 0x10000
+
+typedef struct thread_slot {
+    volatile int32_t tid;       /* 0 free, -1 claimed, else the thread */
+    int32_t (*fn)(void* arg);
+    void* arg;
+} thread_slot_t;
+
+static thread_slot_t thread_slots[THREAD_MAX];
+
+/* Atomically store v in *p and return the old value */
+static int32_t atomic_xchg(volatile int32_t* p, int32_t v)
+{
+    asm volatile ("xchgl %0, %1" : "+r"(v), "+m"(*p) : : "memory");
+    return v;
+}
+
+/* Atomically store v in *p if it holds old; returns what *p held */
+static int32_t atomic_cmpxchg(volatile int32_t* p, int32_t old, int32_t v)
+{
+    int32_t prev;
+
+    asm volatile ("lock; cmpxchgl %2, %1"
+                  : "=a"(prev), "+m"(*p) : "r"(v), "0"(old) : "memory");
+    return prev;
+}
+
+/* First function of every thread; its status is what fn returns */
+static void thread_start(thread_slot_t* slot)
+{
+    ece391_halt ((uint8_t)slot->fn (slot->arg));
+}
+
+/* Start fn(arg) in a new thread; returns its tid or -1 */
+int32_t ece391_thread_create(int32_t (*fn)(void* arg), void* arg)
+{
+    int32_t i, tid;
+    uint32_t stack;
+
+    /* other threads may be creating threads too */
+    for (i = 0; i < THREAD_MAX; i++) {
+        if (0 == atomic_cmpxchg (&thread_slots[i].tid, 0, -1))
+            break;
+    }
+    if (THREAD_MAX == i)
+        return -1;
+    thread_slots[i].fn = fn;
+    thread_slots[i].arg = arg;
+    stack = USER_PAGE_END - THREAD_MAIN_STACK - i * THREAD_STACK;
+    tid = ece391_clone (thread_start, &thread_slots[i], (void*)stack);
+    thread_slots[i].tid = (tid < 0) ? 0 : tid;
+    return tid;
+}
+
+/* Wait for a thread this thread created; returns its status or -1 */
+int32_t ece391_thread_join(int32_t tid)
+{
+    int32_t i, status;
+
+    for (i = 0; i < THREAD_MAX; i++) {
+        if (tid == thread_slots[i].tid)
+            break;
+    }
+    if (THREAD_MAX == i || -1 == (status = ece391_wait (tid)))
+        return -1;
+    /* the thread has halted, nothing runs on its stack any more */
+    thread_slots[i].tid = 0;
+    return status;
+}
+
+/* Only enters the kernel when the mutex is already locked */
+void ece391_mutex_lock(ece391_mutex_t* m)
+{
+    int32_t c;
+
+    if (0 == (c = atomic_cmpxchg (&m->state, 0, 1)))
+        return;
+    /* mark it contended so the holder wakes someone on unlock */
+    if (2 != c)
+        c = atomic_xchg (&m->state, 2);
+    while (0 != c) {
+        ece391_futex_wait (&m->state, 2);
+        c = atomic_xchg (&m->state, 2);
+    }
+}
+
+/* Only enters the kernel when someone may be waiting */
+void ece391_mutex_unlock(ece391_mutex_t* m)
+{
+    if (2 == atomic_xchg (&m->state, 0))
+        ece391_futex_wake (&m->state, 1);
+}
+
+/* Unlock m, sleep until signaled, lock m again; may wake spuriously */
+void ece391_cond_wait(ece391_cond_t* c, ece391_mutex_t* m)
+{
+    int32_t seq = c->seq;
+
+    ece391_mutex_unlock (m);
+    /* a signal after the unlock changes seq, so the wait returns */
+    ece391_futex_wait (&c->seq, seq);
+    ece391_mutex_lock (m);
+}
+
+/* Wake one waiter */
+void ece391_cond_signal(ece391_cond_t* c)
+{
+    asm volatile ("lock; incl %0" : "+m"(c->seq) : : "memory");
+    ece391_futex_wake (&c->seq, 1);
+}
+
+/* Wake every waiter */
+void ece391_cond_broadcast(ece391_cond_t* c)
+{
+    asm volatile ("lock; incl %0" : "+m"(c->seq) : : "memory");
+    ece391_futex_wake (&c->seq, THREAD_MAX);
+}
+
+
+/*
+ * Green tasks.  A switch is one call to ece391_task_switch, a few pushes
+ * and pops.  Only when no task is ready and some sleep does the scheduler
+ * enter the kernel, blocking in a read of the RTC fd until the next tick.
+ * A tick that came while tasks ran makes that read return at once, so
+ * periodic tasks keep pace with the RTC.
+ */
+#define TASK_FREE 0
+#define TASK_READY 1
+#define TASK_SLEEPING 2
+#define TASK_JOINING 3
+#define TASK_DONE 4
+/* task stacks go below the thread stacks */
+#define TASK_STACK_TOP \
+    (USER_PAGE_END - THREAD_MAIN_STACK - THREAD_MAX * THREAD_STACK)
+
+typedef struct task {
+    uint32_t esp;               /* saved by ece391_task_switch */
+    int32_t state;
+    int32_t (*fn)(void* arg);
+    void* arg;
+    int32_t ret;                /* what fn returned, once TASK_DONE */
+    uint32_t wait;              /* tick to wake at or task being joined */
+} task_t;
+
+extern void ece391_task_switch(uint32_t* save_esp, uint32_t next_esp);
+
+static task_t tasks[TASK_MAX];
+static int32_t task_cur;
+static int32_t task_rtc_fd = -1;
+static uint32_t task_tick;
+
+/* Next ready task after the current one, the current one last; waits for
+   RTC ticks while only sleepers are left.  -1 if no task can run again */
+static int32_t task_next(void)
+{
+    int32_t i, id, sleepers, garbage;
+
+    while (1) {
+        sleepers = 0;
+        for (i = 1; i <= TASK_MAX; i++) {
+            id = (task_cur + i) % TASK_MAX;
+            if (TASK_READY == tasks[id].state)
+                return id;
+            if (TASK_SLEEPING == tasks[id].state)
+                sleepers = 1;
+        }
+        if (!sleepers || -1 == task_rtc_fd)
+            return -1;
+        /* every task is blocked, so let the kernel run something else */
+        ece391_read (task_rtc_fd, &garbage, 4);
+        task_tick++;
+        for (id = 0; id < TASK_MAX; id++) {
+            if (TASK_SLEEPING == tasks[id].state &&
+                (int32_t)(tasks[id].wait - task_tick) <= 0)
+                tasks[id].state = TASK_READY;
+        }
+    }
+}
+
+/* Run the next task after the caller set its own state; -1 if none can */
+static int32_t task_schedule(void)
+{
+    int32_t prev = task_cur;
+    int32_t next = task_next ();
+
+    if (-1 == next)
+        return -1;
+    if (next != prev) {
+        task_cur = next;
+        ece391_task_switch (&tasks[prev].esp, tasks[next].esp);
+    }
+    return 0;
+}
+
+/* First function of every spawned task */
+static void task_start(void)
+{
+    task_t* t = &tasks[task_cur];
+    int32_t id;
+
+    t->ret = t->fn (t->arg);
+    t->state = TASK_DONE;
+    for (id = 0; id < TASK_MAX; id++) {
+        if (TASK_JOINING == tasks[id].state && task_cur == tasks[id].wait)
+            tasks[id].state = TASK_READY;
+    }
+    task_schedule ();
+    /* a join that would block forever fails instead, so not reached */
+    ece391_halt (255);
+}
+
+/* Make fn(arg) a task, run once the caller blocks or yields; returns its
+   id or -1 */
+int32_t ece391_task_spawn(int32_t (*fn)(void* arg), void* arg)
+{
+    int32_t id;
+    uint32_t* sp;
+
+    /* the caller is task 0 */
+    if (TASK_FREE == tasks[0].state)
+        tasks[0].state = TASK_READY;
+    for (id = 1; id < TASK_MAX; id++) {
+        if (TASK_FREE == tasks[id].state)
+            break;
+    }
+    if (TASK_MAX == id)
+        return -1;
+
+    sp = (uint32_t*)(TASK_STACK_TOP - (id - 1) * TASK_STACK);
+    *--sp = 0;                  /* task_start never returns */
+    *--sp = (uint32_t)task_start;
+    *--sp = 0;                  /* EBP, EBX, ESI, EDI */
+    *--sp = 0;
+    *--sp = 0;
+    *--sp = 0;
+    tasks[id].esp = (uint32_t)sp;
+    tasks[id].fn = fn;
+    tasks[id].arg = arg;
+    tasks[id].state = TASK_READY;
+    return id;
+}
+
+/* Let every other ready task run once */
+void ece391_task_yield(void)
+{
+    task_schedule ();
+}
+
+/* Wait for a task to return and free it; returns what it returned, or -1
+   if id is not a task or waiting would block every task forever */
+int32_t ece391_task_join(int32_t id)
+{
+    if (id <= 0 || id >= TASK_MAX || id == task_cur ||
+        TASK_FREE == tasks[id].state)
+        return -1;
+    if (TASK_DONE != tasks[id].state) {
+        tasks[task_cur].state = TASK_JOINING;
+        tasks[task_cur].wait = id;
+        if (-1 == task_schedule ()) {
+            tasks[task_cur].state = TASK_READY;
+            return -1;
+        }
+        /* another joiner may have taken it first */
+        if (TASK_DONE != tasks[id].state)
+            return -1;
+    }
+    tasks[id].state = TASK_FREE;
+    return tasks[id].ret;
+}
+
+/* Count sleeps in ticks of this RTC fd, opened and rate set by the caller */
+void ece391_task_set_rtc(int32_t fd)
+{
+    task_rtc_fd = fd;
+}
+
+/* Ticks the scheduler has seen */
+uint32_t ece391_task_ticks(void)
+{
+    return task_tick;
+}
+
+/* Block the calling task until tick; -1 without an RTC fd */
+int32_t ece391_task_sleep_until(uint32_t tick)
+{
+    if (-1 == task_rtc_fd)
+        return -1;
+    if ((int32_t)(tick - task_tick) <= 0)
+        return 0;
+    if (TASK_FREE == tasks[0].state)
+        tasks[0].state = TASK_READY;
+    tasks[task_cur].state = TASK_SLEEPING;
+    tasks[task_cur].wait = tick;
+    task_schedule ();
+    return 0;
+}
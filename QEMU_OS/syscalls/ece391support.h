@@ -8,6 +8,44 @@ extern int32_t ece391_strcmp(const uint8_t* s1, const uint8_t* s2);
 extern int32_t ece391_strncmp(const uint8_t* s1, const uint8_t* s2, uint32_t n);
 extern uint8_t *ece391_itoa(uint32_t value, uint8_t* buf, int32_t radix);
 extern uint8_t *ece391_strrev(uint8_t* s);
+extern uint64_t ece391_div64(uint64_t n, uint32_t d);
+extern uint64_t ece391_now_ns(void);
+extern uint32_t ece391_elapsed_us(uint64_t since_ns);
+
+/* Threads on clone, at most THREAD_MAX at a time, each with a
+   THREAD_STACK byte stack */
+#define THREAD_MAX 8
+#define THREAD_STACK 0x4000
+typedef struct ece391_mutex {
+    volatile int32_t state;     /* 0 free, 1 locked, 2 locked with waiters */
+} ece391_mutex_t;
+typedef struct ece391_cond {
+    volatile int32_t seq;       /* bumped by every signal */
+} ece391_cond_t;
+#define ECE391_MUTEX_INIT {0}
+#define ECE391_COND_INIT {0}
+
+extern int32_t ece391_thread_create(int32_t (*fn)(void* arg), void* arg);
+extern int32_t ece391_thread_join(int32_t tid);
+extern void ece391_mutex_lock(ece391_mutex_t* m);
+extern void ece391_mutex_unlock(ece391_mutex_t* m);
+extern void ece391_cond_wait(ece391_cond_t* c, ece391_mutex_t* m);
+extern void ece391_cond_signal(ece391_cond_t* c);
+extern void ece391_cond_broadcast(ece391_cond_t* c);
+
+/* Green tasks: cooperative tasks inside one thread, switched without the
+   kernel.  The caller is task 0; TASK_MAX - 1 more can be spawned, each
+   with a TASK_STACK byte stack.  Sleeps count reads of the RTC fd given to
+   ece391_task_set_rtc. */
+#define TASK_MAX 8
+#define TASK_STACK 0x2000
+
+extern int32_t ece391_task_spawn(int32_t (*fn)(void* arg), void* arg);
+extern void ece391_task_yield(void);
+extern int32_t ece391_task_join(int32_t id);
+extern void ece391_task_set_rtc(int32_t fd);
+extern uint32_t ece391_task_ticks(void);
+extern int32_t ece391_task_sleep_until(uint32_t tick);
 
 #endif /* ECE391SUPPORT_H */
 
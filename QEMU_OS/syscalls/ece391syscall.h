@@ -22,6 +22,171 @@ extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
 
+/*
+ * Shared memory.  shm_open returns a segment id; a NULL or empty name
+ * creates an anonymous segment, SHM_FILE fills the segment from the file
+ * called name.  shm_map maps the segment at addr (page aligned, at or
+ * above 136MB and below 1GB) or picks an address when addr is NULL, and
+ * returns it.
+ */
+#define SHM_FILE 0x1
+extern int32_t ece391_shm_open (const uint8_t* name, int32_t npages, int32_t flags);
+extern int32_t ece391_shm_map (int32_t id, void* addr);
+extern int32_t ece391_shm_unmap (void* addr);
+
+/*
+ * Processes and pipes.  spawn starts command alongside the caller with
+ * the caller's in_fd and out_fd as its stdin and stdout and returns its
+ * pid; wait blocks until that child halts and returns its status.  pipe
+ * stores a read fd in fds[0] and a write fd in fds[1]; reads return 0
+ * once every write end is closed.  isatty returns 1 for the terminal.
+ */
+extern int32_t ece391_spawn (const uint8_t* command, int32_t in_fd, int32_t out_fd);
+extern int32_t ece391_wait (int32_t pid);
+extern int32_t ece391_pipe (int32_t fds[2]);
+extern int32_t ece391_isatty (int32_t fd);
+
+/*
+ * Synchronous message passing.  A message is two words plus up to
+ * IPC_MAX_BUF bytes at buf.  send blocks until pid has received it; recv
+ * waits for a message from pid (-1 for anyone), fills msg and returns the
+ * sender; call sends and waits for the reply in the same msg; reply answers
+ * a caller without blocking.  buf must hold IPC_MAX_BUF bytes for recv and
+ * call, len is the number of bytes to send and, after a receive, received.
+ */
+#define IPC_MAX_BUF 256
+typedef struct ipc_msg_t {
+    uint32_t w0;
+    uint32_t w1;
+    uint8_t* buf;
+    int32_t len;
+} ipc_msg_t;
+extern int32_t ece391_send (int32_t pid, ipc_msg_t* msg);
+extern int32_t ece391_recv (int32_t pid, ipc_msg_t* msg);
+extern int32_t ece391_call (int32_t pid, ipc_msg_t* msg);
+extern int32_t ece391_reply (int32_t pid, ipc_msg_t* msg);
+
+/*
+ * Wait on several fds.  poll sets revents in each entry to the subset of
+ * events that is ready (POLLNVAL for a closed fd) and returns how many
+ * entries have revents set.  timeout is 0 to only check or -1 to wait;
+ * poll an RTC fd as well to wake up on ticks.  Polling the terminal for
+ * POLLIN starts taking a line, it is ready once enter is pressed.
+ */
+#define POLLIN   0x01
+#define POLLOUT  0x04
+#define POLLNVAL 0x20
+typedef struct ece391_pollfd_t {
+    int32_t fd;
+    int16_t events;
+    int16_t revents;
+} ece391_pollfd_t;
+extern int32_t ece391_poll (ece391_pollfd_t* fds, int32_t nfds, int32_t timeout);
+
+/*
+ * Device specific commands on an fd.  On the terminal, TERM_SETMODE with
+ * raw set makes read return ece391_key_event_t records as keys are
+ * pressed and released instead of lines.  read waits for min events, or
+ * with a timeout (ms) for one event until the timeout passes, and returns
+ * every queued event that fits (0 bytes on timeout).  Only Alt+Fn keeps
+ * switching terminals while raw; the terminal goes back to lines when the
+ * program sets raw to 0 or exits.
+ */
+#define TERM_GETMODE 1
+#define TERM_SETMODE 2
+typedef struct ece391_term_mode_t {
+    int32_t raw;
+    int32_t min;
+    int32_t timeout;
+} ece391_term_mode_t;
+#define KEY_MOD_SHIFT 0x1
+#define KEY_MOD_CTRL  0x2
+#define KEY_MOD_ALT   0x4
+#define KEY_MOD_CAPS  0x8
+#define KEY_RELEASE   0x80
+typedef struct ece391_key_event_t {
+    uint8_t code;
+    uint8_t ch;
+    uint8_t mods;
+    uint8_t pad;
+} ece391_key_event_t;
+extern int32_t ece391_ioctl (int32_t fd, int32_t cmd, void* arg);
+
+/*
+ * Real-time class.  Writing an ece391_rtc_rt_t to an RTC fd sets the rate
+ * like writing the bare freq, and also asks to run earliest deadline
+ * first ahead of other processes: each read ends a job, the first tick
+ * after its period is over starts the next one, due one period later,
+ * whatever rate other processes set, and each job may use up to
+ * budget_us of CPU before it runs like any other process until the next
+ * job.  The write fails if the budgets already admitted leave no room; a
+ * budget of 0 leaves the class.  ioctl RTC_RT_MISSES on the fd returns
+ * how many jobs finished after their deadline.
+ */
+#define RTC_RT_MISSES 1
+typedef struct ece391_rtc_rt_t {
+    int32_t freq;
+    int32_t budget_us;
+} ece391_rtc_rt_t;
+
+/*
+ * Double-buffered vidmap.  vidmap_back maps a back buffer holding a copy
+ * of the screen where vidmap would map video memory; drawing into it
+ * shows nothing until flip.  flip waits for vertical retrace while the
+ * terminal is on screen, copies the 16-byte spans that changed since the
+ * last flip and returns how many it copied.
+ */
+extern int32_t ece391_vidmap_back (uint8_t** screen_start);
+extern int32_t ece391_flip (void);
+
+/*
+ * Store n cells into the terminal's 80x25 window in one call.  Unlike
+ * write, nothing is interpreted: the cursor does not move and the screen
+ * does not scroll.  Cells outside the window are skipped; returns how many
+ * were stored.
+ */
+typedef struct ece391_cell_t {
+    uint8_t row;
+    uint8_t col;
+    uint8_t ch;
+    uint8_t attr;
+} ece391_cell_t;
+extern int32_t ece391_put_cells (const ece391_cell_t* cells, int32_t n);
+
+/*
+ * Timers, in milliseconds with 1ms resolution.  sleep blocks for at
+ * least ms.  timer_arm arms one-shot timer id (0 to 7) to fire ms from
+ * now, or disarms it when ms is 0.  timer_wait blocks until at least one
+ * armed timer has fired and returns the mask of timers that fired since
+ * the last timer_wait (bit id set), or 0 right away if none is armed.
+ * Both fail for ms over 4294966 (about 71 minutes).
+ */
+#define MAX_USER_TIMERS 8
+extern int32_t ece391_sleep (int32_t ms);
+extern int32_t ece391_timer_arm (int32_t id, int32_t ms);
+extern int32_t ece391_timer_wait (void);
+
+/*
+ * Monotonic clock: nanoseconds since boot, from the TSC calibrated
+ * against the PIT.  Every process reads the same clock.  See also
+ * ece391_now_ns and ece391_elapsed_us in ece391support.h.
+ */
+extern int32_t ece391_gettime (uint64_t* ns);
+
+/*
+ * Threads.  clone starts a thread in the caller's address space at entry,
+ * called with arg on the user stack that ends at stack, and returns its
+ * pid.  The thread gets copies of the caller's fds, ends with halt and is
+ * collected by its creator with wait.  When the first thread of a program
+ * halts, every other one halts with it.  futex_wait sleeps only while the
+ * int at addr still holds val and returns 0 when woken by futex_wake,
+ * which wakes up to n sleepers on addr and returns how many it woke.  See
+ * the thread, mutex and condition variable calls in ece391support.h.
+ */
+extern int32_t ece391_clone (void* entry, void* arg, void* stack);
+extern int32_t ece391_futex_wait (volatile int32_t* addr, int32_t val);
+extern int32_t ece391_futex_wake (volatile int32_t* addr, int32_t n);
+
 enum signums {
 	DIV_ZERO = 0,
 	SEGFAULT,
@@ -11,5 +11,28 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_SHM_OPEN   11
+#define SYS_SHM_MAP    12
+#define SYS_SHM_UNMAP  13
+#define SYS_SPAWN      14
+#define SYS_WAIT       15
+#define SYS_PIPE       16
+#define SYS_ISATTY     17
+#define SYS_SEND       18
+#define SYS_RECV       19
+#define SYS_CALL       20
+#define SYS_REPLY      21
+#define SYS_POLL       22
+#define SYS_IOCTL      23
+#define SYS_VIDMAP_BACK 24
+#define SYS_FLIP       25
+#define SYS_PUT_CELLS  26
+#define SYS_SLEEP      27
+#define SYS_TIMER_ARM  28
+#define SYS_TIMER_WAIT 29
+#define SYS_GETTIME    30
+#define SYS_CLONE      31
+#define SYS_FUTEX_WAIT 32
+#define SYS_FUTEX_WAKE 33
 
 #endif /* ECE391SYSNUM_H */
@@ -0,0 +1,75 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define RTC_HZ 32
+#define SWITCHES 100000
+#define BLINKS 6
+
+static volatile uint32_t pings;
+
+/* Bounces control back to whoever yields to it */
+static int32_t ponger (void* arg)
+{
+    while (pings < SWITCHES) {
+        pings++;
+        ece391_task_yield ();
+    }
+    return 0;
+}
+
+/* Prints its name every period ticks, BLINKS times, on a fixed schedule */
+static int32_t blinker (void* arg)
+{
+    uint32_t period = (uint32_t)arg;
+    uint32_t next = ece391_task_ticks ();
+    uint8_t num[16];
+    int32_t i;
+
+    for (i = 0; i < BLINKS; i++) {
+        next += period;
+        ece391_task_sleep_until (next);
+        ece391_fdputs (1, (uint8_t*)"blink every ");
+        ece391_fdputs (1, ece391_itoa (period, num, 10));
+        ece391_fdputs (1, (uint8_t*)" ticks at tick ");
+        ece391_fdputs (1, ece391_itoa (ece391_task_ticks (), num, 10));
+        ece391_fdputs (1, (uint8_t*)"\n");
+    }
+    return period;
+}
+
+/*
+ * Times yields between two green tasks, then runs two blinkers off one
+ * RTC fd; the process only blocks in the kernel when both are asleep.
+ */
+int main ()
+{
+    int32_t id[2], rtc_fd, hz = RTC_HZ;
+    uint8_t num[16];
+    uint64_t start;
+
+    if (-1 == (id[0] = ece391_task_spawn (ponger, 0)))
+        return 2;
+    start = ece391_now_ns ();
+    while (pings < SWITCHES)
+        ece391_task_yield ();
+    ece391_fdputs (1, (uint8_t*)"ns per switch: ");
+    ece391_fdputs (1, ece391_itoa ((uint32_t)ece391_div64 (ece391_now_ns () -
+                   start, 2 * SWITCHES), num, 10));
+    ece391_fdputs (1, (uint8_t*)"\n");
+    ece391_task_join (id[0]);
+
+    rtc_fd = ece391_open ((uint8_t*)"rtc");
+    if (-1 == rtc_fd || -1 == ece391_write (rtc_fd, &hz, 4))
+        return 2;
+    ece391_task_set_rtc (rtc_fd);
+    id[0] = ece391_task_spawn (blinker, (void*)4);
+    id[1] = ece391_task_spawn (blinker, (void*)10);
+    if (4 != ece391_task_join (id[0]) || 10 != ece391_task_join (id[1])) {
+        ece391_fdputs (1, (uint8_t*)"bad join\n");
+        return 1;
+    }
+    ece391_close (rtc_fd);
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define NUM_WORKERS 4
+#define INCREMENTS 20000
+#define ITEMS 50
+
+static ece391_mutex_t lock = ECE391_MUTEX_INIT;
+static ece391_cond_t changed = ECE391_COND_INIT;
+static volatile uint32_t counter;
+static volatile int32_t slot;       /* 0 empty, else the item in it */
+static volatile uint32_t consumed;
+
+/* Bumps the shared counter, taking the lock every time */
+static int32_t adder (void* arg)
+{
+    int32_t i;
+
+    for (i = 0; i < INCREMENTS; i++) {
+        ece391_mutex_lock (&lock);
+        counter++;
+        ece391_mutex_unlock (&lock);
+    }
+    return (int32_t)arg;
+}
+
+/* Takes ITEMS items out of the one-item slot, sleeping while it is empty */
+static int32_t consumer (void* arg)
+{
+    int32_t i;
+
+    for (i = 0; i < ITEMS; i++) {
+        ece391_mutex_lock (&lock);
+        while (0 == slot)
+            ece391_cond_wait (&changed, &lock);
+        consumed += slot;
+        slot = 0;
+        ece391_cond_broadcast (&changed);
+        ece391_mutex_unlock (&lock);
+    }
+    return 0;
+}
+
+static void put_result (const char* what, uint32_t got, uint32_t want)
+{
+    uint8_t num[16];
+
+    ece391_fdputs (1, (uint8_t*)what);
+    ece391_fdputs (1, ece391_itoa (got, num, 10));
+    ece391_fdputs (1, (uint8_t*)(got == want ? " ok\n" : " WRONG\n"));
+}
+
+/*
+ * Runs NUM_WORKERS threads adding to one counter under a mutex, then a
+ * producer and consumer handing items over through a condition variable.
+ * Contended locks and empty slots sleep in futex_wait instead of spinning.
+ */
+int main ()
+{
+    int32_t tid[NUM_WORKERS];
+    int32_t i, status, bad = 0;
+    uint8_t num[16];
+    uint64_t start = ece391_now_ns ();
+
+    for (i = 0; i < NUM_WORKERS; i++) {
+        if (-1 == (tid[i] = ece391_thread_create (adder, (void*)(i + 1)))) {
+            ece391_fdputs (1, (uint8_t*)"thread_create failed\n");
+            return 2;
+        }
+    }
+    for (i = 0; i < NUM_WORKERS; i++) {
+        status = ece391_thread_join (tid[i]);
+        if (status != i + 1)
+            bad = 1;
+    }
+    put_result ("counter ", counter, NUM_WORKERS * INCREMENTS);
+    if (bad)
+        ece391_fdputs (1, (uint8_t*)"bad join status\n");
+
+    if (-1 == (tid[0] = ece391_thread_create (consumer, 0))) {
+        ece391_fdputs (1, (uint8_t*)"thread_create failed\n");
+        return 2;
+    }
+    for (i = 1; i <= ITEMS; i++) {
+        ece391_mutex_lock (&lock);
+        while (0 != slot)
+            ece391_cond_wait (&changed, &lock);
+        slot = i;
+        ece391_cond_broadcast (&changed);
+        ece391_mutex_unlock (&lock);
+    }
+    ece391_thread_join (tid[0]);
+    put_result ("consumed ", consumed, ITEMS * (ITEMS + 1) / 2);
+
+    ece391_fdputs (1, (uint8_t*)"took ");
+    ece391_fdputs (1, ece391_itoa (ece391_elapsed_us (start), num, 10));
+    ece391_fdputs (1, (uint8_t*)"us\n");
+    return 0;
+}
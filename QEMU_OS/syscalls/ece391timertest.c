@@ -0,0 +1,51 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define NUM_BLINKERS 3
+#define ROUNDS 12
+
+/*
+ * Sleeps a few times, then runs three blinkers at different rates off
+ * one-shot timers: each round waits for whichever timers fired and
+ * re-arms only those, so the work done follows the timers that fire.
+ */
+int main ()
+{
+    static const int32_t period[NUM_BLINKERS] = {250, 400, 650};
+    uint8_t num[16];
+    int32_t i, round, fired;
+    uint32_t count[NUM_BLINKERS];
+
+    for (i = 1; i <= 3; i++) {
+        ece391_sleep (300);
+        ece391_fdputs (1, (uint8_t*)"slept 300ms x");
+        ece391_fdputs (1, ece391_itoa (i, num, 10));
+        ece391_fdputs (1, (uint8_t*)"\n");
+    }
+
+    for (i = 0; i < NUM_BLINKERS; i++) {
+        count[i] = 0;
+        ece391_timer_arm (i, period[i]);
+    }
+    for (round = 0; round < ROUNDS; round++) {
+        fired = ece391_timer_wait ();
+        for (i = 0; i < NUM_BLINKERS; i++) {
+            if (!(fired & (1 << i)))
+                continue;
+            count[i]++;
+            ece391_timer_arm (i, period[i]);
+            ece391_fdputs (1, (uint8_t*)"timer ");
+            ece391_fdputs (1, ece391_itoa (i, num, 10));
+            ece391_fdputs (1, (uint8_t*)" (");
+            ece391_fdputs (1, ece391_itoa (period[i], num, 10));
+            ece391_fdputs (1, (uint8_t*)"ms) fired, ");
+            ece391_fdputs (1, ece391_itoa (count[i], num, 10));
+            ece391_fdputs (1, (uint8_t*)" times\n");
+        }
+    }
+    for (i = 0; i < NUM_BLINKERS; i++)
+        ece391_timer_arm (i, 0);
+    return 0;
+}